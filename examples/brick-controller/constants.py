@@ -9,6 +9,7 @@ MQTT_BROKER = "NNN.NNN.NNN.NNN"
 MQTT_PORT = 1883
 MQTT_TOPIC_COMMAND = "brickcommander/command"
 MQTT_TOPIC_RESPONSE = "brickcommander/status"
+MQTT_TOPIC_BACKPRESSURE = "brickcommander/backpressure"
 
 # Window settings
 WINDOW_TITLE = "BrickCommander Motor Controller v20250718"
@@ -12,12 +12,26 @@ cmd = {
     "direction": self.direction,
     "disconnect": disconnect
 }
+
+Commands are throttled per brick to the rate recommended by the
+BrickCommander on the backpressure topic, where the bricks are named by
+their controller key "controller|mac". A command sent too early is held
+back and replaced by newer commands, so only the latest one is sent.
+Disconnect commands are never held back.
 """
 
 import json
+import os
+import sys
+import threading
+import time
 import paho.mqtt.client as mqtt
 from PySide6.QtCore import Signal, QObject
-from constants import MQTT_BROKER, MQTT_PORT, MQTT_TOPIC_COMMAND, MQTT_TOPIC_RESPONSE
+from constants import MQTT_BROKER, MQTT_PORT, MQTT_TOPIC_COMMAND, MQTT_TOPIC_RESPONSE, MQTT_TOPIC_BACKPRESSURE
+
+# Decoder for the json, msgpack and fixed payload encodings, shared with the tools
+sys.path.append(os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "..", "tools"))
+from brickcodec import decode  # pylint: disable=wrong-import-position
 
 class MqttHandler(QObject):
     message_received = Signal(str)  # Define a signal to carry the message
@@ -31,6 +45,12 @@ class MqttHandler(QObject):
         self.client.on_message = self.on_message
         self.client.on_log = self.on_log  # optional for debug
 
+        # Backpressure: recommended rate per controller key, last send time and held back command
+        self.rates = {}
+        self.last_sent = {}
+        self.pending = {}
+        self.lock = threading.Lock()
+
     def on_connect(self, client, userdata, flags, rc):
         #pylint: disable=unused-argument
         if rc == 0:
@@ -39,6 +59,9 @@ class MqttHandler(QObject):
             # subscribe to response topic
             client.subscribe(MQTT_TOPIC_RESPONSE)
             print(f"[MQTT] Subscribed to {MQTT_TOPIC_RESPONSE}")
+            # subscribe to backpressure topic
+            client.subscribe(MQTT_TOPIC_BACKPRESSURE)
+            print(f"[MQTT] Subscribed to {MQTT_TOPIC_BACKPRESSURE}")
         else:
             print(f"[MQTT] Connection failed with code {rc}")
 
@@ -51,10 +74,13 @@ class MqttHandler(QObject):
         #pylint: disable=unused-argument
         # handle incoming messages here
         try:
-            payload = msg.payload.decode()
-            print(f"[MQTT] Received on {msg.topic}: {payload}")
-            # emit signal so GUI can update
-            self.message_received.emit(payload)
+            data = decode(msg.payload)
+            print(f"[MQTT] Received on {msg.topic}: {data}")
+            if msg.topic == MQTT_TOPIC_BACKPRESSURE:
+                self.update_rates(data)
+                return
+            # emit signal so GUI can update, as JSON whatever the status encoding
+            self.message_received.emit(json.dumps(data))
         except Exception as e:
             print(f"[MQTT] Failed to process message: {e}")
 
@@ -77,10 +103,40 @@ class MqttHandler(QObject):
             self.connected = False
             print("[MQTT] Disconnected")
 
+    def update_rates(self, data: dict):
+        """Store the recommended send rates from a backpressure signal."""
+        with self.lock:
+            for key, signal in data.get("c", {}).items():
+                self.rates[key] = max(1, signal.get("rate", 1))
+
     def send_command(self, cmd: dict):
         if not self.connected:
             print("[MQTT] Not connected, cannot send command")
             return
+        key = f"{cmd.get('controller', '').lower()}|{cmd.get('mac', '')}"
+        with self.lock:
+            if not cmd.get("disconnect", False):
+                wait = self.last_sent.get(key, 0) + 1.0 / self.rates.get(key, 1000) - time.monotonic()
+                if wait > 0:
+                    if key not in self.pending:
+                        threading.Timer(wait, self.flush_pending, [key]).start()
+                    self.pending[key] = cmd
+                    print(f"[MQTT] Throttled, holding back command for {key}")
+                    return
+            self.pending.pop(key, None)
+            self.last_sent[key] = time.monotonic()
+        self.publish_command(cmd)
+
+    def flush_pending(self, key: str):
+        """Send the latest held back command of a brick."""
+        with self.lock:
+            cmd = self.pending.pop(key, None)
+            if cmd is None:
+                return
+            self.last_sent[key] = time.monotonic()
+        self.publish_command(cmd)
+
+    def publish_command(self, cmd: dict):
         try:
             payload = json.dumps(cmd)
             self.client.publish(MQTT_TOPIC_COMMAND, payload)
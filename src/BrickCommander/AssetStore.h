@@ -0,0 +1,518 @@
+/**
+ * @file AssetStore.h
+ *
+ * @brief Flash-resident store for sequences, rule tables, calibration curves
+ *        and group definitions.
+ *
+ * Assets are kept in the data partition CONFIG::ASSET_PARTITION_LABEL (see
+ * partitions.csv), outside NVS and outside the heap. The partition is split
+ * into two banks; the active bank is memory-mapped, so assets are read in
+ * place with data() or records(), or streamed in chunks with read().
+ * Only the header of the active bank is held in RAM.
+ *
+ * Bank layout (little-endian):
+ * - Header (32 bytes): magic, format, count, generation, directory offset,
+ *   used bytes, directory CRC32, header CRC32.
+ * - Asset data, each asset 4-byte aligned.
+ * - Directory: one AssetEntry per asset (name, type, version, record size,
+ *   offset, length, CRC32).
+ *
+ * Updates are atomic: a new or replaced asset is streamed into the inactive
+ * bank, the unchanged assets are copied behind it, and the header with the
+ * next generation is written last. A power loss before that leaves the
+ * active bank untouched. Flash sectors of the inactive bank are erased as the
+ * data reaches them, so no single call blocks for the erase of a whole bank.
+ * An asset is only replaced by a higher version.
+ *
+ * Pointers returned by data() and records() stay valid until the next
+ * committed update.
+ *
+ * Example:
+ * @code
+ * AssetStore& assets = AssetStore::getInstance();
+ * const AssetEntry* entry = assets.find("loop1");
+ * size_t count = 0;
+ * const SequenceStep* steps = entry ? assets.records<SequenceStep>(*entry, count) : nullptr;
+ * @endcode
+ *
+ * Author: Robert W.B. Linn
+ * Copyright © 2025 Robert W.B. Linn
+ * License: MIT — see LICENSE file.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <esp_partition.h>
+#include <esp_rom_crc.h>
+#include "Log.h"
+#include "Configuration.h"
+#include "Constants.h"
+
+/**
+ * @brief Directory entry of an asset, stored in flash.
+ */
+struct AssetEntry {
+    char     name[ASSET::NAME_SIZE];    ///< Zero-terminated name
+    uint32_t offset;                    ///< Start of the data in the bank
+    uint32_t length;                    ///< Data length in bytes
+    uint32_t crc;                       ///< CRC32 of the data
+    uint16_t version;                   ///< Asset version, increases with each update
+    uint16_t recordSize;                ///< Size of one record, 0 = unstructured
+    uint8_t  type;                      ///< ASSET::Type
+    uint8_t  reserved[3];
+};
+static_assert(sizeof(AssetEntry) == 36, "AssetEntry is a flash format");
+
+/**
+ * @class AssetStore
+ * @brief Singleton managing the asset partition.
+ */
+class AssetStore {
+public:
+    /**
+     * @brief Access the singleton instance.
+     */
+    static AssetStore& getInstance() {
+        static AssetStore instance;
+        return instance;
+    }
+
+    /**
+     * @brief Find the asset partition and map the newest valid bank.
+     * @return true if the partition was found.
+     */
+    bool begin() {
+        partition_ = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY,
+                                              CONFIG::ASSET_PARTITION_LABEL);
+        if (!partition_) {
+            LOGW("[AssetStore][begin] No partition %s, assets disabled", CONFIG::ASSET_PARTITION_LABEL);
+            return false;
+        }
+
+        // Banks are aligned to the 64 KB MMU pages so they can be mapped separately
+        bankSize_ = (partition_->size / 2) & ~(MMAP_PAGE_SIZE - 1);
+        if (bankSize_ < ASSET::SECTOR_SIZE) {
+            LOGE("[AssetStore][begin] Partition %s too small", CONFIG::ASSET_PARTITION_LABEL);
+            partition_ = nullptr;
+            return false;
+        }
+
+        Header headers[2];
+        int8_t newest = -1;
+        for (uint8_t bank = 0; bank < 2; bank++) {
+            if (!loadHeader(bank, headers[bank])) continue;
+            if (newest < 0 || headers[bank].generation > headers[newest].generation) newest = bank;
+        }
+        if (newest >= 0) {
+            activate(newest, headers[newest]);
+        }
+
+        LOGI("[AssetStore][begin] %u assets, generation %u, %u of %u bytes used",
+             count(), header_.generation, used(), bankSize_);
+        return true;
+    }
+
+    /**
+     * @brief Check if the asset partition is available.
+     */
+    bool isAvailable() const {
+        return partition_ != nullptr;
+    }
+
+    /**
+     * @brief Get the number of assets.
+     */
+    uint16_t count() const {
+        return active_ >= 0 ? header_.count : 0;
+    }
+
+    /**
+     * @brief Get the generation of the active bank, increases with each update.
+     */
+    uint32_t generation() const {
+        return header_.generation;
+    }
+
+    /**
+     * @brief Get the bytes used in the active bank.
+     */
+    uint32_t used() const {
+        return active_ >= 0 ? header_.size : 0;
+    }
+
+    /**
+     * @brief Get the size of a bank, the maximum of all assets including the directory.
+     */
+    uint32_t capacity() const {
+        return bankSize_;
+    }
+
+    /**
+     * @brief Get the directory entry of an asset.
+     * @param index 0…count()-1.
+     * @param entry Receives the entry.
+     * @return false if out of range.
+     */
+    bool entryAt(uint16_t index, AssetEntry& entry) const {
+        if (index >= count()) return false;
+        return readBank(active_, header_.directoryOffset + index * sizeof(AssetEntry), &entry, sizeof(entry));
+    }
+
+    /**
+     * @brief Find an asset by name.
+     * @param name Asset name.
+     * @return Entry in the mapped directory, nullptr if not found or not mapped.
+     */
+    const AssetEntry* find(const char* name) const {
+        if (!base_) return nullptr;
+        const AssetEntry* dir = reinterpret_cast<const AssetEntry*>(base_ + header_.directoryOffset);
+        for (uint16_t i = 0; i < header_.count; i++) {
+            if (strncmp(dir[i].name, name, ASSET::NAME_SIZE) == 0) return &dir[i];
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief Get the data of an asset in mapped flash.
+     * @return Pointer to the data, nullptr if not mapped.
+     */
+    const uint8_t* data(const AssetEntry& entry) const {
+        return base_ ? base_ + entry.offset : nullptr;
+    }
+
+    /**
+     * @brief Get the records of an asset in mapped flash.
+     * @tparam T Record type, its size must match the record size of the asset.
+     * @param entry Asset.
+     * @param count Receives the number of records.
+     * @return Pointer to the first record, nullptr if not mapped or the record size differs.
+     */
+    template <typename T>
+    const T* records(const AssetEntry& entry, size_t& count) const {
+        count = 0;
+        if (!base_ || entry.recordSize != sizeof(T)) return nullptr;
+        count = entry.length / sizeof(T);
+        return reinterpret_cast<const T*>(base_ + entry.offset);
+    }
+
+    /**
+     * @brief Read a chunk of an asset into a buffer, without the mapping.
+     * @param entry Asset.
+     * @param offset Offset in the asset.
+     * @param buffer Destination.
+     * @param length Bytes to read.
+     * @return Bytes read, less at the end of the asset.
+     */
+    size_t read(const AssetEntry& entry, uint32_t offset, void* buffer, size_t length) const {
+        if (active_ < 0 || offset >= entry.length) return 0;
+        if (length > entry.length - offset) length = entry.length - offset;
+        return readBank(active_, entry.offset + offset, buffer, length) ? length : 0;
+    }
+
+    /**
+     * @brief Check the data of an asset against its CRC32.
+     */
+    bool verify(const AssetEntry& entry) const {
+        return active_ >= 0 && crcOf(active_, entry.offset, entry.length) == entry.crc;
+    }
+
+    // ------------------------------------------------------------------------
+    // Update
+    // ------------------------------------------------------------------------
+
+    /**
+     * @brief Start adding or replacing an asset. The data follows with writeUpdate().
+     * @param name Asset name, at most ASSET::NAME_SIZE-1 characters.
+     * @param type ASSET::Type.
+     * @param version Version, must be higher than the stored version.
+     * @param recordSize Size of one record, 0 = unstructured.
+     * @param length Data length in bytes.
+     * @param crc CRC32 of the data.
+     * @param error Receives the reason if refused.
+     * @return true if the update was started.
+     */
+    bool beginUpdate(const char* name, uint8_t type, uint16_t version, uint16_t recordSize,
+                     uint32_t length, uint32_t crc, String& error) {
+        abortUpdate();
+        if (!partition_) { error = "No asset partition"; return false; }
+
+        size_t nameLength = strlen(name);
+        if (nameLength == 0 || nameLength >= ASSET::NAME_SIZE) { error = "Invalid asset name"; return false; }
+        if (type >= ASSET::TYPE_COUNT) { error = "Invalid asset type"; return false; }
+        if (recordSize > 0 && length % recordSize != 0) { error = "Length is not a multiple of the record size"; return false; }
+
+        uint32_t keptBytes = 0;
+        uint16_t keptCount = 0;
+        AssetEntry e;
+        for (uint16_t i = 0; entryAt(i, e); i++) {
+            if (strncmp(e.name, name, ASSET::NAME_SIZE) == 0) {
+                if (version <= e.version) { error = "Version must be higher than " + String(e.version); return false; }
+                continue;
+            }
+            keptBytes += align(e.length);
+            keptCount++;
+        }
+        if (keptCount + 1 > CONFIG::ASSET_MAX_COUNT) { error = "Too many assets"; return false; }
+
+        uint32_t needed = sizeof(Header) + align(length) + keptBytes + (keptCount + 1) * sizeof(AssetEntry);
+        if (needed > bankSize_) { error = "No room, " + String(bankSize_ - (needed - align(length))) + " bytes free"; return false; }
+
+        startUpdate();
+        memset(&update_, 0, sizeof(update_));
+        strncpy(update_.name, name, ASSET::NAME_SIZE - 1);
+        update_.type = type;
+        update_.version = version;
+        update_.recordSize = recordSize;
+        update_.length = length;
+        update_.offset = sizeof(Header);
+        update_.crc = crc;
+        hasUpdate_ = true;
+        LOGI("[AssetStore][beginUpdate] %s v%u, %u bytes into bank %u", name, version, length, targetBank_);
+        return true;
+    }
+
+    /**
+     * @brief Write the next chunk of the asset started with beginUpdate().
+     * @param offset Offset of the chunk in the asset; a chunk already written is ignored.
+     * @param data Chunk data.
+     * @param length Chunk length.
+     * @return false if no update is in progress, the offset is out of order or the write failed.
+     */
+    bool writeUpdate(uint32_t offset, const uint8_t* data, size_t length) {
+        if (!hasUpdate_) return false;
+        if (offset + length <= received_) return true;   // Repeated chunk
+        if (offset != received_ || received_ + length > update_.length) return false;
+
+        if (!writeTarget(update_.offset + received_, data, length)) return false;
+        receivedCrc_ = esp_rom_crc32_le(receivedCrc_, data, length);
+        received_ += length;
+        return true;
+    }
+
+    /**
+     * @brief Get the bytes received for the asset being updated.
+     */
+    uint32_t updateReceived() const {
+        return received_;
+    }
+
+    /**
+     * @brief Finish the update: copy the unchanged assets and switch banks.
+     * @param error Receives the reason if failed.
+     * @return true if the new generation is active.
+     */
+    bool commitUpdate(String& error) {
+        if (!hasUpdate_) { error = "No update in progress"; return false; }
+        if (received_ != update_.length) { error = "Received " + String(received_) + " of " + String(update_.length) + " bytes"; abortUpdate(); return false; }
+        if (receivedCrc_ != update_.crc) { error = "CRC mismatch"; abortUpdate(); return false; }
+        return finish(&update_, update_.name, error);
+    }
+
+    /**
+     * @brief Remove an asset, as an atomic update.
+     * @param name Asset name.
+     * @param error Receives the reason if failed.
+     * @return true if removed.
+     */
+    bool removeAsset(const char* name, String& error) {
+        abortUpdate();
+        if (!partition_) { error = "No asset partition"; return false; }
+        AssetEntry e;
+        bool found = false;
+        for (uint16_t i = 0; entryAt(i, e); i++) {
+            if (strncmp(e.name, name, ASSET::NAME_SIZE) == 0) found = true;
+        }
+        if (!found) { error = "Unknown asset"; return false; }
+
+        startUpdate();
+        return finish(nullptr, name, error);
+    }
+
+    /**
+     * @brief Drop an update in progress; the active bank is unchanged.
+     */
+    void abortUpdate() {
+        hasUpdate_ = false;
+        received_ = 0;
+        receivedCrc_ = 0;
+    }
+
+private:
+    static constexpr uint32_t MMAP_PAGE_SIZE = 0x10000;   ///< ESP32 MMU page
+
+    /**
+     * @brief Bank header, stored in flash.
+     */
+    struct Header {
+        uint32_t magic;             ///< ASSET::MAGIC
+        uint16_t format;            ///< ASSET::FORMAT
+        uint16_t count;             ///< Number of assets
+        uint32_t generation;        ///< Higher is newer
+        uint32_t directoryOffset;   ///< Start of the directory in the bank
+        uint32_t size;              ///< Bytes used in the bank
+        uint32_t directoryCrc;      ///< CRC32 of the directory
+        uint32_t headerCrc;         ///< CRC32 of the fields above
+        uint32_t reserved;
+    };
+    static_assert(sizeof(Header) == 32, "Header is a flash format");
+
+    const esp_partition_t* partition_ = nullptr;
+    uint32_t bankSize_ = 0;
+    int8_t active_ = -1;                        ///< Active bank, -1 = store empty
+    Header header_ = {};                        ///< Header of the active bank
+    const uint8_t* base_ = nullptr;             ///< Mapped active bank
+    esp_partition_mmap_handle_t mmapHandle_ = 0;
+
+    uint8_t targetBank_ = 0;                    ///< Bank being written
+    uint32_t erasedEnd_ = 0;                    ///< Erased bytes at the start of the target bank
+    bool hasUpdate_ = false;
+    AssetEntry update_ = {};                    ///< Asset being received
+    uint32_t received_ = 0;
+    uint32_t receivedCrc_ = 0;
+
+    static uint32_t align(uint32_t n) {
+        return (n + 3) & ~3u;
+    }
+
+    bool readBank(uint8_t bank, uint32_t offset, void* buffer, size_t length) const {
+        return esp_partition_read(partition_, bank * bankSize_ + offset, buffer, length) == ESP_OK;
+    }
+
+    uint32_t crcOf(uint8_t bank, uint32_t offset, uint32_t length) const {
+        uint8_t buffer[256];
+        uint32_t crc = 0;
+        while (length > 0) {
+            size_t n = length < sizeof(buffer) ? length : sizeof(buffer);
+            if (!readBank(bank, offset, buffer, n)) return ~crc;
+            crc = esp_rom_crc32_le(crc, buffer, n);
+            offset += n;
+            length -= n;
+        }
+        return crc;
+    }
+
+    bool loadHeader(uint8_t bank, Header& h) const {
+        if (!readBank(bank, 0, &h, sizeof(h))) return false;
+        if (h.magic != ASSET::MAGIC || h.format != ASSET::FORMAT) return false;
+        if (esp_rom_crc32_le(0, reinterpret_cast<const uint8_t*>(&h), offsetof(Header, headerCrc)) != h.headerCrc) return false;
+        if (h.size > bankSize_ || h.directoryOffset + h.count * sizeof(AssetEntry) > h.size) return false;
+        if (crcOf(bank, h.directoryOffset, h.count * sizeof(AssetEntry)) != h.directoryCrc) {
+            LOGW("[AssetStore][loadHeader] Bank %u directory CRC mismatch", bank);
+            return false;
+        }
+        return true;
+    }
+
+    void activate(uint8_t bank, const Header& h) {
+        if (base_) {
+            esp_partition_munmap(mmapHandle_);
+            base_ = nullptr;
+        }
+        active_ = bank;
+        header_ = h;
+
+        const void* ptr = nullptr;
+        esp_err_t err = esp_partition_mmap(partition_, bank * bankSize_, bankSize_, ESP_PARTITION_MMAP_DATA, &ptr, &mmapHandle_);
+        if (err == ESP_OK) {
+            base_ = static_cast<const uint8_t*>(ptr);
+        } else {
+            LOGW("[AssetStore][activate] Mapping bank %u failed (%s), read() only", bank, esp_err_to_name(err));
+        }
+    }
+
+    void startUpdate() {
+        targetBank_ = active_ == 0 ? 1 : 0;
+        erasedEnd_ = 0;
+        received_ = 0;
+        receivedCrc_ = 0;
+    }
+
+    /**
+     * @brief Write to the target bank, erasing the sectors just before they are reached.
+     */
+    bool writeTarget(uint32_t offset, const void* data, size_t length) {
+        uint32_t end = offset + length;
+        if (end > bankSize_) return false;
+        while (erasedEnd_ < end) {
+            if (esp_partition_erase_range(partition_, targetBank_ * bankSize_ + erasedEnd_, ASSET::SECTOR_SIZE) != ESP_OK) {
+                LOGE("[AssetStore][writeTarget] Erase at %u failed", erasedEnd_);
+                return false;
+            }
+            erasedEnd_ += ASSET::SECTOR_SIZE;
+        }
+        return esp_partition_write(partition_, targetBank_ * bankSize_ + offset, data, length) == ESP_OK;
+    }
+
+    /**
+     * @brief Copy the assets other than skipName behind the new asset, write the directory and header.
+     * @param added Entry of the new asset, nullptr to only remove skipName.
+     */
+    bool finish(const AssetEntry* added, const char* skipName, String& error) {
+        uint32_t pos = added ? align(added->offset + added->length) : sizeof(Header);
+
+        // Data of the kept assets, flash to flash
+        uint8_t buffer[256];
+        AssetEntry e;
+        for (uint16_t i = 0; entryAt(i, e); i++) {
+            if (strncmp(e.name, skipName, ASSET::NAME_SIZE) == 0) continue;
+            for (uint32_t done = 0; done < e.length; ) {
+                size_t n = e.length - done < sizeof(buffer) ? e.length - done : sizeof(buffer);
+                if (!readBank(active_, e.offset + done, buffer, n) || !writeTarget(pos + done, buffer, n)) {
+                    error = "Flash copy failed";
+                    abortUpdate();
+                    return false;
+                }
+                done += n;
+            }
+            pos = align(pos + e.length);
+        }
+
+        // Directory, the offsets are computed again in the same order
+        Header h = {};
+        h.magic = ASSET::MAGIC;
+        h.format = ASSET::FORMAT;
+        h.generation = header_.generation + 1;
+        h.directoryOffset = pos;
+
+        uint32_t dataPos = added ? align(added->offset + added->length) : sizeof(Header);
+        uint32_t dirCrc = 0;
+        auto writeEntry = [&](const AssetEntry& entry) {
+            dirCrc = esp_rom_crc32_le(dirCrc, reinterpret_cast<const uint8_t*>(&entry), sizeof(entry));
+            bool ok = writeTarget(pos, &entry, sizeof(entry));
+            pos += sizeof(entry);
+            h.count++;
+            return ok;
+        };
+
+        bool ok = true;
+        if (added) ok = writeEntry(*added);
+        for (uint16_t i = 0; ok && entryAt(i, e); i++) {
+            if (strncmp(e.name, skipName, ASSET::NAME_SIZE) == 0) continue;
+            e.offset = dataPos;
+            dataPos = align(dataPos + e.length);
+            ok = writeEntry(e);
+        }
+        h.size = pos;
+        h.directoryCrc = dirCrc;
+        h.headerCrc = esp_rom_crc32_le(0, reinterpret_cast<const uint8_t*>(&h), offsetof(Header, headerCrc));
+
+        // The header makes the bank valid, written last
+        if (!ok || !writeTarget(0, &h, sizeof(h))) {
+            error = "Flash write failed";
+            abortUpdate();
+            return false;
+        }
+
+        abortUpdate();
+        activate(targetBank_, h);
+        LOGI("[AssetStore][finish] Generation %u active in bank %u, %u assets, %u bytes",
+             h.generation, targetBank_, h.count, h.size);
+        return true;
+    }
+
+    // Singleton: private constructor and deleted copy operations
+    AssetStore() {}
+    AssetStore(const AssetStore&) = delete;
+    AssetStore& operator=(const AssetStore&) = delete;
+};
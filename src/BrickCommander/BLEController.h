@@ -9,14 +9,76 @@
 #pragma once
 
 #include <Arduino.h>
+#include <functional>
 #include "Log.h"
+#include "HubStateStore.h"
+
+/**
+ * Result of an asynchronous write.
+ */
+enum class WriteStatus : uint8_t {
+    OK,             ///< Write acknowledged by the device
+    FAILED,         ///< Write rejected or could not be started
+    TIMEOUT,        ///< No response received in time
+    NOT_CONNECTED,  ///< Controller not connected or connection lost
+    BUSY,           ///< Too many writes in flight
+    INVALID         ///< Invalid port or level for this controller
+};
+
+/**
+ * Helper function to convert a WriteStatus to string name.
+ */
+inline const char* writeStatusName(WriteStatus status) {
+    switch (status) {
+        case WriteStatus::OK:            return "ok";
+        case WriteStatus::FAILED:        return "failed";
+        case WriteStatus::TIMEOUT:       return "timeout";
+        case WriteStatus::NOT_CONNECTED: return "not connected";
+        case WriteStatus::BUSY:          return "busy";
+        case WriteStatus::INVALID:       return "invalid";
+        default: return "unknown";
+    }
+}
+
+/**
+ * Completion callback of an asynchronous write.
+ * @param status Result of the write.
+ * @param rttUs Round-trip time in microseconds (0 if not sent).
+ */
+using WriteCallback = std::function<void(WriteStatus status, uint32_t rttUs)>;
 
 class BLEController {
 public:
-    virtual ~BLEController() = default;
+    /**
+     * Allocates the state of the controller in the HubStateStore.
+     * @param typeId Controller type id (see TELEMETRY).
+     * @param portCount Number of motor ports.
+     * @param mac BLE MAC address of the device.
+     */
+    BLEController(uint8_t typeId, uint8_t portCount, const String& mac)
+        : handle_(HubStateStore::getInstance().acquire(typeId, portCount, mac)) {}
+
+    /**
+     * Releases the state of the controller in the HubStateStore.
+     */
+    virtual ~BLEController() {
+        HubStateStore::getInstance().release(handle_);
+    }
+
+    BLEController(const BLEController&) = delete;
+    BLEController& operator=(const BLEController&) = delete;
+
+    /**
+     * Gets the handle of the controller state in the HubStateStore.
+     * @return Handle, INVALID_HUB if the store was full.
+     */
+    HubHandle getHandle() const {
+        return handle_;
+    }
 
     /**
-     * Connects to the BLE device.
+     * Connects to the BLE device with a single attempt.
+     * Retries and their backoff are done by ConnectionAdmission.
      * @return true if connection was successful, false otherwise.
      */
     virtual bool connect() = 0;
@@ -26,6 +88,12 @@ public:
      */
     virtual void disconnect() = 0;
 
+    /**
+     * Drops the BLE client objects before the BLE stack is released (see BleStack).
+     * The next connect() creates new ones. Default: nothing to drop.
+     */
+    virtual void releaseBle() {}
+
     /**
      * Sets the motor power level (raw value) for a specific port.
      * @param port Port number (typically 0–3).
@@ -33,6 +101,45 @@ public:
      */
     virtual void setPortLevel(uint8_t port, int8_t level) = 0;
 
+    /**
+     * Sets the motor power level (raw value) for a specific port without blocking.
+     * The callback is invoked from the main loop once the device acknowledged
+     * the write, or with the failure.
+     * Default implementation calls setPortLevel and invokes the callback at once.
+     * @param port Port number (typically 0–3).
+     * @param level Raw power level (-127…127).
+     * @param callback Completion callback with status and round-trip time.
+     * @return Handle of the write.
+     */
+    virtual uint32_t setPortLevelAsync(uint8_t port, int8_t level, WriteCallback callback) {
+        uint32_t start = micros();
+        setPortLevel(port, level);
+        if (callback) callback(WriteStatus::OK, micros() - start);
+        return 0;
+    }
+
+    /**
+     * Converts a power percentage (0–100%) to a raw level.
+     * @param percent Power percentage (0–100).
+     * @return Raw power level (0…127).
+     */
+    static int8_t percentToLevel(uint8_t percent) {
+        if (percent > 100) percent = 100;
+        return static_cast<int8_t>(percent * 127 / 100);
+    }
+
+    /**
+     * Converts a direction and power percentage to a raw level.
+     * forward=true maps to negative power, forward=false to positive power.
+     * @param forward true = forward direction, false = backward.
+     * @param percent Power percentage (0–100).
+     * @return Raw power level (-127…127).
+     */
+    static int8_t directionToLevel(bool forward, uint8_t percent) {
+        int8_t level = percentToLevel(percent);
+        return forward ? -level : level;
+    }
+
     /**
      * Sets the motor power as a percentage (0–100%) for a specific port.
      * Internally converted to a raw level and calls setPortLevel.
@@ -40,9 +147,7 @@ public:
      * @param percent Power percentage (0–100).
      */
     virtual void setPortPercent(uint8_t port, uint8_t percent) {
-        if (percent > 100) percent = 100;
-        int8_t level = static_cast<int8_t>(percent * 127 / 100);
-        setPortLevel(port, level);
+        setPortLevel(port, percentToLevel(percent));
     }
 
     /**
@@ -73,33 +178,52 @@ public:
      * @param percent Power percentage (default = 50%).
      */
     virtual void setDirection(uint8_t port, bool forward, uint8_t percent = 50) {
-        if (percent > 100) percent = 100;
-        int8_t level = static_cast<int8_t>(percent * 127 / 100);
-        if (forward) {
-            level = -level;
-        }
-        //if (!forward) {
-        //    level = -level;
-        //}
-
-        setPortLevel(port, level);
+        setPortLevel(port, directionToLevel(forward, percent));
     }
 
     /**
-     * Checks if the controller is currently awke.
-     * @return true if connected, false otherwise.
+     * Checks if the controller is currently awake.
+     * @return true if connected and ready, false otherwise.
      */
-    virtual bool isAwake() const { return false; }
+    virtual bool isAwake() const { return hubs().isAwake(handle_); }
 
     /**
      * Checks if the controller is currently connected.
      * @return true if connected, false otherwise.
      */
-    virtual bool isConnected() const = 0;
+    virtual bool isConnected() const { return hubs().isConnected(handle_); }
+
+    /**
+     * Gets the BLE MAC address of the device.
+     * @return MAC address, e.g. "90:84:2B:C1:94:79".
+     */
+    virtual String getMacAddress() const = 0;
+
+    /**
+     * Gets the controller type id used in the binary telemetry (see TELEMETRY).
+     * @return Type id, 0 if unknown.
+     */
+    virtual uint8_t getTypeId() const { return 0; }
+
+    /**
+     * Gets the last known battery voltage.
+     * @return Battery voltage in volts, 0 if not reported by the device.
+     */
+    virtual float getBatteryVoltage() const { return hubs().batteryMv(handle_) / 1000.0f; }
 
     /**
      * Gets the current state of the controller as a JSON string.
      * @return JSON-formatted string representing the current state.
      */
     virtual String getStateJson() = 0;
+
+protected:
+    HubHandle handle_;  ///< Index of the controller state in the HubStateStore
+
+    /**
+     * Shortcut to the HubStateStore.
+     */
+    static HubStateStore& hubs() {
+        return HubStateStore::getInstance();
+    }
 };
@@ -0,0 +1,247 @@
+/**
+ * @file Backpressure.h
+ *
+ * @brief Backpressure signal for MQTT clients, per controller and global.
+ *
+ * Clients use the signal to throttle themselves instead of piling up
+ * commands that are stale by the time they are executed:
+ * - q     Commands queued waiting for a connection plus port level writes in flight.
+ * - rate  Recommended maximum send rate in commands per second.
+ * - drop  Commands dropped (queue full), rejected (connect failed) or whose
+ *         write was rejected (busy), timed out or failed so far.
+ *
+ * The recommended rate is derived from the measured write round-trip time.
+ * Port level writes are asynchronous (GattWriter): the writes of different
+ * controllers are in flight at the same time, those of one controller are
+ * answered one after the other by its BLE link. The controller rate follows
+ * the round-trip time of its own writes, the global rate the average over all
+ * controllers and caps the controller rates. A dropped write counts as a
+ * write of CONFIG::GATT_WRITE_TIMEOUT_MS, so the rates fall while writes are
+ * rejected. A controller that waits for its connection is recommended 1 command/s.
+ *
+ * Published retained on the backpressure topic when it changes:
+ * {"q":3,"rate":24,"drop":0,"c":{"legohubno4|90:84:2B:C1:94:79":{"q":3,"rate":1,"drop":0}}}
+ *
+ * The controllers are named by their key (type|mac), as the same MAC address
+ * can be addressed with different controller types.
+ *
+ * Author: Robert W.B. Linn
+ * Copyright © 2025 Robert W.B. Linn
+ * License: MIT — see LICENSE file.
+ */
+
+#pragma once
+
+#include <map>
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "Configuration.h"
+#include "ConnectionAdmission.h"
+
+/**
+ * @class Backpressure
+ * @brief Singleton tracking command execution times and building the backpressure signal.
+ */
+class Backpressure {
+public:
+    /**
+     * @brief Access the singleton instance.
+     */
+    static Backpressure& getInstance() {
+        static Backpressure instance;
+        return instance;
+    }
+
+    /**
+     * @brief Start tracking a controller.
+     * @param key Controller key (type|mac), used as name in the signal.
+     */
+    void track(const String& key) {
+        if (controllers_.find(key) == controllers_.end()) {
+            controllers_.emplace(key, ControllerState());
+            dirty_ = true;
+        }
+    }
+
+    /**
+     * @brief Record the execution time of a command.
+     * Marks the signal changed if a recommended rate moved by more than 25%.
+     *
+     * @param key Controller key (type|mac).
+     * @param durationUs Execution time in microseconds.
+     */
+    void recordService(const String& key, uint32_t durationUs) {
+        auto it = controllers_.find(key);
+        if (it == controllers_.end()) return;
+
+        updateAverage(it->second.avgUs, durationUs);
+        updateAverage(globalAvgUs_, durationUs);
+
+        if (rateChanged(it->second.publishedRate, rateFor(it->second.avgUs)) ||
+            rateChanged(publishedRate_, rateFor(globalAvgUs_))) {
+            dirty_ = true;
+        }
+    }
+
+    /**
+     * @brief Record the start of a port level write of a controller.
+     * @param key Controller key (type|mac).
+     */
+    void writeStarted(const String& key) {
+        auto it = controllers_.find(key);
+        if (it == controllers_.end()) return;
+        it->second.inFlight++;
+        inFlight_++;
+        dirty_ = true;
+    }
+
+    /**
+     * @brief Record the completion of a port level write, whatever its status.
+     * @param key Controller key (type|mac).
+     */
+    void writeFinished(const String& key) {
+        auto it = controllers_.find(key);
+        if (it == controllers_.end() || it->second.inFlight == 0) return;
+        it->second.inFlight--;
+        if (inFlight_ > 0) inFlight_--;
+        dirty_ = true;
+    }
+
+    /**
+     * @brief Record a dropped port level write (busy, timed out or failed).
+     * Counts as a write taking CONFIG::GATT_WRITE_TIMEOUT_MS, which lowers the rates.
+     * @param key Controller key (type|mac).
+     */
+    void recordDrop(const String& key) {
+        auto it = controllers_.find(key);
+        if (it == controllers_.end()) return;
+        it->second.drops++;
+        drops_++;
+        updateAverage(it->second.avgUs, CONFIG::GATT_WRITE_TIMEOUT_MS * 1000UL);
+        updateAverage(globalAvgUs_, CONFIG::GATT_WRITE_TIMEOUT_MS * 1000UL);
+        dirty_ = true;
+    }
+
+    /**
+     * @brief Forget all controllers.
+     * Must be called before the controllers are deleted.
+     */
+    void clear() {
+        controllers_.clear();
+        inFlight_ = 0;
+        dirty_ = true;
+    }
+
+    /**
+     * @brief Check if the signal changed and is due to be published.
+     * @param nowMs Current time in ms.
+     * @return true if the signal should be published now.
+     */
+    bool isDue(uint32_t nowMs) const {
+        if (!dirty_ && admission().revision() == publishedRevision_) return false;
+        return nowMs - publishedMs_ >= CONFIG::BACKPRESSURE_MIN_INTERVAL_MS;
+    }
+
+    /**
+     * @brief Build the signal for publishing and mark it as published.
+     * @param nowMs Current time in ms.
+     * @return Compact JSON string.
+     */
+    String takeJson(uint32_t nowMs) {
+        DynamicJsonDocument doc(256 + controllers_.size() * 96);
+
+        publishedRate_ = globalRate();
+        doc["q"] = admission().queuedCount() + inFlight_;
+        doc["rate"] = publishedRate_;
+        doc["drop"] = admission().droppedCount() + drops_;
+
+        JsonObject ctrls = doc.createNestedObject("c");
+        for (auto& [key, state] : controllers_) {
+            state.publishedRate = rateFor(state.avgUs);
+            JsonObject c = ctrls.createNestedObject(key);
+            fill(c, key);
+        }
+
+        dirty_ = false;
+        publishedRevision_ = admission().revision();
+        publishedMs_ = nowMs;
+
+        String json;
+        serializeJson(doc, json);
+        return json;
+    }
+
+    /**
+     * @brief Add the signal of one controller to a JSON object, e.g. a status reply.
+     * @param obj Target object, receives q, rate and drop.
+     * @param key Controller key (type|mac).
+     */
+    void fill(JsonObject obj, const String& key) const {
+        size_t queued = admission().queuedCount(key);
+        auto it = controllers_.find(key);
+        bool tracked = it != controllers_.end();
+        uint16_t rate = tracked ? rateFor(it->second.avgUs) : globalRate();
+        if (queued > 0) rate = 1;
+        if (rate > globalRate()) rate = globalRate();
+
+        obj["q"] = queued + (tracked ? it->second.inFlight : 0);
+        obj["rate"] = rate;
+        obj["drop"] = admission().droppedCount(key) + (tracked ? it->second.drops : 0);
+    }
+
+private:
+    /**
+     * @brief Per controller state.
+     */
+    struct ControllerState {
+        uint32_t avgUs = 0;             ///< Moving average of the execution time
+        uint16_t publishedRate = 0;     ///< Rate in the last published signal
+        uint16_t inFlight = 0;          ///< Port level writes in flight
+        uint32_t drops = 0;             ///< Port level writes dropped so far
+    };
+
+    std::map<String, ControllerState> controllers_; ///< Tracked controllers by key
+    uint32_t globalAvgUs_ = 0;                      ///< Moving average over all controllers
+    uint16_t inFlight_ = 0;                         ///< Port level writes in flight over all controllers
+    uint32_t drops_ = 0;                            ///< Port level writes dropped so far, kept over clear()
+    uint16_t publishedRate_ = 0;                    ///< Global rate in the last published signal
+    uint32_t publishedRevision_ = 0;                ///< Admission revision in the last published signal
+    uint32_t publishedMs_ = 0;                      ///< Time of the last publish
+    bool dirty_ = true;                             ///< Signal changed since the last publish
+
+    static const ConnectionAdmission& admission() {
+        return ConnectionAdmission::getInstance();
+    }
+
+    /**
+     * @brief Exponential moving average with weight 1/8 for the new sample.
+     */
+    static void updateAverage(uint32_t& avg, uint32_t sample) {
+        avg = (avg == 0) ? sample : avg - avg / 8 + sample / 8;
+    }
+
+    /**
+     * @brief Convert an average execution time into a send rate (commands/s).
+     */
+    static uint16_t rateFor(uint32_t avgUs) {
+        if (avgUs == 0) return CONFIG::BACKPRESSURE_MAX_RATE;
+        uint32_t rate = 1000000UL / avgUs;
+        if (rate < 1) rate = 1;
+        if (rate > CONFIG::BACKPRESSURE_MAX_RATE) rate = CONFIG::BACKPRESSURE_MAX_RATE;
+        return static_cast<uint16_t>(rate);
+    }
+
+    uint16_t globalRate() const {
+        return rateFor(globalAvgUs_);
+    }
+
+    static bool rateChanged(uint16_t published, uint16_t current) {
+        uint16_t diff = (published > current) ? published - current : current - published;
+        return diff * 4 > published;
+    }
+
+    // Singleton: private constructor and deleted copy operations
+    Backpressure() {}
+    Backpressure(const Backpressure&) = delete;
+    Backpressure& operator=(const Backpressure&) = delete;
+};
@@ -0,0 +1,161 @@
+/**
+ * @file BleStack.h
+ *
+ * @brief On-demand lifecycle of the BLE stack.
+ *
+ * The BLE stack (controller and Bluedroid host) is started by the first
+ * controller connect and released again once no BLE controller has been
+ * active for CONFIG::BLE_IDLE_RELEASE_MS. A controller is active while it is
+ * connected, has commands queued for its connection or GATT writes in flight.
+ * Simulated hubs do not use BLE and are ignored.
+ *
+ * While the stack is released the WiFi has the radio to itself and the heap
+ * used by the BLE tasks and buffers is free again. The next connect starts
+ * the stack, its init time is reported in the metrics ("ble_stack").
+ *
+ * The stack is released with BLEDevice::deinit(false). Releasing the
+ * controller memory with deinit(true) returns more heap but cannot be undone
+ * until the next reboot, so it is not used.
+ *
+ * The radio handlers adapt the WiFi to the coexistence rules: before a start
+ * the WiFi power-save "none" must be lowered to modem-sleep, after a release
+ * the configured mode can be applied again.
+ *
+ * Author: Robert W.B. Linn
+ * Copyright © 2025 Robert W.B. Linn
+ * License: MIT — see LICENSE file.
+ */
+
+#pragma once
+
+#include <functional>
+#include <Arduino.h>
+#include <BLEDevice.h>
+#include "Log.h"
+#include "Configuration.h"
+#include "Constants.h"
+#include "Metrics.h"
+#include "HubStateStore.h"
+#include "ControllerRegistry.h"
+#include "ConnectionAdmission.h"
+#include "GattWriter.h"
+
+/**
+ * @class BleStack
+ * @brief Singleton starting the BLE stack on demand and releasing it when idle.
+ */
+class BleStack {
+public:
+    using RadioHandler = std::function<void()>;     ///< Adapts the WiFi before a start or after a release
+
+    /**
+     * @brief Access the singleton instance.
+     */
+    static BleStack& getInstance() {
+        static BleStack instance;
+        return instance;
+    }
+
+    /**
+     * @brief Set the handlers called before the stack starts and after it is released.
+     * @param beforeStart Called before the BLE stack starts.
+     * @param afterRelease Called after the BLE stack is released.
+     */
+    void setRadioHandlers(RadioHandler beforeStart, RadioHandler afterRelease) {
+        beforeStart_ = beforeStart;
+        afterRelease_ = afterRelease;
+    }
+
+    /**
+     * @brief Check if the BLE stack is running.
+     */
+    bool isRunning() const {
+        return running_;
+    }
+
+    /**
+     * @brief Start the BLE stack if not running. Called before each BLE connect.
+     */
+    void start() {
+        if (running_) return;
+        if (beforeStart_) beforeStart_();
+
+        uint32_t heapBefore = ESP.getFreeHeap();
+        uint32_t startMs = millis();
+        BLEDevice::init("");
+        uint32_t durationMs = millis() - startMs;
+
+        running_ = true;
+        lastActiveMs_ = millis();
+        metrics.recordBleStart(durationMs);
+        LOGI("[BleStack][start] BLE started in %u ms, %d bytes heap used",
+             durationMs, static_cast<int>(heapBefore - ESP.getFreeHeap()));
+    }
+
+    /**
+     * @brief Release the BLE stack and its memory.
+     * The clients of all BLE controllers are dropped first; connect() creates new ones.
+     */
+    void release() {
+        if (!running_) return;
+
+        ControllerRegistry::getInstance().forEach([](const String&, BLEController* ctrl) {
+            ctrl->releaseBle();
+        });
+
+        uint32_t heapBefore = ESP.getFreeHeap();
+        BLEDevice::deinit(false);
+        running_ = false;
+        int32_t freed = static_cast<int32_t>(ESP.getFreeHeap() - heapBefore);
+
+        metrics.recordBleRelease(freed);
+        LOGI("[BleStack][release] BLE released, %d bytes heap freed", static_cast<int>(freed));
+        if (afterRelease_) afterRelease_();
+    }
+
+    /**
+     * @brief Release the stack once idle for CONFIG::BLE_IDLE_RELEASE_MS. Call from loop().
+     * @param nowMs Current time in ms.
+     */
+    void loop(uint32_t nowMs) {
+        if (!running_ || CONFIG::BLE_IDLE_RELEASE_MS == 0) return;
+        if (nowMs - lastCheckMs_ < CHECK_INTERVAL_MS) return;
+        lastCheckMs_ = nowMs;
+
+        if (isActive()) {
+            lastActiveMs_ = nowMs;
+        } else if (nowMs - lastActiveMs_ >= CONFIG::BLE_IDLE_RELEASE_MS) {
+            LOGI("[BleStack][loop] No BLE controller active for %u ms", nowMs - lastActiveMs_);
+            release();
+        }
+    }
+
+private:
+    static constexpr uint32_t CHECK_INTERVAL_MS = 1000;    ///< Interval of the idle check
+
+    bool running_ = false;
+    uint32_t lastActiveMs_ = 0;     ///< Last time a BLE controller was active
+    uint32_t lastCheckMs_ = 0;      ///< Last idle check
+    RadioHandler beforeStart_;
+    RadioHandler afterRelease_;
+
+    /**
+     * @brief Check if a BLE controller is connected, waits for its connection or has writes in flight.
+     */
+    bool isActive() const {
+        if (ConnectionAdmission::getInstance().queuedCount() > 0) return true;
+        if (GattWriter::getInstance().pendingCount() > 0) return true;
+
+        const HubStateStore& hubs = HubStateStore::getInstance();
+        bool connected = false;
+        hubs.forEach([&](HubHandle h) {
+            if (hubs.type(h) != SIMHUB::TYPE_ID && hubs.isConnected(h)) connected = true;
+        });
+        return connected;
+    }
+
+    // Singleton: private constructor and deleted copy operations
+    BleStack() {}
+    BleStack(const BleStack&) = delete;
+    BleStack& operator=(const BleStack&) = delete;
+};
@@ -2,7 +2,8 @@
  * @file BrickCommander.ino
  *
  * @brief Main program for the BrickCommander program running on an ESP32.
- *        IMPORTANT: Set ESP32 board partition to Huge App.
+ *        IMPORTANT: The partition table partitions.csv in the sketch folder
+ *        replaces the board partition scheme (Huge App plus the asset partition).
  *
  * Author: Robert W.B. Linn
  * Copyright © 2025 Robert W.B. Linn
@@ -15,14 +16,18 @@
 #include "Pins.h"
 #include "WiFiMod.h"
 #include "ConfigManager.h"
+#include "AssetStore.h"
 #include "MqttHandler.h"
+#include "BleStack.h"
 #include "Shutdown.h"
 #include "TerminalCommandHandler.h"
+#ifdef PROFILER
+#include "Profiler.h"
+#endif
 
 // Instantiate ConfigManager, TerminalCommandHandler, WiFi & MQTT
-// ConfigManager config is defined as global instance in ConfigManager.h
+// ConfigManager config and WiFiMod wifi are defined as global instances in their headers
 TerminalCommandHandler terminalHandler;
-WiFiMod wifi;
 MqttHandler mqtt; 
 #warning "Building with WiFi & MQTT support"
 
@@ -40,10 +45,26 @@ void setup() {
     // Load the stored configuration
     config.load();
 
+    // WiFi power-save "none" is not allowed while BLE runs, it is restored when BLE is released
+    BleStack::getInstance().setRadioHandlers(
+        []() { wifi.beforeBleInit(); },
+        []() {
+            if (wifi.isConnected()) wifi.setPowerSave(config.wifi_power_save, config.wifi_listen_interval);
+        });
+
+    // Map the stored assets, they are read in place from flash
+    AssetStore::getInstance().begin();
+
     // Connect to WiFi followed by MQTT broker using the config credentials
     if (wifi.connect()) {
         mqtt.begin(config.mqtt_broker.c_str(), config.mqtt_port, config.mqtt_username.c_str(), config.mqtt_password.c_str());
     } 
+#ifdef EMBEDDED_BROKER
+    // Standalone: local clients join the access point and use the embedded broker
+    else if (wifi.startAccessPoint()) {
+        mqtt.begin(config.mqtt_broker.c_str(), config.mqtt_port, config.mqtt_username.c_str(), config.mqtt_password.c_str());
+    }
+#endif
     else {
         LOGE("[SetUp] WiFi failed. Cannot use MQTT.");
     }
@@ -58,9 +79,12 @@ void loop() {
     terminalHandler.loop();
 
     mqtt.loop();
+#ifdef PROFILER
+    Profiler::getInstance().loop(millis());
+#endif
     delay(10);
     
-    if (!wifi.isConnected()) {
+    if (!wifi.isConnected() && !wifi.isAccessPoint()) {
         LOGW("WiFi lost — shutting down BrickCommander.");
         shutdownBrickCommander();
         // optionally reset/restart here
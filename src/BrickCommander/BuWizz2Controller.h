@@ -17,6 +17,8 @@
 #include "Log.h"
 #include "Constants.h"
 #include "BLEController.h"
+#include "GattWriter.h"
+#include "BleStack.h"
 
 /**
  * @class BuWizz2Controller
@@ -29,9 +31,9 @@ public:
      * @brief Represents the connection state of the controller.
      */
     enum State {
-        DISCONNECTED, ///< Not connected
-        CONNECTED,    ///< Connected but not yet awake
-        AWAKE         ///< Connected and ready for commands
+        DISCONNECTED = HubStateStore::LINK_DISCONNECTED, ///< Not connected
+        CONNECTED    = HubStateStore::LINK_CONNECTED,    ///< Connected but not yet awake
+        AWAKE        = HubStateStore::LINK_AWAKE         ///< Connected and ready for commands
     };
 
     /**
@@ -39,8 +41,8 @@ public:
      * @param mac MAC address of the BuWizz 2.0 device.
      */
     explicit BuWizz2Controller(const String& mac)
-        : macAddress_(mac), client_(nullptr), characteristic_(nullptr),
-          state_(DISCONNECTED), awake_(false), batteryVoltage_(0.0f) {}
+        : BLEController(BUWIZZ2::TYPE_ID, BUWIZZ2::PORT_COUNT, mac),
+          macAddress_(mac), client_(nullptr), characteristic_(nullptr) {}
 
     /**
      * @brief Destructor.
@@ -51,7 +53,8 @@ public:
     }
 
     /**
-     * @brief Connect to the BuWizz 2.0 device.
+     * @brief Connect to the BuWizz 2.0 device with a single attempt.
+     * Called by ConnectionAdmission, which retries failed attempts with a backoff.
      * @return true if connection was successful, false otherwise.
      */
     bool connect() override {
@@ -60,7 +63,7 @@ public:
             disconnect();
             delay(200);
         }
-        return connectWithRetries(5);
+        return connectOnce();
     }
 
     /**
@@ -77,11 +80,19 @@ public:
             client_ = nullptr;
         }
         characteristic_ = nullptr;
-        state_ = DISCONNECTED;
-        awake_ = false;
+        setState(DISCONNECTED);
         LOGI("[BLEController][disconnect] Disconnected from BuWizz2");
     }
 
+    /**
+     * @brief Drop the BLE client, called before the BLE stack is released.
+     */
+    void releaseBle() override {
+        delete client_;
+        client_ = nullptr;
+        characteristic_ = nullptr;
+    }
+
     /**
      * @brief Wake up the BuWizz 2.0 and set output level.
      * @param level Output level (default 1).
@@ -96,8 +107,7 @@ public:
 
         characteristic_->writeValue(cmd, sizeof(cmd), true);
         delay(100);
-        state_ = AWAKE;
-        awake_ = true;
+        setState(AWAKE);
         LOGI("BuWizz2 is awake & ready.");
     }
 
@@ -107,10 +117,8 @@ public:
      * @param power Power level (-100–100).
      */
     void setPortLevel(uint8_t port, int8_t power) override {
-        if (!characteristic_ || port > 3) return;
-
-        uint8_t cmd[] = { 0x10, 0, 0, 0, 0, 0 };
-        cmd[1 + port] = static_cast<uint8_t>(power);
+        uint8_t cmd[PORT_COMMAND_SIZE];
+        if (!characteristic_ || !buildPortCommand(port, power, cmd)) return;
 
         LOGI("[BuWizz2Controller][setPortLevel] port=%u power=%d", port, power);
         LOGIHEX("[BuWizz2Controller][setPortLevel] cmd=", cmd, sizeof(cmd));
@@ -119,11 +127,38 @@ public:
     }
 
     /**
-     * @brief Get the current battery voltage.
-     * @return Battery voltage in volts.
+     * @brief Set power level on a specific port without blocking.
+     * @param port Port number (0–3).
+     * @param power Power level (-100–100).
+     * @param callback Completion callback with status and round-trip time.
+     * @return Handle of the write.
+     */
+    uint32_t setPortLevelAsync(uint8_t port, int8_t power, WriteCallback callback) override {
+        uint8_t cmd[PORT_COMMAND_SIZE];
+        if (!buildPortCommand(port, power, cmd)) {
+            return GattWriter::getInstance().completeLater(callback, WriteStatus::INVALID);
+        }
+
+        LOGI("[BuWizz2Controller][setPortLevelAsync] port=%u power=%d", port, power);
+        LOGIHEX("[BuWizz2Controller][setPortLevelAsync] cmd=", cmd, sizeof(cmd));
+
+        return GattWriter::getInstance().write(client_, characteristic_, cmd, sizeof(cmd), callback);
+    }
+
+    /**
+     * @brief Get the BLE MAC address.
+     * @return MAC address of the BuWizz 2.0.
      */
-    float getBatteryVoltage() const {
-        return batteryVoltage_;
+    String getMacAddress() const override {
+        return macAddress_;
+    }
+
+    /**
+     * @brief Get the controller type id used in the binary telemetry.
+     * @return BUWIZZ2::TYPE_ID.
+     */
+    uint8_t getTypeId() const override {
+        return BUWIZZ2::TYPE_ID;
     }
 
     /**
@@ -134,7 +169,7 @@ public:
         String json = "{";
         json += "\"device\":\"BuWizz2\",";
         json += "\"connected\":" + String(isConnected() ? "true" : "false") + ",";
-        json += "\"batteryVoltage\":" + String(batteryVoltage_, 2);
+        json += "\"batteryVoltage\":" + String(getBatteryVoltage(), 2);
         json += "}";
         return json;
     }
@@ -144,33 +179,43 @@ public:
      * @return Current state.
      */
     State getState() const {
-        return state_;
+        return static_cast<State>(hubs().link(handle_));
     }
 
+private:
+    static constexpr size_t PORT_COMMAND_SIZE = 6;  ///< Size of a port level command
+
     /**
-     * @brief Check if the device is connected.
-     * @return true if connected, false otherwise.
+     * @brief Build the command setting the power level of a port.
+     * @param port Port number (0–3).
+     * @param power Power level (-100–100).
+     * @param cmd Destination of PORT_COMMAND_SIZE bytes.
+     * @return false if the port is invalid.
      */
-    bool isConnected() const override {
-        return state_ >= CONNECTED;
+    static bool buildPortCommand(uint8_t port, int8_t power, uint8_t* cmd) {
+        if (port > 3) return false;
+        memset(cmd, 0, PORT_COMMAND_SIZE);
+        cmd[0] = 0x10;
+        cmd[1 + port] = static_cast<uint8_t>(power);
+        return true;
     }
 
     /**
-     * @brief Check if the device is awake.
-     * @return true if awake, false otherwise.
+     * @brief Set the connection state in the HubStateStore.
+     * Also called from the BLE task by the client callbacks.
+     * @param state New state.
      */
-    bool isAwake() const override {
-        return awake_;
+    void setState(State state) {
+        hubs().setLink(handle_, static_cast<HubStateStore::LinkState>(state));
     }
 
-private:
     /**
-     * @brief Attempt to connect to the BuWizz with retries.
-     * @param maxAttempts Maximum number of connection attempts.
+     * @brief Single attempt to connect to the BuWizz.
+     * Retries and their backoff are done by ConnectionAdmission.
      * @return true if connected, false otherwise.
      */
-    bool connectWithRetries(int maxAttempts) {
-        BLEDevice::init("");
+    bool connectOnce() {
+        BleStack::getInstance().start();
 
         if (client_) {
             delete client_;
@@ -179,56 +224,50 @@ private:
         client_ = BLEDevice::createClient();
         client_->setClientCallbacks(new ClientCallbacks(this));
 
-        for (int attempt = 1; attempt <= maxAttempts; ++attempt) {
-            LOGI("Connecting attempt %d …", attempt);
-
-            if (!client_->connect(BLEAddress(macAddress_.c_str()))) {
-                LOGE("Failed to connect BLE, retrying …");
-                delay(1000);
-                continue;
-            }
-
-            BLERemoteService* service = client_->getService(BUWIZZ2::UUID_SERVICE);
-            if (!service) {
-                LOGE("BuWizz2 service not found, retrying …");
-                client_->disconnect();
-                delay(500);
-                continue;
-            }
-
-            characteristic_ = service->getCharacteristic(BUWIZZ2::UUID_CHARACTERISTIC);
-            if (!characteristic_) {
-                LOGE("Control characteristic not found, retrying …");
-                client_->disconnect();
-                delay(500);
-                continue;
-            }
+        LOGI("[BuWizz2Controller][connect] Connecting to %s", macAddress_.c_str());
+        if (!client_->connect(BLEAddress(macAddress_.c_str()))) {
+            LOGE("[BuWizz2Controller][connect] Failed to connect BLE");
+            return connectFailed();
+        }
 
-            if (characteristic_->canNotify()) {
-                characteristic_->registerForNotify(
-                    std::bind(&BuWizz2Controller::notificationCallback, this,
-                              std::placeholders::_1, std::placeholders::_2,
-                              std::placeholders::_3, std::placeholders::_4));
-            }
+        BLERemoteService* service = client_->getService(BUWIZZ2::UUID_SERVICE);
+        if (!service) {
+            LOGE("[BuWizz2Controller][connect] BuWizz2 service not found");
+            return connectFailed();
+        }
 
-            LOGI("Connected to BuWizz2");
-            state_ = CONNECTED;
+        characteristic_ = service->getCharacteristic(BUWIZZ2::UUID_CHARACTERISTIC);
+        if (!characteristic_) {
+            LOGE("[BuWizz2Controller][connect] Control characteristic not found");
+            return connectFailed();
+        }
 
-            setOutputLevel(1);
-            return true;
+        if (characteristic_->canNotify()) {
+            characteristic_->registerForNotify(
+                std::bind(&BuWizz2Controller::notificationCallback, this,
+                          std::placeholders::_1, std::placeholders::_2,
+                          std::placeholders::_3, std::placeholders::_4));
         }
 
-        LOGE("Unable to connect after %d attempts.", maxAttempts);
+        LOGI("Connected to BuWizz2");
+        setState(CONNECTED);
 
+        setOutputLevel(1);
+        return true;
+    }
+
+    /**
+     * @brief Drop the BLE client after a failed connect attempt.
+     * @return false
+     */
+    bool connectFailed() {
         if (client_) {
             client_->disconnect();
             delete client_;
             client_ = nullptr;
         }
         characteristic_ = nullptr;
-        state_ = DISCONNECTED;
-        awake_ = false;
-
+        setState(DISCONNECTED);
         return false;
     }
 
@@ -242,7 +281,7 @@ private:
     void notificationCallback(BLERemoteCharacteristic* chr, uint8_t* data, size_t length, bool isNotify) {
         if (length >= 3 && data[0] == 0x00) {
             uint8_t rawVbat = data[2];
-            batteryVoltage_ = 3.0f + rawVbat * 0.01f;
+            hubs().setBatteryMv(handle_, 3000 + rawVbat * 10);
         }
     }
 
@@ -264,7 +303,7 @@ private:
          */
         void onConnect(BLEClient*) override {
             LOGI("BLE client connected");
-            controller_->state_ = CONNECTED;
+            controller_->setState(CONNECTED);
         }
 
         /**
@@ -273,8 +312,7 @@ private:
          */
         void onDisconnect(BLEClient*) override {
             LOGI("BLE client disconnected");
-            controller_->state_ = DISCONNECTED;
-            controller_->awake_ = false;
+            controller_->setState(DISCONNECTED);
         }
 
     private:
@@ -284,7 +322,4 @@ private:
     String macAddress_; ///< MAC address of the BuWizz 2.0
     BLEClient* client_; ///< BLE client instance
     BLERemoteCharacteristic* characteristic_; ///< BLE characteristic for control
-    volatile State state_; ///< Current connection state
-    bool awake_; ///< Whether the device is awake
-    float batteryVoltage_; ///< Last known battery voltage
 };
@@ -0,0 +1,26 @@
+/**
+ * @file CommandContext.h
+ *
+ * @brief Context of a received command, carried along until its status is published.
+ *
+ * The correlation id is taken from the MQTT 5 user property "cid" or, with
+ * MQTT 3.1.1, from the optional command field "cid". It is returned with the
+ * status so clients can match replies that arrive later (queued commands,
+ * acknowledged writes) to their command.
+ *
+ * Author: Robert W.B. Linn
+ * Copyright © 2025 Robert W.B. Linn
+ * License: MIT — see LICENSE file.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+/**
+ * @brief Context of a received command.
+ */
+struct CommandContext {
+    String correlationId;       ///< Correlation id set by the client, may be empty
+    uint32_t receivedMs = 0;    ///< Time the command was received (millis())
+};
@@ -5,6 +5,16 @@
  *
  * Supports lazy registration: if a controller instance for a given controller type
  * and MAC does not yet exist it will be created and registered on demand.
+ * Commands for a controller that is not connected are queued in the
+ * ConnectionAdmission, which connects the controllers one at a time.
+ * Port levels are written without blocking; the status is published by the
+ * commandReplyHandler once the controller acknowledged the write. A failed
+ * write is retried CONFIG::GATT_WRITE_RETRIES times before an error is sent;
+ * a timed out write is not retried, it is still queued in the BLE stack.
+ * The requested and acknowledged port levels are kept in the HubStateStore.
+ * Commands are checked against the ControllerCapabilities of their controller
+ * type before a controller is created or connected; a disconnect of a
+ * controller that is not connected returns at once.
  *
  * Example JSON command:
  * {
@@ -29,19 +39,98 @@
 #include "StringUtils.h"
 // Controllers
 #include "ControllerRegistry.h"
+#include "HubStateStore.h"
+#include "ControllerCapabilities.h"
+#include "ConnectionAdmission.h"
+#include "Backpressure.h"
+#include "CommandContext.h"
 #include "LEGOHubNo4Controller.h"
 #include "BuWizz2Controller.h"
+#ifdef SIMULATED_HUBS
+#include "SimulatedController.h"
+#endif
 // add more like a custom controller
 
+/**
+ * @brief Handler publishing the status of a command completed after handleCommand returned.
+ * @param msg JSON string with keys status and message.
+ * @param key Controller key (type|mac).
+ * @param context Context of the command.
+ */
+using CommandReplyHandler = std::function<void(const String& msg, const String& key, const CommandContext& context)>;
+
+inline CommandReplyHandler commandReplyHandler; // set by the MqttHandler
+
+/**
+ * @brief Writes a port level without blocking and publishes the status on completion.
+ * Failed writes are retried up to CONFIG::GATT_WRITE_RETRIES times. Timed out
+ * writes are not, they are still queued in the BLE stack and a retry would
+ * only queue a duplicate behind them.
+ *
+ * @param controller Connected controller.
+ * @param key Controller key (type|mac).
+ * @param port Port number.
+ * @param level Raw power level (-127…127).
+ * @param okStatus Status JSON published when the write is acknowledged.
+ * @param context Context of the command.
+ * @param attempt Retry count, 0 for the first attempt.
+ */
+inline void writePortLevel(BLEController* controller, const String& key, uint8_t port, int8_t level,
+                           const String& okStatus, const CommandContext& context, uint8_t attempt = 0) {
+    HubHandle handle = controller->getHandle();
+    HubStateStore::getInstance().setDesiredLevel(handle, port, level);
+    Backpressure::getInstance().writeStarted(key);
+
+    controller->setPortLevelAsync(port, level, [=](WriteStatus status, uint32_t rttUs) {
+        HubStateStore& hubs = HubStateStore::getInstance();
+        Backpressure::getInstance().writeFinished(key);
+        if (status == WriteStatus::OK) {
+            hubs.setAppliedLevel(handle, port, level);
+            hubs.recordWrite(handle, true);
+            Backpressure::getInstance().recordService(key, rttUs);
+            LOGI("[CommandHandler] Port %u level %d acknowledged by %s in %u us", port, level, key.c_str(), rttUs);
+            if (commandReplyHandler) commandReplyHandler(okStatus, key, context);
+            return;
+        }
+
+        if (status == WriteStatus::FAILED && attempt < CONFIG::GATT_WRITE_RETRIES) {
+            LOGW("[CommandHandler] Write to %s %s, retrying", key.c_str(), writeStatusName(status));
+            metrics.recordGattRetry();
+            writePortLevel(controller, key, port, level, okStatus, context, attempt + 1);
+            return;
+        }
+
+        LOGE("[CommandHandler] Write to %s port %u %s", key.c_str(), port, writeStatusName(status));
+        hubs.recordWrite(handle, false);
+        if (status == WriteStatus::BUSY || status == WriteStatus::TIMEOUT || status == WriteStatus::FAILED) {
+            Backpressure::getInstance().recordDrop(key);
+        }
+        if (commandReplyHandler) {
+            commandReplyHandler(StringUtils::formatStatus(COMMAND_STATUS::ERROR,
+                                                          "Failed to set port %u: %s",
+                                                          port, writeStatusName(status)),
+                                key, context);
+        }
+    });
+}
+
 /**
  * @brief Handles a JSON command string.
  *
  * Creates and registers controllers on-demand and executes commands.
  *
  * @param jsonCommand A String containing the JSON command.
+ * @param context Context of the command; the correlation id is taken from the
+ *                command field "cid" if not set, so the caller can return it
+ *                with the status.
+ * @param controllerKey Optional, receives the key (type|mac) of the addressed controller.
  * @return String with status:msg, where status is ok or error.
+ *         Empty if the command is queued until its controller is connected,
+ *         or a port level write is in flight; its status is then published
+ *         by the ConnectionAdmission or the commandReplyHandler.
  */
-inline String handleCommand(const String& jsonCommand) {
+inline String handleCommand(const String& jsonCommand, CommandContext& context,
+                            String* controllerKey = nullptr) {
     LOGI("[CommandHandler] Handling JSON: %s", jsonCommand.c_str());
 
     StaticJsonDocument<512> doc;
@@ -61,7 +150,10 @@ inline String handleCommand(const String& jsonCommand) {
     int speed         = doc[COMMAND::SPEED]        | -1;
     String direction  = doc[COMMAND::DIRECTION]    | "";
     bool disconnect   = doc[COMMAND::DISCONNECT]   | false;
-    String msg        = "";
+
+    if (context.correlationId.isEmpty()) {
+        context.correlationId = doc[COMMAND::CORRELATION_ID] | "";
+    }
 
     ctrlName.toLowerCase();
     direction.toLowerCase();
@@ -74,48 +166,147 @@ inline String handleCommand(const String& jsonCommand) {
         return StringUtils::formatStatus(COMMAND_STATUS::ERROR, "Missing controller or MAC field");
     }
 
+    /*
+     * Validate the command against the controller capabilities before any BLE work
+     */
+    const ControllerCapabilities* caps = findCapabilities(ctrlName);
+    if (!caps) {
+        LOGE("[CommandHandler] Unknown controller type: %s", ctrlName.c_str());
+        return StringUtils::formatStatus(COMMAND_STATUS::ERROR,
+                            "Unknown controller type: %s",
+                            ctrlName.c_str());
+    }
+
+    if (!StringUtils::isMacAddress(mac.c_str())) {
+        LOGE("[CommandHandler] Invalid MAC address: %s", mac.c_str());
+        return StringUtils::formatStatus(COMMAND_STATUS::ERROR, "Invalid MAC address: %s", mac.c_str());
+    }
+
+    uint8_t operation = 0;
+    if (disconnect) {
+        operation = CAPABILITY::OP_DISCONNECT;
+    } else if (!direction.isEmpty()) {
+        operation = CAPABILITY::OP_DIRECTION;
+    } else if (doc.containsKey(COMMAND::POWER)) {
+        operation = CAPABILITY::OP_POWER;
+    }
+
+    if (operation == 0) {
+        LOGW("[CommandHandler] No port, power or direction to set.");
+        return StringUtils::formatStatus(COMMAND_STATUS::ERROR, "No port, power or direction to set");
+    }
+
+    if (!caps->supports(operation)) {
+        LOGE("[CommandHandler] Operation 0x%02x not supported by %s", operation, caps->name);
+        return StringUtils::formatStatus(COMMAND_STATUS::ERROR, "Operation not supported by %s", caps->name);
+    }
+
+    uint8_t percent = 50;
+    if (operation != CAPABILITY::OP_DISCONNECT) {
+        if (port < 0 || port >= caps->portCount) {
+            LOGW("[CommandHandler] Invalid port %d for %s.", port, caps->name);
+            return StringUtils::formatStatus(COMMAND_STATUS::ERROR,
+                               "Invalid port %d, %s has ports 0-%u",
+                               port, caps->name, caps->portCount - 1);
+        }
+
+        if (operation == CAPABILITY::OP_DIRECTION &&
+            direction != COMMAND::FORWARD && direction != COMMAND::BACKWARD) {
+            LOGW("[CommandHandler] Invalid direction: %s", direction.c_str());
+            return StringUtils::formatStatus(COMMAND_STATUS::ERROR,
+                               "Invalid direction %s, use forward or backward",
+                               direction.c_str());
+        }
+
+        // Speed takes precedence over power for a direction, power is mandatory without direction
+        bool hasSpeed = operation == CAPABILITY::OP_DIRECTION && doc.containsKey(COMMAND::SPEED);
+        bool hasPower = doc.containsKey(COMMAND::POWER);
+        if (hasSpeed || hasPower) {
+            int value = hasSpeed ? speed : power;
+            if (value < 0 || value > caps->maxPercent) {
+                LOGW("[CommandHandler] %s %d out of range.", hasSpeed ? "Speed" : "Power", value);
+                return StringUtils::formatStatus(COMMAND_STATUS::ERROR,
+                                   "%s %d out of range 0-%u",
+                                   hasSpeed ? "Speed" : "Power", value, caps->maxPercent);
+            }
+            percent = static_cast<uint8_t>(value);
+        }
+    }
+
     BLEController* controller = ControllerRegistry::getInstance().getController(ctrlName, mac);
+    String key = ControllerRegistry::makeKey(ctrlName, mac);
+    if (controllerKey) *controllerKey = key;
+    ConnectionAdmission& admission = ConnectionAdmission::getInstance();
+
+    /*
+     * Disconnect from a Controller that is not connected: nothing to do.
+     * Commands still waiting for its connect are cancelled instead of connecting first.
+     */
+    if (operation == CAPABILITY::OP_DISCONNECT && (!controller || !controller->isConnected())) {
+        LOGI("[CommandHandler] Controller %s at %s not connected, nothing to disconnect.", ctrlName.c_str(), mac.c_str());
+        admission.cancel(key);
+        return StringUtils::formatStatus(COMMAND_STATUS::OK,
+                        "Not connected to %s, nothing to disconnect",
+                        mac.c_str());
+    }
 
     if (!controller) {
         LOGI("[CommandHandler] No controller found for %s @ %s — creating.", ctrlName.c_str(), mac.c_str());
 
-        if (ctrlName == StringUtils::toLower(LEGOHUBNO4::NAME)) {
-            controller = new LEGOHubNo4Controller(mac);
-        } else if (ctrlName == StringUtils::toLower(BUWIZZ2::NAME)) {
-            controller = new BuWizz2Controller(mac);
+        if (HubStateStore::getInstance().isFull()) {
+            LOGE("[CommandHandler] Too many controllers, max %u.", HubStateStore::MAX_HUBS);
+            return StringUtils::formatStatus(COMMAND_STATUS::ERROR,
+                                "Too many controllers, max %u",
+                                HubStateStore::MAX_HUBS);
+        }
 
-        // Add additional Controllers here
+        switch (caps->typeId) {
+            case LEGOHUBNO4::TYPE_ID:
+                controller = new LEGOHubNo4Controller(mac);
+                break;
+            case BUWIZZ2::TYPE_ID:
+                controller = new BuWizz2Controller(mac);
+                break;
+#ifdef SIMULATED_HUBS
+            case SIMHUB::TYPE_ID:
+                controller = new SimulatedController(mac);
+                break;
+#endif
 
-        } else {
-            LOGE("[CommandHandler] Unknown controller type: %s", ctrlName.c_str());
-            return StringUtils::formatStatus(COMMAND_STATUS::ERROR,
-                                "Unknown controller type: %s",
-                                ctrlName.c_str());
+            // Add additional Controllers here
+
+            default:
+                LOGE("[CommandHandler] No implementation for controller type: %s", ctrlName.c_str());
+                return StringUtils::formatStatus(COMMAND_STATUS::ERROR,
+                                    "Unknown controller type: %s",
+                                    ctrlName.c_str());
         }
 
         ControllerRegistry::getInstance().registerController(ctrlName, mac, controller);
     }
 
     /*
-     * Connect to the Controller
+     * Queue the command until the Controller is connected.
+     * Also queue while earlier commands are still waiting, to keep their order.
      */
-    if (!controller->isConnected()) {
-        LOGI("[CommandHandler] Connecting to controller %s at %s", ctrlName.c_str(), mac.c_str());
-        // Connect
-        if (!controller->connect()) {
-            LOGE("[CommandHandler] Failed to connect to controller %s at %s", ctrlName.c_str(), mac.c_str());
-            return StringUtils::formatStatus(COMMAND_STATUS::ERROR,
-                                "Failed to connect to: %s",
-                                mac.c_str());
-        }
+    Backpressure::getInstance().track(key);
+    HubStateStore::getInstance().recordCommand(controller->getHandle());
+
+    if (!controller->isConnected() || admission.isQueued(key)) {
+        LOGI("[CommandHandler] Queueing command until controller %s at %s is connected", ctrlName.c_str(), mac.c_str());
+        admission.enqueue(key, controller, jsonCommand, context);
+        return "";
     }
+    admission.noteUsed(key);
 
     /*
      * Disconnect from the Controller
      */
-    if (disconnect) {
+    if (operation == CAPABILITY::OP_DISCONNECT) {
         // Disconnect
+        uint32_t startUs = micros();
         controller->disconnect();
+        Backpressure::getInstance().recordService(key, micros() - startUs);
         LOGI("[CommandHandler] Controller disconnected.");
         return StringUtils::formatStatus(COMMAND_STATUS::OK,
                         "Disconnected from %s",
@@ -125,41 +316,29 @@ inline String handleCommand(const String& jsonCommand) {
     /*
      * Set direction, power on port
      */
-    if (!direction.isEmpty() && port >= 0) {
+    if (operation == CAPABILITY::OP_DIRECTION) {
         bool forward = (direction == COMMAND::FORWARD);
 
-        uint8_t percent = 50;
-        if (speed >= 0) {
-            percent = static_cast<uint8_t>(speed);
-        } else if (power >= 0) {
-            percent = static_cast<uint8_t>(power);
-        }
-
-        controller->setDirection(static_cast<uint8_t>(port), forward, percent);
         LOGI("[CommandHandler] Set direction on port %d to %s with %d%%.", port, forward ? "forward" : "backward", percent);
-        msg = StringUtils::formatStatus(COMMAND_STATUS::OK,
+        writePortLevel(controller, key, static_cast<uint8_t>(port),
+                       BLEController::directionToLevel(forward, percent),
+                       StringUtils::formatStatus(COMMAND_STATUS::OK,
                            "Set direction on port %d to %s with %d%%.", 
-                           port, forward ? "forward" : "backward", percent);
-
-
-    } else if (!direction.isEmpty() && port < 0) {
-        LOGW("[CommandHandler] Direction specified but invalid port: %d", port);
-        msg = StringUtils::formatStatus(COMMAND_STATUS::ERROR,
-                           "Direction specified but invalid port: %d",
-                           port);
+                           port, forward ? "forward" : "backward", percent),
+                       context);
+        return "";
     }
 
     /*
      * Set power on port
      */
-    if (direction.isEmpty() && power >= 0 && port >= 0) {
-        controller->setPortPercent(static_cast<uint8_t>(port), static_cast<uint8_t>(power));
-        LOGI("[CommandHandler] Set power on port %d to %d%%.", port, power);
-        msg = StringUtils::formatStatus(COMMAND_STATUS::OK,
-                           "Set power on port %d to %d%%.", 
-                           port, power);
-    }
-
-    return msg;
+    LOGI("[CommandHandler] Set power on port %d to %d%%.", port, percent);
+    writePortLevel(controller, key, static_cast<uint8_t>(port),
+                   BLEController::percentToLevel(percent),
+                   StringUtils::formatStatus(COMMAND_STATUS::OK,
+                       "Set power on port %d to %d%%.", 
+                       port, percent),
+                   context);
+    return "";
 }
 
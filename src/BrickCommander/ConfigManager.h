@@ -1,7 +1,7 @@
 /**
  * @file ConfigManager.h
  *
- * @brief Handles MQTT broker configuration load & save.
+ * @brief Handles MQTT broker, WiFi power-save and encoding configuration load & save.
  *
  * Author: Robert W.B. Linn
  * Copyright © 2025 Robert W.B. Linn
@@ -22,6 +22,11 @@ public:
     uint16_t mqtt_port = CONFIG::MQTT_PORT;
     String mqtt_username = CONFIG::MQTT_USERNAME;
     String mqtt_password = CONFIG::MQTT_PASSWORD;
+    String wifi_power_save = CONFIG::WIFI_POWER_SAVE;
+    uint16_t wifi_listen_interval = CONFIG::WIFI_LISTEN_INTERVAL;
+    String telemetry_encoding = CONFIG::TELEMETRY_ENCODING;
+    uint32_t telemetry_interval = CONFIG::TELEMETRY_INTERVAL_MS;
+    String status_encoding = CONFIG::STATUS_ENCODING;
 
     /**
      * @brief Load the configuration items.
@@ -33,8 +38,15 @@ public:
         mqtt_port       = prefs.getUShort("mqtt_port", CONFIG::MQTT_PORT);
         mqtt_username   = prefs.getString("mqtt_username", CONFIG::MQTT_USERNAME);
         mqtt_password   = prefs.getString("mqtt_password", CONFIG::MQTT_PASSWORD);
+        wifi_power_save = prefs.getString("wifi_ps", CONFIG::WIFI_POWER_SAVE);
+        wifi_listen_interval = prefs.getUShort("wifi_listen", CONFIG::WIFI_LISTEN_INTERVAL);
+        telemetry_encoding = prefs.getString("tele_enc", CONFIG::TELEMETRY_ENCODING);
+        telemetry_interval = prefs.getUInt("tele_ms", CONFIG::TELEMETRY_INTERVAL_MS);
+        status_encoding = prefs.getString("status_enc", CONFIG::STATUS_ENCODING);
         prefs.end();
         LOGI("[ConfigManager][load] Load broker=%s,port=%d,username=%s,password=%s", mqtt_broker.c_str(), mqtt_port, mqtt_username.c_str(), mqtt_password.c_str());
+        LOGI("[ConfigManager][load] Load wifi_power_save=%s,wifi_listen_interval=%u", wifi_power_save.c_str(), wifi_listen_interval);
+        LOGI("[ConfigManager][load] Load telemetry_encoding=%s,telemetry_interval=%u,status_encoding=%s", telemetry_encoding.c_str(), telemetry_interval, status_encoding.c_str());
     }
 
     /**
@@ -46,8 +58,36 @@ public:
         prefs.putUShort("mqtt_port", mqtt_port);
         prefs.putString("mqtt_username", mqtt_username);
         prefs.putString("mqtt_password", mqtt_password);
+        prefs.putString("wifi_ps", wifi_power_save);
+        prefs.putUShort("wifi_listen", wifi_listen_interval);
+        prefs.putString("tele_enc", telemetry_encoding);
+        prefs.putUInt("tele_ms", telemetry_interval);
+        prefs.putString("status_enc", status_encoding);
         prefs.end();
         LOGI("[ConfigManager][save] Save broker=%s,port=%d,username=%s,password=%s", mqtt_broker.c_str(), mqtt_port, mqtt_username.c_str(), mqtt_password.c_str());
+        LOGI("[ConfigManager][save] Save wifi_power_save=%s,wifi_listen_interval=%u", wifi_power_save.c_str(), wifi_listen_interval);
+        LOGI("[ConfigManager][save] Save telemetry_encoding=%s,telemetry_interval=%u,status_encoding=%s", telemetry_encoding.c_str(), telemetry_interval, status_encoding.c_str());
+    }
+
+    /**
+     * @brief Get the password of the access point started for the embedded broker.
+     * CONFIG::BROKER_AP_PASSWORD if set, otherwise a random password generated on
+     * first use and stored, so it differs per device and is kept over a reset.
+     */
+    String apPassword() {
+        if (strlen(CONFIG::BROKER_AP_PASSWORD) >= 8) return CONFIG::BROKER_AP_PASSWORD;
+
+        prefs.begin("brickcmd", false); // read-write
+        String password = prefs.getString("ap_pwd", "");
+        if (password.length() < 8) {
+            static const char chars[] = "abcdefghijkmnpqrstuvwxyz23456789";
+            password = "";
+            for (int i = 0; i < 12; i++) password += chars[esp_random() % (sizeof(chars) - 1)];
+            prefs.putString("ap_pwd", password);
+            LOGI("[ConfigManager][apPassword] Generated access point password");
+        }
+        prefs.end();
+        return password;
     }
 
     /**
@@ -60,6 +100,11 @@ public:
         prefs.putUShort("mqtt_port", CONFIG::MQTT_PORT);
         prefs.putString("mqtt_username", CONFIG::MQTT_USERNAME);
         prefs.putString("mqtt_password", CONFIG::MQTT_PASSWORD);
+        prefs.putString("wifi_ps", CONFIG::WIFI_POWER_SAVE);
+        prefs.putUShort("wifi_listen", CONFIG::WIFI_LISTEN_INTERVAL);
+        prefs.putString("tele_enc", CONFIG::TELEMETRY_ENCODING);
+        prefs.putUInt("tele_ms", CONFIG::TELEMETRY_INTERVAL_MS);
+        prefs.putString("status_enc", CONFIG::STATUS_ENCODING);
         prefs.end();
         LOGI("[ConfigManager][reset] Reset broker=%s,port=%d,username=%s,password=%s", mqtt_broker.c_str(), mqtt_port, mqtt_username.c_str(), mqtt_password.c_str());
     }
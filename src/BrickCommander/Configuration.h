@@ -10,6 +10,18 @@
 
 #pragma once
 
+// Uncomment to use MQTT 5 (topic aliases, user properties) instead of MQTT 3.1.1
+// #define MQTT_V5
+
+// Uncomment to enable simulated hubs ("controller":"simhub") for benchmarks, see tools/benchmark.py
+// #define SIMULATED_HUBS
+
+// Uncomment to run a MQTT 3.1.1 broker on the commander for local clients, see EmbeddedBroker.h
+// #define EMBEDDED_BROKER
+
+// Uncomment to build the sampling profiler, see Profiler.h and tools/profiler.py
+// #define PROFILER
+
 namespace CONFIG {
     constexpr const char* PROJECT_NAME      = "BrickCommander";
     constexpr const char* VERSION           = "20250721";
@@ -17,15 +29,28 @@ namespace CONFIG {
     constexpr const char* WIFI_SSID         = "***";
     constexpr const char* WIFI_PASSWORD     = "***";
 
+    // WiFi power-save: "none", "min" (ESP32 default modem-sleep) or "max".
+    // "none" removes the DTIM batching delay on incoming MQTT messages but is
+    // only accepted by the ESP32 while the BLE stack is not running.
+    constexpr const char* WIFI_POWER_SAVE       = "min";
+    // Listen interval in beacon intervals used with "max" (0 = driver default 3).
+    constexpr uint16_t    WIFI_LISTEN_INTERVAL  = 0;
+
     constexpr const char* MQTT_BROKER       = "NNN.NNN.NNN.NNN";
     constexpr uint16_t    MQTT_PORT         = 1883;
     constexpr const char* MQTT_USERNAME     = "";
     constexpr const char* MQTT_PASSWORD     = "";
+    constexpr uint32_t    MQTT_RECONNECT_MS = 5000;     // Pause between two broker connect attempts
 
     constexpr const char* MQTT_TOPIC_BASE                = "brickcommander";
     constexpr const char* MQTT_TOPIC_COMMAND_SUFFIX      = "command";
     constexpr const char* MQTT_TOPIC_STATUS_SUFFIX       = "status";
     constexpr const char* MQTT_TOPIC_AVAILABILITY_SUFFIX = "availability";
+    constexpr const char* MQTT_TOPIC_BACKPRESSURE_SUFFIX = "backpressure";
+    constexpr const char* MQTT_TOPIC_TELEMETRY_SUFFIX    = "telemetry";
+    constexpr const char* MQTT_TOPIC_ASSET_SUFFIX        = "asset";
+    constexpr const char* MQTT_TOPIC_PROFILE_SUFFIX      = "profile";
+    constexpr const char* MQTT_TOPIC_PROBE_SUFFIX        = "probe";
 
     constexpr const char* MQTT_TOPIC_CONFIG_SUFFIX       = "config";
     constexpr const char* MQTT_TOPIC_CONFIG_STATUS       = "status";
@@ -33,7 +58,90 @@ namespace CONFIG {
     constexpr const char* MQTT_TOPIC_CONFIG_PORT         = "mqtt_port";
     constexpr const char* MQTT_TOPIC_CONFIG_USERNAME     = "mqtt_username";
     constexpr const char* MQTT_TOPIC_CONFIG_PASSWORD     = "mqtt_password";
+    constexpr const char* MQTT_TOPIC_CONFIG_WIFI_POWER_SAVE      = "wifi_power_save";
+    constexpr const char* MQTT_TOPIC_CONFIG_WIFI_LISTEN_INTERVAL = "wifi_listen_interval";
+    constexpr const char* MQTT_TOPIC_CONFIG_TELEMETRY_ENCODING   = "telemetry_encoding";
+    constexpr const char* MQTT_TOPIC_CONFIG_TELEMETRY_INTERVAL   = "telemetry_interval";
+    constexpr const char* MQTT_TOPIC_CONFIG_STATUS_ENCODING      = "status_encoding";
+    constexpr const char* MQTT_TOPIC_CONFIG_ASSET                = "asset";
+    constexpr const char* MQTT_TOPIC_CONFIG_PROFILE              = "profile";
 
     constexpr const char* MQTT_AVAILABILITY_ONLINE       = "online";
     constexpr const char* MQTT_AVAILABILITY_OFFLINE      = "offline";
+
+    // Max MQTT packet size (PubSubClient default is 256), fits the metrics status.
+    constexpr uint16_t    MQTT_BUFFER_SIZE               = 2048;
+
+    // Embedded broker (EMBEDDED_BROKER). With the embedded broker the upstream broker
+    // is optional: it is not used if mqtt_broker is empty, "none" or the MQTT_BROKER
+    // placeholder, and its connection is retried without blocking the local clients.
+    constexpr uint16_t    BROKER_PORT                    = 1883;
+    constexpr uint8_t     BROKER_MAX_CLIENTS             = 4;     // Local clients at the same time
+    constexpr uint8_t     BROKER_MAX_SUBSCRIPTIONS       = 8;     // Topic filters per client
+    constexpr uint8_t     BROKER_MAX_RETAINED            = 8;     // Retained topics
+    constexpr uint16_t    BROKER_PACKET_SIZE             = 1024;  // Largest packet accepted from a client
+    constexpr uint32_t    BROKER_CONNECT_TIMEOUT_MS      = 5000;  // Time for a new connection to send CONNECT
+    // Access point started if the WiFi network is not found, so local clients can join.
+    // Without a password set here each device generates its own random password on
+    // first use, stores it and logs it on the serial console.
+    constexpr const char* BROKER_AP_SSID                 = "BrickCommander";
+    constexpr const char* BROKER_AP_PASSWORD             = "";    // At least 8 characters, empty = per device
+
+    // Telemetry of all controllers, published periodically on the telemetry topic.
+    // Encodings: "json", "msgpack" or "fixed" (binary schema, see TELEMETRY in Constants.h).
+    // The status topic supports "json" and "msgpack".
+    constexpr uint32_t    TELEMETRY_INTERVAL_MS          = 1000;  // 0 = telemetry off
+    constexpr const char* TELEMETRY_ENCODING             = "json";
+    constexpr const char* STATUS_ENCODING                = "json";
+    constexpr uint8_t     TELEMETRY_CONTROLLERS_PER_MESSAGE = 8;  // Larger installations are split over several messages
+
+    // Asset store in the flash data partition, see partitions.csv and AssetStore.h.
+    constexpr const char* ASSET_PARTITION_LABEL          = "assets";
+    constexpr uint8_t     ASSET_MAX_COUNT                = 32;    // Assets in the store
+    constexpr uint8_t     ASSET_LIST_PAGE_SIZE           = 8;     // Assets per list status, fits the MQTT buffer
+
+    // Hubs handled at the same time (size of the HubStateStore arrays, max 32).
+    constexpr uint8_t     MAX_HUBS                       = 32;
+    // BLE RSSI of one connected hub is read per interval, round-robin.
+    constexpr uint32_t    BLE_RSSI_POLL_MS               = 1000;
+
+    // The BLE stack is started by the first connect and released when no BLE controller
+    // was connected, queued or writing for this time (0 = never released).
+    constexpr uint32_t    BLE_IDLE_RELEASE_MS            = 60000;
+
+    // BLE connection admission: connect attempts are queued and started one at a time.
+    constexpr uint32_t    BLE_CONNECT_SPACING_MS         = 250;   // Pause between two connect attempts
+    constexpr uint32_t    BLE_CONNECT_BACKOFF_MS         = 2000;  // Backoff per failed attempt of a controller
+    constexpr uint8_t     BLE_CONNECT_MAX_FAILURES       = 3;     // Failed attempts before queued commands are rejected
+    constexpr uint8_t     BLE_CONNECT_QUEUE_SIZE         = 8;     // Queued commands per controller, oldest dropped first
+
+    // Asynchronous GATT writes.
+    constexpr uint32_t    GATT_WRITE_TIMEOUT_MS          = 1000;  // Write without response is reported as timeout
+    constexpr uint8_t     GATT_WRITE_RETRIES             = 1;     // Retries of a failed port level write
+    constexpr uint8_t     GATT_MAX_PENDING_WRITES        = 16;    // Writes in flight over all controllers
+
+    // Backpressure signal published to clients on change.
+    constexpr uint32_t    BACKPRESSURE_MIN_INTERVAL_MS   = 250;   // Minimum time between two publishes
+    constexpr uint16_t    BACKPRESSURE_MAX_RATE          = 50;    // Upper limit of the recommended send rate (commands/s)
+
+    // Gaps between received MQTT messages above this are idle time, not latency.
+    constexpr uint32_t    METRICS_RX_GAP_IDLE_MS         = 5000;
+
+    // Loopback probe published to and received from the broker, measures the delivery delay
+    // per power-save mode independent of the client send rate (0 = off).
+    constexpr uint32_t    METRICS_PROBE_INTERVAL_MS      = 2000;
+
+    // Sampling profiler (PROFILER), started via the config topic key "profile".
+    constexpr uint32_t    PROFILER_HZ                    = 997;   // Samples per second and core, prime against aliasing
+    constexpr uint32_t    PROFILER_MAX_HZ                = 10000;
+    constexpr uint32_t    PROFILER_DURATION_MS           = 10000; // Sampling time, 0 = until stopped
+    constexpr uint8_t     PROFILER_CORES                 = 0x03;  // Sampled cores, bit 0 = core 0
+    constexpr size_t      PROFILER_SLOTS                 = 512;   // Histogram slots per core (8 bytes each), power of 2
+
+    // Default link of simulated hubs (SIMULATED_HUBS), changed via the config topic key "sim".
+    constexpr const char* MQTT_TOPIC_CONFIG_SIM          = "sim";
+    constexpr uint32_t    SIM_LATENCY_MS                 = 20;    // Write round-trip time
+    constexpr uint32_t    SIM_JITTER_MS                  = 10;    // Random extra round-trip time
+    constexpr uint8_t     SIM_LOSS_PCT                   = 0;     // Lost writes and failed connects in %
+    constexpr uint32_t    SIM_CONNECT_MS                 = 800;   // Duration of a connect attempt
 }
@@ -0,0 +1,359 @@
+/**
+ * @file ConnectionAdmission.h
+ *
+ * @brief Admission control for BLE connection attempts.
+ *
+ * Commands for a controller that is not connected are queued here instead of
+ * connecting inline in the MQTT callback. The queue is worked off from the
+ * main loop, one connect attempt at a time, with a short pause in between so
+ * the BLE stack can settle and the MQTT client is serviced between attempts.
+ *
+ * The next controller to connect is chosen by:
+ * 1. Number of queued commands (most first).
+ * 2. Last use of the controller (most recent first).
+ * 3. Time of the first queued command (oldest first).
+ *
+ * A controller that fails to connect is retried with a growing backoff; after
+ * CONFIG::BLE_CONNECT_MAX_FAILURES attempts its queued commands are rejected.
+ * BLEController::connect() makes a single attempt, the retries are only done here.
+ * Once connected, the queued commands are executed in arrival order.
+ *
+ * Only one attempt is in flight at a time because BLEClient::connect() blocks
+ * in the ESP32 BLE library.
+ *
+ * Author: Robert W.B. Linn
+ * Copyright © 2025 Robert W.B. Linn
+ * License: MIT — see LICENSE file.
+ */
+
+#pragma once
+
+#include <map>
+#include <vector>
+#include <functional>
+#include <Arduino.h>
+#include "Log.h"
+#include "Configuration.h"
+#include "Constants.h"
+#include "StringUtils.h"
+#include "Metrics.h"
+#include "BLEController.h"
+#include "HubStateStore.h"
+#include "CommandContext.h"
+
+/**
+ * @class ConnectionAdmission
+ * @brief Singleton queueing and ordering BLE connect attempts.
+ */
+class ConnectionAdmission {
+public:
+    using ExecuteHandler = std::function<String(const String&, const CommandContext&)>;              ///< Executes a JSON command, returns status JSON
+    using ReplyHandler   = std::function<void(const String&, const String&, const CommandContext&)>; ///< Publishes a status JSON for a controller key
+
+    /**
+     * @brief Access the singleton instance.
+     */
+    static ConnectionAdmission& getInstance() {
+        static ConnectionAdmission instance;
+        return instance;
+    }
+
+    /**
+     * @brief Set the handlers used to execute queued commands and publish their status.
+     * @param execute Executes a JSON command once its controller is connected.
+     * @param reply Publishes the status of a queued command.
+     */
+    void setHandlers(ExecuteHandler execute, ReplyHandler reply) {
+        execute_ = execute;
+        reply_ = reply;
+    }
+
+    /**
+     * @brief Queue a command until its controller is connected.
+     * If the controller queue is full, the oldest command is dropped.
+     *
+     * @param key Controller key (type|mac).
+     * @param controller Controller to connect.
+     * @param jsonCommand The JSON command to execute after connecting.
+     * @param context Context of the command, returned with its status.
+     */
+    void enqueue(const String& key, BLEController* controller, const String& jsonCommand, const CommandContext& context) {
+        uint32_t now = millis();
+        if (queued_ == 0) {
+            burstStartMs_ = now;
+        }
+
+        Candidate& c = candidates_[key];
+        if (c.commands.empty()) {
+            c.controller = controller;
+            c.firstQueuedMs = now;
+        }
+
+        if (c.commands.size() >= CONFIG::BLE_CONNECT_QUEUE_SIZE) {
+            LOGW("[ConnectionAdmission][enqueue] Queue full for %s, dropping oldest command", key.c_str());
+            CommandContext dropped = c.commands.front().context;
+            c.commands.erase(c.commands.begin());
+            queued_--;
+            dropped_[key]++;
+            metrics.recordConnectDiscard(1, 0);
+            sendReply(StringUtils::formatStatus(COMMAND_STATUS::ERROR,
+                                                "Command dropped, connect queue full for %s",
+                                                key.c_str()), key, dropped);
+        }
+
+        c.commands.push_back({ jsonCommand, context });
+        HubStateStore::getInstance().setQueued(controller->getHandle(), c.commands.size());
+        queued_++;
+        revision_++;
+        metrics.recordConnectQueueDepth(queued_);
+        LOGI("[ConnectionAdmission][enqueue] Queued command for %s (controller=%u, total=%u)",
+             key.c_str(), static_cast<unsigned>(c.commands.size()), static_cast<unsigned>(queued_));
+    }
+
+    /**
+     * @brief Mark a controller as used, raising its priority for the next connect.
+     * @param key Controller key (type|mac).
+     */
+    void noteUsed(const String& key) {
+        lastUsedMs_[key] = millis();
+    }
+
+    /**
+     * @brief Check if commands are queued for a controller.
+     * @param key Controller key (type|mac).
+     * @return true if the controller waits for a connect attempt.
+     */
+    bool isQueued(const String& key) const {
+        return candidates_.find(key) != candidates_.end();
+    }
+
+    /**
+     * @brief Get the total number of queued commands.
+     */
+    size_t queuedCount() const {
+        return queued_;
+    }
+
+    /**
+     * @brief Get the number of queued commands of a controller.
+     * @param key Controller key (type|mac).
+     */
+    size_t queuedCount(const String& key) const {
+        auto it = candidates_.find(key);
+        return it != candidates_.end() ? it->second.commands.size() : 0;
+    }
+
+    /**
+     * @brief Get the number of commands of a controller dropped or rejected so far.
+     * @param key Controller key (type|mac).
+     */
+    uint32_t droppedCount(const String& key) const {
+        auto it = dropped_.find(key);
+        return it != dropped_.end() ? it->second : 0;
+    }
+
+    /**
+     * @brief Get the number of commands dropped or rejected so far.
+     */
+    uint32_t droppedCount() const {
+        uint32_t total = 0;
+        for (const auto& [key, count] : dropped_) total += count;
+        return total;
+    }
+
+    /**
+     * @brief Get a counter that changes whenever the queue changes.
+     */
+    uint32_t revision() const {
+        return revision_;
+    }
+
+    /**
+     * @brief Start the next connect attempt if one is due.
+     * Call from the main loop. Blocks for the duration of one connect attempt.
+     */
+    void loop() {
+        if (candidates_.empty()) return;
+
+        uint32_t now = millis();
+        if (now - lastAttemptEndMs_ < CONFIG::BLE_CONNECT_SPACING_MS) return;
+
+        auto next = selectNext(now);
+        if (next == candidates_.end()) return;
+
+        String key = next->first;
+        Candidate& c = next->second;
+
+        LOGI("[ConnectionAdmission][loop] Connecting %s (%u queued)", key.c_str(), static_cast<unsigned>(c.commands.size()));
+        uint32_t start = millis();
+        bool ok = c.controller->isConnected() || c.controller->connect();
+        uint32_t duration = millis() - start;
+        lastAttemptEndMs_ = millis();
+        metrics.recordConnectAttempt(duration, ok);
+
+        if (ok) {
+            LOGI("[ConnectionAdmission][loop] Connected %s in %u ms", key.c_str(), duration);
+            std::vector<QueuedCommand> commands;
+            commands.swap(c.commands);
+            queued_ -= commands.size();
+            revision_++;
+            HubStateStore::getInstance().setQueued(c.controller->getHandle(), 0);
+            candidates_.erase(next);
+            noteUsed(key);
+
+            for (const QueuedCommand& cmd : commands) {
+                if (execute_) sendReply(execute_(cmd.json, cmd.context), key, cmd.context);
+            }
+        } else {
+            c.failures++;
+            LOGW("[ConnectionAdmission][loop] Connect %s failed (%u/%u)", key.c_str(), c.failures, CONFIG::BLE_CONNECT_MAX_FAILURES);
+
+            if (c.failures >= CONFIG::BLE_CONNECT_MAX_FAILURES) {
+                metrics.recordConnectDiscard(0, c.commands.size());
+                dropped_[key] += c.commands.size();
+                queued_ -= c.commands.size();
+                revision_++;
+                std::vector<QueuedCommand> commands;
+                commands.swap(c.commands);
+                HubStateStore::getInstance().setQueued(c.controller->getHandle(), 0);
+                candidates_.erase(next);
+                String msg = StringUtils::formatStatus(COMMAND_STATUS::ERROR,
+                                                       "Failed to connect to: %s",
+                                                       key.c_str());
+                for (const QueuedCommand& cmd : commands) {
+                    sendReply(msg, key, cmd.context);
+                }
+            } else {
+                c.notBeforeMs = lastAttemptEndMs_ + CONFIG::BLE_CONNECT_BACKOFF_MS * c.failures;
+            }
+        }
+
+        if (queued_ == 0) {
+            uint32_t drain = millis() - burstStartMs_;
+            metrics.recordConnectDrain(drain);
+            LOGI("[ConnectionAdmission][loop] Connect queue drained in %u ms", drain);
+        }
+    }
+
+    /**
+     * @brief Remove a controller from the connect queue, e.g. on a disconnect before its connect.
+     * Each queued command gets an error status.
+     * @param key Controller key (type|mac).
+     * @return Number of cancelled commands.
+     */
+    size_t cancel(const String& key) {
+        auto it = candidates_.find(key);
+        if (it == candidates_.end()) return 0;
+
+        std::vector<QueuedCommand> commands;
+        commands.swap(it->second.commands);
+        HubStateStore::getInstance().setQueued(it->second.controller->getHandle(), 0);
+        candidates_.erase(it);
+        queued_ -= commands.size();
+        revision_++;
+        LOGI("[ConnectionAdmission][cancel] Cancelled %u queued commands for %s",
+             static_cast<unsigned>(commands.size()), key.c_str());
+
+        String msg = StringUtils::formatStatus(COMMAND_STATUS::ERROR,
+                                               "Command cancelled by disconnect of %s",
+                                               key.c_str());
+        for (const QueuedCommand& cmd : commands) {
+            sendReply(msg, key, cmd.context);
+        }
+        return commands.size();
+    }
+
+    /**
+     * @brief Drop all queued commands without replying.
+     * Must be called before the controllers are deleted.
+     */
+    void clear() {
+        candidates_.clear();
+        HubStateStore::getInstance().clearQueued();
+        queued_ = 0;
+        revision_++;
+        LOGI("[ConnectionAdmission] Cleared connect queue.");
+    }
+
+private:
+    /**
+     * @brief A command waiting for its controller to connect.
+     */
+    struct QueuedCommand {
+        String json;                            ///< JSON command
+        CommandContext context;                 ///< Context returned with its status
+    };
+
+    /**
+     * @brief A controller waiting for a connect attempt with its queued commands.
+     */
+    struct Candidate {
+        BLEController* controller = nullptr;    ///< Controller to connect
+        std::vector<QueuedCommand> commands;    ///< Queued commands in arrival order
+        uint32_t firstQueuedMs = 0;             ///< Arrival of the oldest queued command
+        uint32_t notBeforeMs = 0;               ///< Backoff after a failed attempt
+        uint8_t failures = 0;                   ///< Failed attempts so far
+    };
+
+    std::map<String, Candidate> candidates_;    ///< Waiting controllers by key
+    std::map<String, uint32_t> lastUsedMs_;     ///< Last command time by key
+    std::map<String, uint32_t> dropped_;        ///< Dropped or rejected commands by key
+    size_t queued_ = 0;                         ///< Total queued commands
+    uint32_t revision_ = 0;                     ///< Changes whenever the queue changes
+    uint32_t lastAttemptEndMs_ = 0;             ///< End of the previous attempt
+    uint32_t burstStartMs_ = 0;                 ///< First command queued while the queue was empty
+    ExecuteHandler execute_;                    ///< Executes a queued command
+    ReplyHandler reply_;                        ///< Publishes a status
+
+    /**
+     * @brief Select the candidate to connect next.
+     * @param now Current time in ms.
+     * @return Iterator to the candidate or end() if none is due.
+     */
+    std::map<String, Candidate>::iterator selectNext(uint32_t now) {
+        auto best = candidates_.end();
+        for (auto it = candidates_.begin(); it != candidates_.end(); ++it) {
+            const Candidate& c = it->second;
+            if (c.failures > 0 && static_cast<int32_t>(now - c.notBeforeMs) < 0) continue;
+            if (best == candidates_.end() || higherPriority(it, best)) {
+                best = it;
+            }
+        }
+        return best;
+    }
+
+    /**
+     * @brief Compare two candidates by queued commands, last use and age.
+     */
+    bool higherPriority(std::map<String, Candidate>::iterator a, std::map<String, Candidate>::iterator b) {
+        if (a->second.commands.size() != b->second.commands.size()) {
+            return a->second.commands.size() > b->second.commands.size();
+        }
+        uint32_t usedA = lastUsed(a->first);
+        uint32_t usedB = lastUsed(b->first);
+        if (usedA != usedB) {
+            return usedA > usedB;
+        }
+        return static_cast<int32_t>(a->second.firstQueuedMs - b->second.firstQueuedMs) < 0;
+    }
+
+    /**
+     * @brief Last use of a controller, 0 if never used.
+     */
+    uint32_t lastUsed(const String& key) const {
+        auto it = lastUsedMs_.find(key);
+        return it != lastUsedMs_.end() ? it->second : 0;
+    }
+
+    /**
+     * @brief Publish a status if a reply handler is set and the status is not empty.
+     */
+    void sendReply(const String& msg, const String& key, const CommandContext& context) {
+        if (reply_ && !msg.isEmpty()) reply_(msg, key, context);
+    }
+
+    // Singleton: private constructor and deleted copy operations
+    ConnectionAdmission() {}
+    ConnectionAdmission(const ConnectionAdmission&) = delete;
+    ConnectionAdmission& operator=(const ConnectionAdmission&) = delete;
+};
@@ -20,6 +20,17 @@ namespace INFO {
     constexpr const char* VERSION = CONFIG::VERSION;
 }
 
+// ============================================================================
+// Controller capabilities, checked before a command causes any BLE work.
+// ============================================================================
+namespace CAPABILITY {
+    constexpr uint8_t OP_POWER       = 0x01;  // "power" or "speed" on a port
+    constexpr uint8_t OP_DIRECTION   = 0x02;  // "direction" with power on a port
+    constexpr uint8_t OP_DISCONNECT  = 0x04;  // "disconnect"
+    constexpr uint8_t OP_ALL         = OP_POWER | OP_DIRECTION | OP_DISCONNECT;
+    constexpr uint8_t MAX_PERCENT    = 100;   // Power and speed in %
+}
+
 // ============================================================================
 // BRICK BuWizz2 BLE UUIDs and name.
 // ============================================================================
@@ -30,6 +41,9 @@ namespace BUWIZZ2 {
     constexpr const char* UUID_MODEL_NUMBER    = "00002a24-0000-1000-8000-00805f9b34fb";  // Model number characteristic
     constexpr const char* UUID_FIRMWARE_REV    = "00002a26-0000-1000-8000-00805f9b34fb";  // Firmware revision characteristic
     constexpr const char* NAME                 = "BuWizz2";                               // Device advertised name
+    constexpr uint8_t     TYPE_ID              = 2;                                       // Type id in binary telemetry
+    constexpr uint8_t     PORT_COUNT           = 4;                                       // Ports A-D
+    constexpr uint8_t     OPERATIONS           = CAPABILITY::OP_ALL;                      // Supported command operations
 }
 
 // ============================================================================
@@ -39,6 +53,19 @@ namespace LEGOHUBNO4 {
     constexpr const char* UUID_SERVICE         = "00001623-1212-efde-1623-785feabcd123";  // LEGO Hub No 4 service UUID
     constexpr const char* UUID_CHARACTERISTIC  = "00001624-1212-efde-1623-785feabcd123";  // Control characteristic UUID
     constexpr const char* NAME                 = "LEGOHubNo4";                            // Device advertised name
+    constexpr uint8_t     TYPE_ID              = 1;                                       // Type id in binary telemetry
+    constexpr uint8_t     PORT_COUNT           = 2;                                       // Ports A-B
+    constexpr uint8_t     OPERATIONS           = CAPABILITY::OP_ALL;                      // Supported command operations
+}
+
+// ============================================================================
+// Simulated hub for benchmarks (SIMULATED_HUBS)
+// ============================================================================
+namespace SIMHUB {
+    constexpr const char* NAME                 = "SimHub";                                // Controller name in commands
+    constexpr uint8_t     TYPE_ID              = 3;                                       // Type id in binary telemetry
+    constexpr uint8_t     PORT_COUNT           = 4;                                       // Ports A-D
+    constexpr uint8_t     OPERATIONS           = CAPABILITY::OP_ALL;                      // Supported command operations
 }
 
 // ============================================================================
@@ -52,6 +79,7 @@ namespace COMMAND {
     constexpr const char* SPEED      = "speed";         // Optional command
     constexpr const char* DIRECTION  = "direction";
     constexpr const char* DISCONNECT = "disconnect";
+    constexpr const char* CORRELATION_ID = "cid";  // Optional, returned with the status
     constexpr const char* FORWARD    = "forward";
     constexpr const char* BACKWARD   = "backward";
 }
@@ -63,6 +91,140 @@ namespace TERMINAL_COMMAND {
     constexpr const char* RESTART   = "restart";
     constexpr const char* RESET     = "reset";
     constexpr const char* STATUS    = "status";
+    constexpr const char* PROFILE   = "profile";   // profile start [hz] [ms] | stop | dump | clear
+}
+
+// ============================================================================
+// Config status request values
+// ============================================================================
+namespace CONFIG_STATUS {
+    constexpr int HEAP    = 1;
+    constexpr int METRICS = 2;
+    constexpr int METRICS_RESET = 3;
+}
+
+// ============================================================================
+// WiFi power-save modes
+// ============================================================================
+namespace WIFI_POWER_SAVE {
+    constexpr const char* NONE = "none";
+    constexpr const char* MIN  = "min";
+    constexpr const char* MAX  = "max";
+
+    enum Mode : uint8_t {
+        MODE_NONE = 0,
+        MODE_MIN  = 1,
+        MODE_MAX  = 2,
+        MODE_COUNT
+    };
+}
+
+// Helper function to convert a power-save mode to its config name.
+constexpr const char* powerSaveName(uint8_t mode) {
+    switch (mode) {
+        case WIFI_POWER_SAVE::MODE_NONE: return WIFI_POWER_SAVE::NONE;
+        case WIFI_POWER_SAVE::MODE_MIN:  return WIFI_POWER_SAVE::MIN;
+        case WIFI_POWER_SAVE::MODE_MAX:  return WIFI_POWER_SAVE::MAX;
+        default: return "unknown";
+    }
+}
+
+// ============================================================================
+// Payload encodings, selectable per topic
+// ============================================================================
+namespace ENCODING {
+    constexpr const char* JSON    = "json";     // JSON text
+    constexpr const char* MSGPACK = "msgpack";  // MessagePack, same structure as JSON
+    constexpr const char* FIXED   = "fixed";    // Fixed binary schema, telemetry only
+
+    enum Format : uint8_t {
+        FORMAT_JSON    = 0,
+        FORMAT_MSGPACK = 1,
+        FORMAT_FIXED   = 2,
+        FORMAT_COUNT
+    };
+}
+
+// Helper function to convert an encoding to its config name.
+constexpr const char* encodingName(uint8_t format) {
+    switch (format) {
+        case ENCODING::FORMAT_JSON:    return ENCODING::JSON;
+        case ENCODING::FORMAT_MSGPACK: return ENCODING::MSGPACK;
+        case ENCODING::FORMAT_FIXED:   return ENCODING::FIXED;
+        default: return "unknown";
+    }
+}
+
+// ============================================================================
+// Telemetry fixed schema, all values little-endian.
+// Header:  magic u8, version u8, count u8, wifi rssi i8, uptime ms u32, free heap u32
+// Record:  mac[6], type u8, flags u8, battery mV u16, queued commands u8, ble rssi i8,
+//          requested port levels i8[4], acknowledged port levels i8[4]
+// ============================================================================
+namespace TELEMETRY {
+    constexpr uint8_t MAGIC          = 0xC1;  // Never used in MessagePack, never '{' in JSON
+    constexpr uint8_t VERSION        = 2;
+    constexpr size_t  HEADER_SIZE    = 12;
+    constexpr size_t  RECORD_SIZE    = 20;
+
+    constexpr uint8_t FLAG_CONNECTED = 0x01;
+    constexpr uint8_t FLAG_AWAKE     = 0x02;
+    constexpr uint8_t FLAG_QUEUED    = 0x04;
+    constexpr uint8_t FLAG_PENDING   = 0x08;  // Requested level not acknowledged yet
+}
+
+// ============================================================================
+// Profiler histogram message, all values little-endian (see Profiler.h)
+// Header:  magic u8, version u8, core u8, flags u8, hz u16, records u16,
+//          samples u32, dropped samples u32, isr cycles per sample u32
+// Record:  pc u32, samples u32
+// ============================================================================
+namespace PROFILE {
+    constexpr uint8_t MAGIC       = 0xC2;   // Profile topic only, always binary
+    constexpr uint8_t VERSION     = 1;
+    constexpr size_t  HEADER_SIZE = 20;
+    constexpr size_t  RECORD_SIZE = 8;
+    constexpr size_t  MAX_RECORDS = 128;    // Per message, leaves room for the MQTT header and topic
+
+    constexpr uint8_t FLAG_LAST   = 0x01;   // Last message of the core
+}
+
+// ============================================================================
+// Asset store flash format, all values little-endian (see AssetStore.h)
+// Asset chunk message: offset u32, data
+// ============================================================================
+namespace ASSET {
+    constexpr uint32_t MAGIC       = 0x53414342;  // "BCAS"
+    constexpr uint16_t FORMAT      = 1;
+    constexpr uint32_t SECTOR_SIZE = 4096;        // Flash erase unit
+    constexpr size_t   NAME_SIZE   = 16;          // Including the terminating zero
+
+    constexpr const char* RAW         = "raw";
+    constexpr const char* SEQUENCE    = "sequence";
+    constexpr const char* RULES       = "rules";
+    constexpr const char* CALIBRATION = "calibration";
+    constexpr const char* GROUP       = "group";
+
+    enum Type : uint8_t {
+        TYPE_RAW         = 0,
+        TYPE_SEQUENCE    = 1,
+        TYPE_RULES       = 2,
+        TYPE_CALIBRATION = 3,
+        TYPE_GROUP       = 4,
+        TYPE_COUNT
+    };
+}
+
+// Helper function to convert an asset type to its name.
+constexpr const char* assetTypeName(uint8_t type) {
+    switch (type) {
+        case ASSET::TYPE_RAW:         return ASSET::RAW;
+        case ASSET::TYPE_SEQUENCE:    return ASSET::SEQUENCE;
+        case ASSET::TYPE_RULES:       return ASSET::RULES;
+        case ASSET::TYPE_CALIBRATION: return ASSET::CALIBRATION;
+        case ASSET::TYPE_GROUP:       return ASSET::GROUP;
+        default: return "unknown";
+    }
 }
 
 // ============================================================================
@@ -73,6 +235,14 @@ namespace COMMAND_STATUS {
     constexpr const char* ERROR = "ERROR";
 }
 
+// ============================================================================
+// MQTT 5 user properties
+// ============================================================================
+namespace USER_PROPERTY {
+    constexpr const char* CORRELATION_ID = "cid";     // Correlation id of the command
+    constexpr const char* SERVICE_TIME   = "svc_ms";  // Time from receiving the command to its status
+}
+
 // ============================================================================
 // Motor port enums
 // ============================================================================
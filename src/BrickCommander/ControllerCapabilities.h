@@ -0,0 +1,62 @@
+/**
+ * @file ControllerCapabilities.h
+ *
+ * @brief Declared capabilities of each controller type.
+ *
+ * The CommandHandler checks a command against the capabilities of its
+ * controller type (ports, power range, operations) before a controller is
+ * created or connected, so invalid commands are rejected without BLE work.
+ *
+ * Author: Robert W.B. Linn
+ * Copyright © 2025 Robert W.B. Linn
+ * License: MIT — see LICENSE file.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include "Configuration.h"
+#include "Constants.h"
+
+/**
+ * @brief Capabilities of a controller type.
+ */
+struct ControllerCapabilities {
+    const char* name;           ///< Controller name in commands (case-insensitive)
+    uint8_t typeId;             ///< Type id, see TYPE_ID in Constants.h
+    uint8_t portCount;          ///< Ports 0…portCount-1
+    uint8_t maxPercent;         ///< Highest power and speed in %
+    uint8_t operations;         ///< CAPABILITY::OP_* bits
+
+    /**
+     * @brief Check if an operation is supported.
+     * @param op CAPABILITY::OP_* bit.
+     */
+    bool supports(uint8_t op) const {
+        return (operations & op) == op;
+    }
+};
+
+/**
+ * @brief Capabilities of all controller types.
+ */
+constexpr ControllerCapabilities CONTROLLER_CAPABILITIES[] = {
+    { LEGOHUBNO4::NAME, LEGOHUBNO4::TYPE_ID, LEGOHUBNO4::PORT_COUNT, CAPABILITY::MAX_PERCENT, LEGOHUBNO4::OPERATIONS },
+    { BUWIZZ2::NAME,    BUWIZZ2::TYPE_ID,    BUWIZZ2::PORT_COUNT,    CAPABILITY::MAX_PERCENT, BUWIZZ2::OPERATIONS },
+#ifdef SIMULATED_HUBS
+    { SIMHUB::NAME,     SIMHUB::TYPE_ID,     SIMHUB::PORT_COUNT,     CAPABILITY::MAX_PERCENT, SIMHUB::OPERATIONS },
+#endif
+    // Add additional Controllers here
+};
+
+/**
+ * @brief Find the capabilities of a controller type.
+ * @param name Controller name, e.g. "legohubno4" (case-insensitive).
+ * @return Capabilities or nullptr if the type is unknown.
+ */
+inline const ControllerCapabilities* findCapabilities(const String& name) {
+    for (const ControllerCapabilities& caps : CONTROLLER_CAPABILITIES) {
+        if (name.equalsIgnoreCase(caps.name)) return &caps;
+    }
+    return nullptr;
+}
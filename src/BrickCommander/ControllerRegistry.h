@@ -16,6 +16,7 @@
 #pragma once
 
 #include <map>
+#include <functional>
 #include <Arduino.h>
 #include "BLEController.h"
 #include "Log.h"
@@ -34,6 +35,16 @@ public:
         return instance;
     }
 
+    /**
+     * @brief Builds the registry key for a controller.
+     * @param type Controller type string (e.g., "legohubno4").
+     * @param mac  MAC address string (e.g., "90:84:2B:C1:94:79").
+     * @return Key "type|mac".
+     */
+    static String makeKey(const String& type, const String& mac) {
+        return type + "|" + mac;
+    }
+
     /**
      * @brief Registers a controller under the specified type and MAC address.
      * If a controller with the same key already exists, it is overwritten.
@@ -43,7 +54,7 @@ public:
      * @param controller Pointer to BLEController instance (ownership remains external).
      */
     void registerController(const String& type, const String& mac, BLEController* controller) {
-        String key = type + "|" + mac;
+        String key = makeKey(type, mac);
         controllers_[key] = controller;
         LOGI("[ControllerRegistry] Registered controller: %s", key.c_str());
     }
@@ -55,7 +66,7 @@ public:
      * @return Pointer to BLEController instance if found, nullptr otherwise.
      */
     BLEController* getController(const String& type, const String& mac) {
-        String key = type + "|" + mac;
+        String key = makeKey(type, mac);
         auto it = controllers_.find(key);
         if (it != controllers_.end()) {
             return it->second;
@@ -63,6 +74,23 @@ public:
         return nullptr;
     }
 
+    /**
+     * @brief Calls a function for each registered controller, ordered by key.
+     * @param fn Function receiving the key (type|mac) and the controller.
+     */
+    void forEach(const std::function<void(const String& key, BLEController* controller)>& fn) const {
+        for (const auto& [key, ctrl] : controllers_) {
+            if (ctrl) fn(key, ctrl);
+        }
+    }
+
+    /**
+     * @brief Gets the number of registered controllers.
+     */
+    size_t count() const {
+        return controllers_.size();
+    }
+
     /**
      * @brief Disconnects and deletes all registered controllers.
      * Should be called during shutdown to free memory and clean up BLE.
@@ -0,0 +1,638 @@
+/**
+ * @file EmbeddedBroker.h
+ *
+ * @brief Minimal on-device MQTT 3.1.1 broker for standalone installations.
+ *
+ * Only built if EMBEDDED_BROKER is defined in Configuration.h. Local clients
+ * connect to the commander on CONFIG::BROKER_PORT; their messages are passed
+ * to the message handler of the MqttHandler on the main loop, so commands
+ * reach the command pipeline without a round trip over an external broker
+ * or a loopback TCP connection. Messages published by the commander are
+ * delivered to the subscribed local clients.
+ *
+ * Supported:
+ * - CONNECT with clean session, keep alive and last will. Username and
+ *   password must match the configured MQTT credentials (CONNACK 0x05
+ *   otherwise); without a configured username any client is accepted.
+ * - PUBLISH QoS 0, 1 and 2 from clients (QoS 2 is delivered on receipt,
+ *   a resent duplicate is delivered again). Delivery to clients is QoS 0.
+ * - SUBSCRIBE / UNSUBSCRIBE with + and # wildcards, granted QoS 0.
+ * - Retained messages, up to CONFIG::BROKER_MAX_RETAINED topics.
+ * - PINGREQ, DISCONNECT.
+ *
+ * Not supported: persistent sessions, QoS 1/2 delivery to clients, MQTT 5.
+ *
+ * Author: Robert W.B. Linn
+ * Copyright © 2025 Robert W.B. Linn
+ * License: MIT — see LICENSE file.
+ */
+
+#pragma once
+
+#include <WiFi.h>
+#include <functional>
+#include <vector>
+#include "Log.h"
+#include "Configuration.h"
+#include "Metrics.h"
+
+/**
+ * @class EmbeddedBroker
+ * @brief Singleton MQTT 3.1.1 broker for a few local clients.
+ */
+class EmbeddedBroker {
+public:
+    /**
+     * @brief Receives a message published by a local client.
+     */
+    using MessageHandler = std::function<void(const char* topic, const uint8_t* payload, size_t length, bool retain)>;
+
+    static constexpr uint8_t  MAX_CLIENTS       = CONFIG::BROKER_MAX_CLIENTS;        ///< Concurrent local clients
+    static constexpr uint8_t  MAX_SUBSCRIPTIONS = CONFIG::BROKER_MAX_SUBSCRIPTIONS;  ///< Topic filters per client
+    static constexpr uint8_t  MAX_RETAINED      = CONFIG::BROKER_MAX_RETAINED;       ///< Retained topics
+    static constexpr uint16_t PACKET_SIZE       = CONFIG::BROKER_PACKET_SIZE;        ///< Max packet size from a client
+
+    /**
+     * @brief Access the singleton instance.
+     */
+    static EmbeddedBroker& getInstance() {
+        static EmbeddedBroker instance;
+        return instance;
+    }
+
+    /**
+     * @brief Start listening for local clients.
+     * @param port TCP port.
+     * @param handler Receives the messages published by local clients.
+     * @param username Username required from the clients, empty = no authentication.
+     * @param password Password required with the username.
+     */
+    void begin(uint16_t port, MessageHandler handler, const String& username = "", const String& password = "") {
+        handler_ = handler;
+        username_ = username;
+        password_ = password;
+        if (username_.isEmpty()) {
+            LOGW("[EmbeddedBroker][begin] No MQTT username configured, local clients are not authenticated");
+        }
+        server_.begin(port);
+        server_.setNoDelay(true);
+        running_ = true;
+        LOGI("[EmbeddedBroker][begin] Listening on port %u, max %u clients", port, MAX_CLIENTS);
+    }
+
+    /**
+     * @brief Accept clients, process their packets and check keep alives. Call from the main loop.
+     */
+    void loop() {
+        if (!running_) return;
+        uint32_t now = millis();
+
+        WiFiClient incoming = server_.accept();
+        if (incoming) accept(incoming, now);
+
+        for (Session& s : sessions_) {
+            if (!s.active) continue;
+
+            if (!s.client.connected()) {
+                LOGI("[EmbeddedBroker][loop] Client %s connection lost", s.clientId.c_str());
+                close(s, true);
+                continue;
+            }
+
+            if (!receive(s, now)) {
+                close(s, true);
+                continue;
+            }
+
+            // No CONNECT yet, or no packet within 1.5 times the keep alive
+            uint32_t limitMs = s.connected ? s.keepAliveS * 1500UL : CONFIG::BROKER_CONNECT_TIMEOUT_MS;
+            if (limitMs > 0 && now - s.lastRxMs > limitMs) {
+                LOGW("[EmbeddedBroker][loop] Client %s timed out", s.clientId.c_str());
+                close(s, true);
+            }
+        }
+    }
+
+    /**
+     * @brief Deliver a message to the subscribed local clients, keep it if retained.
+     * @param topic Topic name.
+     * @param payload Payload.
+     * @param length Payload length.
+     * @param retain Keep the message for clients subscribing later; an empty payload removes it.
+     * @return Number of clients the message was delivered to.
+     */
+    uint8_t publish(const char* topic, const uint8_t* payload, size_t length, bool retain = false) {
+        if (!running_) return 0;
+        if (retain) storeRetained(topic, payload, length);
+
+        uint8_t delivered = 0;
+        for (Session& s : sessions_) {
+            if (!s.active || !s.connected || !isSubscribed(s, topic)) continue;
+            if (send(s, topic, payload, length, false)) {
+                delivered++;
+            } else {
+                metrics.recordBrokerError();
+            }
+        }
+        metrics.recordBrokerDeliver(delivered);
+        return delivered;
+    }
+
+    /**
+     * @brief Get the number of connected local clients.
+     */
+    uint8_t clientCount() const {
+        uint8_t n = 0;
+        for (const Session& s : sessions_) {
+            if (s.active && s.connected) n++;
+        }
+        return n;
+    }
+
+    /**
+     * @brief Check if the broker is listening.
+     */
+    bool isRunning() const {
+        return running_;
+    }
+
+    /**
+     * @brief Check if a topic name matches a topic filter with + and # wildcards.
+     * @param filter Topic filter, e.g. "brickcommander/+".
+     * @param topic Topic name, e.g. "brickcommander/status".
+     */
+    static bool topicMatches(const char* filter, const char* topic) {
+        // Wildcards at the first level do not match topics starting with $
+        if (topic[0] == '$' && (filter[0] == '+' || filter[0] == '#')) return false;
+
+        while (*filter && *topic) {
+            if (*filter == '#') return true;
+            if (*filter == '+') {
+                while (*topic && *topic != '/') topic++;
+                filter++;
+                continue;
+            }
+            if (*filter != *topic) return false;
+            filter++;
+            topic++;
+        }
+        if (*topic == '\0') {
+            // "a/#" also matches "a", "#" and "+" match an empty last level of "a/"
+            if (filter[0] == '/' && filter[1] == '#' && filter[2] == '\0') return true;
+            if ((filter[0] == '#' || filter[0] == '+') && filter[1] == '\0') return true;
+        }
+        return *filter == '\0' && *topic == '\0';
+    }
+
+private:
+    // Control packet types (fixed header bits 7-4)
+    enum PacketType : uint8_t {
+        CONNECT = 1, CONNACK = 2, PUBLISH = 3, PUBACK = 4, PUBREC = 5, PUBREL = 6, PUBCOMP = 7,
+        SUBSCRIBE = 8, SUBACK = 9, UNSUBSCRIBE = 10, UNSUBACK = 11, PINGREQ = 12, PINGRESP = 13, DISCONNECT = 14
+    };
+
+    /**
+     * @brief Connection of one local client.
+     */
+    struct Session {
+        WiFiClient client;
+        bool active = false;                        ///< Slot in use
+        bool connected = false;                     ///< CONNECT accepted
+        String clientId;
+        uint16_t keepAliveS = 0;                    ///< Keep alive from CONNECT, 0 = off
+        uint32_t lastRxMs = 0;                      ///< Time of the last received bytes
+        String subscriptions[MAX_SUBSCRIPTIONS];    ///< Topic filters
+        uint8_t subscriptionCount = 0;
+        bool hasWill = false;
+        bool willRetain = false;
+        String willTopic;
+        std::vector<uint8_t> willPayload;
+        uint8_t rx[PACKET_SIZE];                    ///< Bytes of incomplete packets
+        size_t rxLength = 0;
+    };
+
+    /**
+     * @brief A retained message.
+     */
+    struct Retained {
+        String topic;                               ///< Empty = free slot
+        std::vector<uint8_t> payload;
+    };
+
+    WiFiServer server_;
+    bool running_ = false;
+    MessageHandler handler_;
+    String username_;                               ///< Required username, empty = no authentication
+    String password_;                               ///< Required password
+    Session sessions_[MAX_CLIENTS];
+    Retained retained_[MAX_RETAINED];
+    uint8_t tx_[PACKET_SIZE];                       ///< Outgoing packet
+
+    /**
+     * @brief Take a new TCP connection into a free session slot.
+     */
+    void accept(WiFiClient& client, uint32_t now) {
+        for (Session& s : sessions_) {
+            if (s.active) continue;
+            s.client = client;
+            s.client.setNoDelay(true);
+            s.active = true;
+            s.connected = false;
+            s.clientId = client.remoteIP().toString();
+            s.lastRxMs = now;
+            s.rxLength = 0;
+            s.subscriptionCount = 0;
+            s.hasWill = false;
+            return;
+        }
+        LOGW("[EmbeddedBroker][accept] No free slot for %s, max %u clients",
+             client.remoteIP().toString().c_str(), MAX_CLIENTS);
+        metrics.recordBrokerError();
+        client.stop();
+    }
+
+    /**
+     * @brief Close a session, publishing its last will if the client did not disconnect.
+     */
+    void close(Session& s, bool publishWill) {
+        // The will of a client whose CONNECT was not accepted is not published
+        publishWill = publishWill && s.connected;
+        s.client.stop();
+        s.active = false;
+        s.connected = false;
+        s.rxLength = 0;
+        for (uint8_t i = 0; i < s.subscriptionCount; i++) s.subscriptions[i] = String();
+        s.subscriptionCount = 0;
+
+        if (publishWill && s.hasWill) {
+            LOGI("[EmbeddedBroker][close] Publishing will of %s to %s", s.clientId.c_str(), s.willTopic.c_str());
+            route(s.willTopic.c_str(), s.willPayload.data(), s.willPayload.size(), s.willRetain);
+        }
+        s.hasWill = false;
+        s.willTopic = String();
+        s.willPayload.clear();
+    }
+
+    /**
+     * @brief Read the available bytes and handle the complete packets.
+     * @return false if the session must be closed.
+     */
+    bool receive(Session& s, uint32_t now) {
+        int available = s.client.available();
+        if (available <= 0) return true;
+
+        size_t room = PACKET_SIZE - s.rxLength;
+        size_t count = static_cast<size_t>(available) < room ? static_cast<size_t>(available) : room;
+        int n = s.client.read(&s.rx[s.rxLength], count);
+        if (n <= 0) return true;
+        s.rxLength += n;
+        s.lastRxMs = now;
+
+        while (s.rxLength >= 2) {
+            // Remaining length, 1 to 4 bytes
+            size_t remaining = 0;
+            size_t headerLength = 0;
+            for (size_t i = 1; i < 5; i++) {
+                if (i >= s.rxLength) return true;  // Incomplete length
+                remaining |= static_cast<size_t>(s.rx[i] & 0x7F) << (7 * (i - 1));
+                if (!(s.rx[i] & 0x80)) {
+                    headerLength = i + 1;
+                    break;
+                }
+            }
+            if (headerLength == 0 || headerLength + remaining > PACKET_SIZE) {
+                LOGE("[EmbeddedBroker][receive] Packet from %s malformed or larger than %u bytes",
+                     s.clientId.c_str(), PACKET_SIZE);
+                metrics.recordBrokerError();
+                return false;
+            }
+
+            size_t total = headerLength + remaining;
+            if (s.rxLength < total) return true;  // Incomplete packet
+
+            if (!handlePacket(s, s.rx[0], &s.rx[headerLength], remaining)) return false;
+            if (!s.active) return true;  // Closed by DISCONNECT
+
+            memmove(s.rx, &s.rx[total], s.rxLength - total);
+            s.rxLength -= total;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Handle one control packet.
+     * @param header First byte of the fixed header.
+     * @param body Variable header and payload.
+     * @param length Length of the body.
+     * @return false if the session must be closed.
+     */
+    bool handlePacket(Session& s, uint8_t header, const uint8_t* body, size_t length) {
+        uint8_t type = header >> 4;
+
+        if (!s.connected && type != CONNECT) {
+            LOGW("[EmbeddedBroker][handlePacket] Packet type %u before CONNECT from %s", type, s.clientId.c_str());
+            return false;
+        }
+
+        switch (type) {
+            case CONNECT:
+                return handleConnect(s, body, length);
+
+            case PUBLISH:
+                return handlePublish(s, header, body, length);
+
+            case PUBREL:
+                // QoS 2 message was delivered on PUBLISH, complete the exchange
+                if (length < 2) return false;
+                return sendAck(s, PUBCOMP << 4, body[0], body[1]);
+
+            case SUBSCRIBE:
+                return handleSubscribe(s, body, length);
+
+            case UNSUBSCRIBE:
+                return handleUnsubscribe(s, body, length);
+
+            case PINGREQ: {
+                const uint8_t pingresp[2] = { PINGRESP << 4, 0 };
+                return s.client.write(pingresp, sizeof(pingresp)) == sizeof(pingresp);
+            }
+
+            case DISCONNECT:
+                LOGI("[EmbeddedBroker][handlePacket] Client %s disconnected", s.clientId.c_str());
+                close(s, false);
+                return true;
+
+            default:
+                LOGW("[EmbeddedBroker][handlePacket] Unsupported packet type %u from %s", type, s.clientId.c_str());
+                return false;
+        }
+    }
+
+    bool handleConnect(Session& s, const uint8_t* body, size_t length) {
+        if (s.connected) return false;  // Second CONNECT is a protocol violation
+
+        size_t pos = 0;
+        String protocol;
+        if (!readString(body, length, pos, protocol) || pos + 4 > length) return false;
+        uint8_t level = body[pos++];
+        uint8_t flags = body[pos++];
+        uint16_t keepAlive = (body[pos] << 8) | body[pos + 1];
+        pos += 2;
+
+        if (protocol != "MQTT" || level != 4) {
+            LOGW("[EmbeddedBroker][handleConnect] Unsupported protocol %s level %u", protocol.c_str(), level);
+            sendConnack(s, 0x01);  // Unacceptable protocol version
+            return false;
+        }
+
+        String clientId;
+        if (!readString(body, length, pos, clientId)) return false;
+        if (clientId.isEmpty() && !(flags & 0x02)) {
+            sendConnack(s, 0x02);  // Identifier rejected, persistent sessions not supported
+            return false;
+        }
+
+        s.hasWill = (flags & 0x04) != 0;
+        if (s.hasWill) {
+            uint16_t willLength = 0;
+            if (!readString(body, length, pos, s.willTopic) || pos + 2 > length) return false;
+            willLength = (body[pos] << 8) | body[pos + 1];
+            pos += 2;
+            if (pos + willLength > length) return false;
+            s.willPayload.assign(&body[pos], &body[pos + willLength]);
+            pos += willLength;
+            s.willRetain = (flags & 0x20) != 0;
+        }
+
+        // Username (flag 0x80) and password (flag 0x40), a password requires a username
+        String username;
+        String password;
+        if ((flags & 0x40) && !(flags & 0x80)) return false;
+        if ((flags & 0x80) && !readString(body, length, pos, username)) return false;
+        if ((flags & 0x40) && !readString(body, length, pos, password)) return false;
+        if (!username_.isEmpty() && (username != username_ || password != password_)) {
+            LOGW("[EmbeddedBroker][handleConnect] Client %s not authorized", s.clientId.c_str());
+            metrics.recordBrokerError();
+            sendConnack(s, 0x05);  // Not authorized
+            return false;
+        }
+
+        // A client connecting with an id in use takes over the session
+        if (!clientId.isEmpty()) {
+            for (Session& other : sessions_) {
+                if (&other != &s && other.active && other.connected && other.clientId == clientId) {
+                    LOGI("[EmbeddedBroker][handleConnect] Client %s reconnected, closing old session", clientId.c_str());
+                    close(other, true);
+                }
+            }
+            s.clientId = clientId;
+        }
+
+        s.keepAliveS = keepAlive;
+        s.connected = true;
+        metrics.recordBrokerConnect(clientCount());
+        LOGI("[EmbeddedBroker][handleConnect] Client %s connected, keep alive %u s, %u clients",
+             s.clientId.c_str(), keepAlive, clientCount());
+        return sendConnack(s, 0x00);
+    }
+
+    bool handlePublish(Session& s, uint8_t header, const uint8_t* body, size_t length) {
+        uint8_t qos = (header >> 1) & 0x03;
+        bool retain = header & 0x01;
+
+        size_t pos = 0;
+        String topic;
+        if (qos > 2 || !readString(body, length, pos, topic) || topic.isEmpty()) return false;
+        if (topic.indexOf('+') >= 0 || topic.indexOf('#') >= 0) return false;  // No wildcards in topic names
+
+        uint8_t idHigh = 0, idLow = 0;
+        if (qos > 0) {
+            if (pos + 2 > length) return false;
+            idHigh = body[pos++];
+            idLow = body[pos++];
+        }
+
+        route(topic.c_str(), &body[pos], length - pos, retain);
+
+        if (qos == 1) return sendAck(s, PUBACK << 4, idHigh, idLow);
+        if (qos == 2) return sendAck(s, PUBREC << 4, idHigh, idLow);
+        return true;
+    }
+
+    bool handleSubscribe(Session& s, const uint8_t* body, size_t length) {
+        if (length < 2) return false;
+        size_t pos = 2;
+
+        uint8_t codes[MAX_SUBSCRIPTIONS];
+        String granted[MAX_SUBSCRIPTIONS];
+        size_t count = 0;
+        while (pos < length) {
+            if (count == MAX_SUBSCRIPTIONS) return false;  // More topic filters than a client can hold
+            String filter;
+            if (!readString(body, length, pos, filter) || pos >= length) return false;
+            pos++;  // Requested QoS, QoS 0 is granted
+
+            if (filter.isEmpty()) return false;
+            if (addSubscription(s, filter)) {
+                granted[count] = filter;
+                codes[count++] = 0x00;
+            } else {
+                LOGW("[EmbeddedBroker][handleSubscribe] Client %s has max %u subscriptions",
+                     s.clientId.c_str(), MAX_SUBSCRIPTIONS);
+                codes[count++] = 0x80;  // Failure
+            }
+        }
+
+        tx_[0] = SUBACK << 4;
+        tx_[1] = static_cast<uint8_t>(2 + count);
+        tx_[2] = body[0];
+        tx_[3] = body[1];
+        memcpy(&tx_[4], codes, count);
+        if (s.client.write(tx_, 4 + count) != 4 + count) return false;
+
+        // Retained messages follow the SUBACK
+        for (size_t i = 0; i < count; i++) {
+            if (!granted[i].isEmpty()) sendRetained(s, granted[i]);
+        }
+        return true;
+    }
+
+    bool handleUnsubscribe(Session& s, const uint8_t* body, size_t length) {
+        if (length < 2) return false;
+        size_t pos = 2;
+        while (pos < length) {
+            String filter;
+            if (!readString(body, length, pos, filter)) return false;
+            for (uint8_t i = 0; i < s.subscriptionCount; i++) {
+                if (s.subscriptions[i] == filter) {
+                    s.subscriptions[i] = s.subscriptions[--s.subscriptionCount];
+                    s.subscriptions[s.subscriptionCount] = String();
+                    break;
+                }
+            }
+        }
+        return sendAck(s, UNSUBACK << 4, body[0], body[1]);
+    }
+
+    /**
+     * @brief Pass a message from a local client to the subscribers and the message handler.
+     */
+    void route(const char* topic, const uint8_t* payload, size_t length, bool retain) {
+        metrics.recordBrokerReceive();
+        publish(topic, payload, length, retain);
+        if (handler_) handler_(topic, payload, length, retain);
+    }
+
+    bool addSubscription(Session& s, const String& filter) {
+        for (uint8_t i = 0; i < s.subscriptionCount; i++) {
+            if (s.subscriptions[i] == filter) return true;
+        }
+        if (s.subscriptionCount >= MAX_SUBSCRIPTIONS) return false;
+        s.subscriptions[s.subscriptionCount++] = filter;
+        return true;
+    }
+
+    bool isSubscribed(const Session& s, const char* topic) const {
+        for (uint8_t i = 0; i < s.subscriptionCount; i++) {
+            if (topicMatches(s.subscriptions[i].c_str(), topic)) return true;
+        }
+        return false;
+    }
+
+    void storeRetained(const char* topic, const uint8_t* payload, size_t length) {
+        Retained* slot = nullptr;
+        for (Retained& r : retained_) {
+            if (r.topic == topic) slot = &r;
+        }
+
+        if (length == 0) {
+            if (slot) {
+                slot->topic = String();
+                slot->payload.clear();
+            }
+            return;
+        }
+        for (Retained& r : retained_) {
+            if (!slot && r.topic.isEmpty()) slot = &r;
+        }
+        if (!slot) {
+            LOGW("[EmbeddedBroker][storeRetained] No room to retain %s, max %u topics", topic, MAX_RETAINED);
+            return;
+        }
+        slot->topic = topic;
+        slot->payload.assign(payload, payload + length);
+    }
+
+    void sendRetained(Session& s, const String& filter) {
+        for (const Retained& r : retained_) {
+            if (!r.topic.isEmpty() && topicMatches(filter.c_str(), r.topic.c_str())) {
+                send(s, r.topic.c_str(), r.payload.data(), r.payload.size(), true);
+            }
+        }
+    }
+
+    /**
+     * @brief Send a QoS 0 PUBLISH to a client.
+     * @param retain Retain flag, set only for retained messages sent on subscribe.
+     * @return true if all bytes were written.
+     */
+    bool send(Session& s, const char* topic, const uint8_t* payload, size_t length, bool retain) {
+        size_t topicLength = strlen(topic);
+        size_t remaining = 2 + topicLength + length;
+
+        size_t pos = 0;
+        tx_[pos++] = (PUBLISH << 4) | (retain ? 0x01 : 0x00);
+        size_t value = remaining;
+        do {
+            uint8_t b = value & 0x7F;
+            value >>= 7;
+            tx_[pos++] = b | (value ? 0x80 : 0);
+        } while (value);
+        tx_[pos++] = topicLength >> 8;
+        tx_[pos++] = topicLength & 0xFF;
+
+        // One write if the packet fits the buffer, else the payload separately
+        if (pos + topicLength + length <= sizeof(tx_)) {
+            memcpy(&tx_[pos], topic, topicLength);
+            pos += topicLength;
+            memcpy(&tx_[pos], payload, length);
+            pos += length;
+            return s.client.write(tx_, pos) == pos;
+        }
+        if (pos + topicLength > sizeof(tx_)) return false;
+        memcpy(&tx_[pos], topic, topicLength);
+        pos += topicLength;
+        return s.client.write(tx_, pos) == pos && s.client.write(payload, length) == length;
+    }
+
+    bool sendConnack(Session& s, uint8_t returnCode) {
+        const uint8_t connack[4] = { CONNACK << 4, 2, 0, returnCode };
+        return s.client.write(connack, sizeof(connack)) == sizeof(connack);
+    }
+
+    bool sendAck(Session& s, uint8_t header, uint8_t idHigh, uint8_t idLow) {
+        const uint8_t ack[4] = { header, 2, idHigh, idLow };
+        return s.client.write(ack, sizeof(ack)) == sizeof(ack);
+    }
+
+    /**
+     * @brief Read a length-prefixed UTF-8 string.
+     * @return false if the string exceeds the packet.
+     */
+    static bool readString(const uint8_t* body, size_t length, size_t& pos, String& out) {
+        if (pos + 2 > length) return false;
+        size_t n = (body[pos] << 8) | body[pos + 1];
+        pos += 2;
+        if (pos + n > length) return false;
+        out = String();
+        out.reserve(n);
+        for (size_t i = 0; i < n; i++) out += static_cast<char>(body[pos + i]);
+        pos += n;
+        return true;
+    }
+
+    // Singleton: private constructor and deleted copy operations
+    EmbeddedBroker() {}
+    EmbeddedBroker(const EmbeddedBroker&) = delete;
+    EmbeddedBroker& operator=(const EmbeddedBroker&) = delete;
+};
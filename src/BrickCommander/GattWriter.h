@@ -0,0 +1,298 @@
+/**
+ * @file GattWriter.h
+ *
+ * @brief Non-blocking GATT characteristic writes with completion callbacks.
+ *
+ * BLERemoteCharacteristic::writeValue() blocks until the write response and
+ * does not report the result. GattWriter issues the write with
+ * esp_ble_gattc_write_char() and returns at once; the write response is
+ * caught by a custom GATT client event handler and the completion callback
+ * is invoked from poll() on the main loop with status and round-trip time.
+ *
+ * Writes to different controllers are in flight at the same time without a
+ * task per controller. Writes that get no response within
+ * CONFIG::GATT_WRITE_TIMEOUT_MS complete with WriteStatus::TIMEOUT, pending
+ * writes of a connection that drops complete with WriteStatus::NOT_CONNECTED.
+ *
+ * Responses carry no write id, they are matched to the oldest pending write
+ * of the same connection and characteristic. A timed out write is still
+ * queued in the BLE stack, so it is kept as a tombstone until its late
+ * response arrives or the connection drops; the responses of the writes
+ * issued after it are then still matched to the right write.
+ *
+ * Example:
+ * @code
+ * GattWriter::getInstance().write(client, characteristic, cmd, sizeof(cmd),
+ *     [](WriteStatus status, uint32_t rttUs) { LOGI("status=%s rtt=%u us", writeStatusName(status), rttUs); });
+ * @endcode
+ *
+ * Author: Robert W.B. Linn
+ * Copyright © 2025 Robert W.B. Linn
+ * License: MIT — see LICENSE file.
+ */
+
+#pragma once
+
+#include <BLEDevice.h>
+#include <BLEClient.h>
+#include <BLERemoteCharacteristic.h>
+#include <esp_gattc_api.h>
+#include <vector>
+#include "Log.h"
+#include "Configuration.h"
+#include "Metrics.h"
+#include "BLEController.h"
+
+/**
+ * @class GattWriter
+ * @brief Singleton dispatching asynchronous GATT writes and their completions.
+ */
+class GattWriter {
+public:
+    /**
+     * @brief Access the singleton instance.
+     */
+    static GattWriter& getInstance() {
+        static GattWriter instance;
+        return instance;
+    }
+
+    /**
+     * @brief Write a value with response, without waiting for the response.
+     * The callback is always invoked from poll(), also if the write cannot be started.
+     *
+     * @param client Connected BLE client.
+     * @param characteristic Characteristic to write.
+     * @param data Value to write, copied by the BLE stack.
+     * @param length Length of the value.
+     * @param callback Completion callback with status and round-trip time.
+     * @return Handle of the write (never 0).
+     */
+    uint32_t write(BLEClient* client, BLERemoteCharacteristic* characteristic,
+                   const uint8_t* data, size_t length, WriteCallback callback) {
+        uint32_t id = nextId();
+
+        if (!client || !characteristic || !client->isConnected()) {
+            complete(id, callback, WriteStatus::NOT_CONNECTED, 0);
+            return id;
+        }
+        if (pending_.size() >= CONFIG::GATT_MAX_PENDING_WRITES) {
+            LOGW("[GattWriter][write] Too many pending writes (%u)", static_cast<unsigned>(pending_.size()));
+            complete(id, callback, WriteStatus::BUSY, 0);
+            return id;
+        }
+
+        PendingWrite w;
+        w.id = id;
+        w.gattcIf = client->getGattcIf();
+        w.connId = client->getConnId();
+        w.attrHandle = characteristic->getHandle();
+        w.startUs = micros();
+        w.callback = callback;
+
+        esp_err_t err = esp_ble_gattc_write_char(w.gattcIf, w.connId, w.attrHandle,
+                                                 length, const_cast<uint8_t*>(data),
+                                                 ESP_GATT_WRITE_TYPE_RSP, ESP_GATT_AUTH_REQ_NONE);
+        if (err != ESP_OK) {
+            LOGE("[GattWriter][write] esp_ble_gattc_write_char failed (err=0x%x)", err);
+            complete(id, callback, WriteStatus::FAILED, 0);
+            return id;
+        }
+
+        pending_.push_back(w);
+        metrics.recordGattPending(pendingCount());
+        return id;
+    }
+
+    /**
+     * @brief Complete a write without BLE traffic, e.g. a validation failure
+     * or a simulated controller. The callback is invoked from poll().
+     *
+     * @param callback Completion callback.
+     * @param status Status to report.
+     * @param rttUs Round-trip time to report.
+     * @param delayMs Delay before the completion is reported.
+     * @return Handle of the write (never 0).
+     */
+    uint32_t completeLater(WriteCallback callback, WriteStatus status, uint32_t rttUs = 0, uint32_t delayMs = 0) {
+        uint32_t id = nextId();
+        completions_.push_back({ id, millis() + delayMs, status, rttUs, callback });
+        metrics.recordGattPending(pendingCount());
+        return id;
+    }
+
+    /**
+     * @brief Invoke the callbacks of finished writes.
+     * Call from the main loop.
+     */
+    void poll() {
+        // Write responses and disconnects reported by the BLE stack
+        GattEvent event;
+        while (events_ && xQueueReceive(events_, &event, 0) == pdTRUE) {
+            if (event.disconnect) {
+                failConnection(event.gattcIf, event.connId);
+                continue;
+            }
+            for (auto it = pending_.begin(); it != pending_.end(); ++it) {
+                if (it->gattcIf == event.gattcIf && it->connId == event.connId && it->attrHandle == event.attrHandle) {
+                    if (it->timedOut) {
+                        LOGI("[GattWriter][poll] Late response of write %u after %u us", it->id, event.timeUs - it->startUs);
+                        pending_.erase(it);
+                        break;
+                    }
+                    WriteStatus status = (event.status == ESP_GATT_OK) ? WriteStatus::OK : WriteStatus::FAILED;
+                    uint32_t rtt = event.timeUs - it->startUs;
+                    WriteCallback cb = it->callback;
+                    pending_.erase(it);
+                    finish(cb, status, rtt);
+                    break;
+                }
+            }
+        }
+
+        // Timeouts, the write stays as tombstone until its response arrives
+        uint32_t nowUs = micros();
+        for (PendingWrite& w : pending_) {
+            if (w.timedOut) continue;
+            uint32_t age = nowUs - w.startUs;
+            if (age >= CONFIG::GATT_WRITE_TIMEOUT_MS * 1000UL) {
+                LOGW("[GattWriter][poll] Write %u timed out", w.id);
+                w.timedOut = true;
+                WriteCallback cb;
+                cb.swap(w.callback);
+                finish(cb, WriteStatus::TIMEOUT, age);
+            }
+        }
+
+        // Completions without BLE traffic
+        uint32_t nowMs = millis();
+        for (size_t i = 0; i < completions_.size();) {
+            if (static_cast<int32_t>(nowMs - completions_[i].dueMs) >= 0) {
+                Completion c = completions_[i];
+                completions_.erase(completions_.begin() + i);
+                finish(c.callback, c.status, c.rttUs);
+            } else {
+                i++;
+            }
+        }
+    }
+
+    /**
+     * @brief Get the number of writes waiting for completion or, after a timeout, for their response.
+     */
+    size_t pendingCount() const {
+        return pending_.size() + completions_.size();
+    }
+
+    /**
+     * @brief Drop all pending writes without invoking their callbacks.
+     * Must be called before the controllers are deleted.
+     */
+    void clear() {
+        pending_.clear();
+        completions_.clear();
+        LOGI("[GattWriter] Cleared pending writes.");
+    }
+
+private:
+    /**
+     * @brief A write waiting for its response.
+     */
+    struct PendingWrite {
+        uint32_t id = 0;                ///< Handle returned to the caller
+        esp_gatt_if_t gattcIf = 0;      ///< GATT client interface
+        uint16_t connId = 0;            ///< Connection id
+        uint16_t attrHandle = 0;        ///< Characteristic handle
+        uint32_t startUs = 0;           ///< Time the write was issued
+        bool timedOut = false;          ///< Completed with TIMEOUT, waits for its late response
+        WriteCallback callback;         ///< Completion callback
+    };
+
+    /**
+     * @brief A completion reported without BLE traffic.
+     */
+    struct Completion {
+        uint32_t id;                    ///< Handle returned to the caller
+        uint32_t dueMs;                 ///< Time to report the completion
+        WriteStatus status;             ///< Status to report
+        uint32_t rttUs;                 ///< Round-trip time to report
+        WriteCallback callback;         ///< Completion callback
+    };
+
+    /**
+     * @brief Event passed from the BLE stack task to the main loop.
+     */
+    struct GattEvent {
+        bool disconnect;                ///< true for a disconnect, false for a write response
+        esp_gatt_if_t gattcIf;          ///< GATT client interface
+        uint16_t connId;                ///< Connection id
+        uint16_t attrHandle;            ///< Characteristic handle
+        esp_gatt_status_t status;       ///< Write status
+        uint32_t timeUs;                ///< Time the event was received
+    };
+
+    std::vector<PendingWrite> pending_;     ///< Writes waiting for their response
+    std::vector<Completion> completions_;   ///< Completions without BLE traffic
+    QueueHandle_t events_ = nullptr;        ///< Events from the BLE stack task
+    uint32_t lastId_ = 0;                   ///< Last handle issued
+
+    uint32_t nextId() {
+        if (++lastId_ == 0) lastId_ = 1;
+        return lastId_;
+    }
+
+    void complete(uint32_t id, WriteCallback callback, WriteStatus status, uint32_t rttUs) {
+        completions_.push_back({ id, millis(), status, rttUs, callback });
+    }
+
+    void finish(WriteCallback& callback, WriteStatus status, uint32_t rttUs) {
+        metrics.recordGattWrite(status == WriteStatus::OK, status == WriteStatus::TIMEOUT, rttUs);
+        if (callback) callback(status, rttUs);
+    }
+
+    void failConnection(esp_gatt_if_t gattcIf, uint16_t connId) {
+        for (size_t i = 0; i < pending_.size();) {
+            if (pending_[i].gattcIf == gattcIf && pending_[i].connId == connId) {
+                WriteCallback cb = pending_[i].callback;
+                bool timedOut = pending_[i].timedOut;
+                pending_.erase(pending_.begin() + i);
+                if (!timedOut) finish(cb, WriteStatus::NOT_CONNECTED, 0);
+            } else {
+                i++;
+            }
+        }
+    }
+
+    /**
+     * @brief GATT client event handler, runs in the BLE stack task.
+     * Only forwards the events to the main loop.
+     */
+    static void gattcEventHandler(esp_gattc_cb_event_t event, esp_gatt_if_t gattcIf, esp_ble_gattc_cb_param_t* param) {
+        GattEvent e = {};
+        e.gattcIf = gattcIf;
+        e.timeUs = micros();
+
+        if (event == ESP_GATTC_WRITE_CHAR_EVT) {
+            e.disconnect = false;
+            e.connId = param->write.conn_id;
+            e.attrHandle = param->write.handle;
+            e.status = param->write.status;
+        } else if (event == ESP_GATTC_DISCONNECT_EVT) {
+            e.disconnect = true;
+            e.connId = param->disconnect.conn_id;
+        } else {
+            return;
+        }
+
+        QueueHandle_t queue = getInstance().events_;
+        if (queue) xQueueSend(queue, &e, 0);
+    }
+
+    // Singleton: private constructor and deleted copy operations
+    GattWriter() {
+        events_ = xQueueCreate(CONFIG::GATT_MAX_PENDING_WRITES * 2, sizeof(GattEvent));
+        BLEDevice::setCustomGattcHandler(gattcEventHandler);
+    }
+    GattWriter(const GattWriter&) = delete;
+    GattWriter& operator=(const GattWriter&) = delete;
+};
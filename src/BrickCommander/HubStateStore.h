@@ -0,0 +1,333 @@
+/**
+ * @file HubStateStore.h
+ *
+ * @brief Central state of all hubs as structure of arrays, indexed by hub handle.
+ *
+ * Every controller gets a handle (0…CONFIG::MAX_HUBS-1) when it is created
+ * and keeps its link state, port levels, battery, RSSI, timestamps and
+ * counters here instead of in its own members. Scans over all hubs, like
+ * the telemetry, the RSSI poll and shutdown, are loops over small contiguous
+ * arrays without virtual calls or String building.
+ *
+ * Used handles are kept in a bit mask, forEach() visits them in handle order.
+ *
+ * The link state and battery are also written from the BLE task (connect and
+ * disconnect callbacks, notifications); these are single byte or half word
+ * stores that are read on the main loop.
+ *
+ * Author: Robert W.B. Linn
+ * Copyright © 2025 Robert W.B. Linn
+ * License: MIT — see LICENSE file.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include "Log.h"
+#include "Configuration.h"
+
+using HubHandle = uint8_t;                  ///< Index into the HubStateStore arrays
+constexpr HubHandle INVALID_HUB = 0xFF;     ///< No handle, store full
+
+/**
+ * @class HubStateStore
+ * @brief Singleton holding the state of all hubs in parallel arrays.
+ */
+class HubStateStore {
+public:
+    static constexpr uint8_t MAX_HUBS  = CONFIG::MAX_HUBS;   ///< Number of handles
+    static constexpr uint8_t MAX_PORTS = 4;                  ///< Ports per hub in the level arrays
+
+    static_assert(MAX_HUBS <= 32, "Used handles are kept in a 32 bit mask");
+
+    /**
+     * @brief Link state of a hub, ordered so that >= LINK_CONNECTED means connected.
+     */
+    enum LinkState : uint8_t {
+        LINK_DISCONNECTED = 0,  ///< Not connected
+        LINK_CONNECTED    = 1,  ///< Connected, not yet ready
+        LINK_AWAKE        = 2   ///< Connected and ready for commands
+    };
+
+    /**
+     * @brief Access the singleton instance.
+     */
+    static HubStateStore& getInstance() {
+        static HubStateStore instance;
+        return instance;
+    }
+
+    /**
+     * @brief Allocate a handle for a new hub and reset its state.
+     * @param type Controller type id.
+     * @param portCount Number of motor ports of the hub.
+     * @param mac MAC address "90:84:2B:C1:94:79".
+     * @return Handle or INVALID_HUB if all handles are in use.
+     */
+    HubHandle acquire(uint8_t type, uint8_t portCount, const String& mac) {
+        for (HubHandle h = 0; h < MAX_HUBS; h++) {
+            if (used_ & bit(h)) continue;
+            reset(h);
+            used_ |= bit(h);
+            type_[h] = type;
+            portCount_[h] = portCount > MAX_PORTS ? MAX_PORTS : portCount;
+            parseMac(mac.c_str(), mac_[h]);
+            return h;
+        }
+        LOGE("[HubStateStore][acquire] No free handle for %s (max %u hubs)", mac.c_str(), MAX_HUBS);
+        return INVALID_HUB;
+    }
+
+    /**
+     * @brief Release the handle of a deleted hub.
+     */
+    void release(HubHandle h) {
+        if (valid(h)) used_ &= ~bit(h);
+    }
+
+    /**
+     * @brief Check if all handles are in use.
+     */
+    bool isFull() const {
+        return count() >= MAX_HUBS;
+    }
+
+    /**
+     * @brief Get the number of hubs.
+     */
+    uint8_t count() const {
+        return static_cast<uint8_t>(__builtin_popcount(used_));
+    }
+
+    /**
+     * @brief Call a function for each hub in handle order.
+     * @param fn Function receiving the handle.
+     */
+    template <typename Fn>
+    void forEach(Fn fn) const {
+        uint32_t mask = used_;
+        while (mask) {
+            HubHandle h = static_cast<HubHandle>(__builtin_ctz(mask));
+            mask &= mask - 1;
+            fn(h);
+        }
+    }
+
+    // ------------------------------------------------------------------------
+    // Identity
+    // ------------------------------------------------------------------------
+
+    /**
+     * @brief Get the MAC address bytes of a hub.
+     */
+    const uint8_t* mac(HubHandle h) const {
+        return mac_[valid(h) ? h : 0];
+    }
+
+    /**
+     * @brief Get the MAC address of a hub as text "90:84:2B:C1:94:79".
+     * @param h Handle.
+     * @param out Buffer of at least 18 chars.
+     */
+    void macText(HubHandle h, char* out) const {
+        const uint8_t* m = mac(h);
+        snprintf(out, 18, "%02X:%02X:%02X:%02X:%02X:%02X", m[0], m[1], m[2], m[3], m[4], m[5]);
+    }
+
+    /**
+     * @brief Find a hub by its MAC address bytes.
+     * @return Handle or INVALID_HUB.
+     */
+    HubHandle findByMac(const uint8_t addr[6]) const {
+        for (HubHandle h = 0; h < MAX_HUBS; h++) {
+            if ((used_ & bit(h)) && memcmp(mac_[h], addr, 6) == 0) return h;
+        }
+        return INVALID_HUB;
+    }
+
+    uint8_t type(HubHandle h) const { return valid(h) ? type_[h] : 0; }
+    uint8_t portCount(HubHandle h) const { return valid(h) ? portCount_[h] : 0; }
+
+    // ------------------------------------------------------------------------
+    // Link
+    // ------------------------------------------------------------------------
+
+    /**
+     * @brief Set the link state, counts connects and keeps the time of the change.
+     */
+    void setLink(HubHandle h, LinkState state) {
+        if (!valid(h) || link_[h] == state) return;
+        if (link_[h] == LINK_DISCONNECTED) connects_[h]++;
+        link_[h] = state;
+        linkChangedMs_[h] = millis();
+    }
+
+    LinkState link(HubHandle h) const { return valid(h) ? static_cast<LinkState>(link_[h]) : LINK_DISCONNECTED; }
+    bool isConnected(HubHandle h) const { return link(h) >= LINK_CONNECTED; }
+    bool isAwake(HubHandle h) const { return link(h) == LINK_AWAKE; }
+    uint32_t linkChangedMs(HubHandle h) const { return valid(h) ? linkChangedMs_[h] : 0; }
+    uint32_t connects(HubHandle h) const { return valid(h) ? connects_[h] : 0; }
+
+    /**
+     * @brief Get the number of connected hubs.
+     */
+    uint8_t connectedCount() const {
+        uint8_t n = 0;
+        for (HubHandle h = 0; h < MAX_HUBS; h++) {
+            if ((used_ & bit(h)) && link_[h] >= LINK_CONNECTED) n++;
+        }
+        return n;
+    }
+
+    // ------------------------------------------------------------------------
+    // Port levels
+    // ------------------------------------------------------------------------
+
+    /**
+     * @brief Set the level requested by a command, before it is written.
+     */
+    void setDesiredLevel(HubHandle h, uint8_t port, int8_t level) {
+        if (valid(h) && port < MAX_PORTS) desired_[h][port] = level;
+    }
+
+    /**
+     * @brief Set the level acknowledged by the hub.
+     */
+    void setAppliedLevel(HubHandle h, uint8_t port, int8_t level) {
+        if (valid(h) && port < MAX_PORTS) applied_[h][port] = level;
+    }
+
+    int8_t desiredLevel(HubHandle h, uint8_t port) const { return (valid(h) && port < MAX_PORTS) ? desired_[h][port] : 0; }
+    int8_t appliedLevel(HubHandle h, uint8_t port) const { return (valid(h) && port < MAX_PORTS) ? applied_[h][port] : 0; }
+
+    /**
+     * @brief Check if a requested level is not (yet) acknowledged on any port.
+     */
+    bool isPending(HubHandle h) const {
+        return valid(h) && memcmp(desired_[h], applied_[h], MAX_PORTS) != 0;
+    }
+
+    // ------------------------------------------------------------------------
+    // Battery, RSSI, queue
+    // ------------------------------------------------------------------------
+
+    void setBatteryMv(HubHandle h, uint16_t mv) { if (valid(h)) batteryMv_[h] = mv; }
+    uint16_t batteryMv(HubHandle h) const { return valid(h) ? batteryMv_[h] : 0; }
+
+    void setRssi(HubHandle h, int8_t rssi) { if (valid(h)) rssi_[h] = rssi; }
+    int8_t rssi(HubHandle h) const { return valid(h) ? rssi_[h] : 0; }
+
+    void setQueued(HubHandle h, size_t queued) { if (valid(h)) queued_[h] = queued > 255 ? 255 : static_cast<uint8_t>(queued); }
+    uint8_t queued(HubHandle h) const { return valid(h) ? queued_[h] : 0; }
+
+    /**
+     * @brief Set the queued commands of all hubs to 0, e.g. after the connect queue was cleared.
+     */
+    void clearQueued() {
+        memset(queued_, 0, sizeof(queued_));
+    }
+
+    // ------------------------------------------------------------------------
+    // Timestamps and counters
+    // ------------------------------------------------------------------------
+
+    /**
+     * @brief Count a command addressed to a hub.
+     */
+    void recordCommand(HubHandle h) {
+        if (!valid(h)) return;
+        commands_[h]++;
+        lastCommandMs_[h] = millis();
+    }
+
+    /**
+     * @brief Count a completed port level write.
+     * @param ok true if acknowledged.
+     */
+    void recordWrite(HubHandle h, bool ok) {
+        if (!valid(h)) return;
+        if (ok) {
+            writesOk_[h]++;
+            lastAckMs_[h] = millis();
+        } else {
+            writesFailed_[h]++;
+        }
+    }
+
+    uint32_t lastCommandMs(HubHandle h) const { return valid(h) ? lastCommandMs_[h] : 0; }
+    uint32_t lastAckMs(HubHandle h) const { return valid(h) ? lastAckMs_[h] : 0; }
+    uint32_t commands(HubHandle h) const { return valid(h) ? commands_[h] : 0; }
+    uint32_t writesOk(HubHandle h) const { return valid(h) ? writesOk_[h] : 0; }
+    uint32_t writesFailed(HubHandle h) const { return valid(h) ? writesFailed_[h] : 0; }
+
+private:
+    uint32_t used_ = 0;                             ///< Bit per used handle
+
+    // Identity
+    uint8_t  mac_[MAX_HUBS][6] = {};                ///< MAC address bytes
+    uint8_t  type_[MAX_HUBS] = {};                  ///< Controller type id
+    uint8_t  portCount_[MAX_HUBS] = {};             ///< Motor ports
+
+    // Link
+    volatile uint8_t link_[MAX_HUBS] = {};          ///< LinkState, also written from the BLE task
+    uint32_t linkChangedMs_[MAX_HUBS] = {};         ///< Time of the last link change
+    uint32_t connects_[MAX_HUBS] = {};              ///< Transitions to connected
+
+    // Ports
+    int8_t   desired_[MAX_HUBS][MAX_PORTS] = {};    ///< Level requested by the last command
+    int8_t   applied_[MAX_HUBS][MAX_PORTS] = {};    ///< Level acknowledged by the hub
+
+    // Measurements
+    volatile uint16_t batteryMv_[MAX_HUBS] = {};    ///< Battery voltage in mV, 0 = unknown
+    volatile int8_t   rssi_[MAX_HUBS] = {};         ///< BLE RSSI in dBm, 0 = unknown
+    uint8_t  queued_[MAX_HUBS] = {};                ///< Commands waiting for the connection
+
+    // Timestamps and counters
+    uint32_t lastCommandMs_[MAX_HUBS] = {};         ///< Time of the last command
+    uint32_t lastAckMs_[MAX_HUBS] = {};             ///< Time of the last acknowledged write
+    uint32_t commands_[MAX_HUBS] = {};              ///< Commands addressed to the hub
+    uint32_t writesOk_[MAX_HUBS] = {};              ///< Acknowledged writes
+    uint32_t writesFailed_[MAX_HUBS] = {};          ///< Failed writes after retries
+
+    static constexpr uint32_t bit(HubHandle h) { return 1UL << h; }
+
+    bool valid(HubHandle h) const {
+        return h < MAX_HUBS && (used_ & bit(h));
+    }
+
+    void reset(HubHandle h) {
+        memset(mac_[h], 0, sizeof(mac_[h]));
+        type_[h] = 0;
+        portCount_[h] = 0;
+        link_[h] = LINK_DISCONNECTED;
+        linkChangedMs_[h] = 0;
+        connects_[h] = 0;
+        memset(desired_[h], 0, sizeof(desired_[h]));
+        memset(applied_[h], 0, sizeof(applied_[h]));
+        batteryMv_[h] = 0;
+        rssi_[h] = 0;
+        queued_[h] = 0;
+        lastCommandMs_[h] = 0;
+        lastAckMs_[h] = 0;
+        commands_[h] = 0;
+        writesOk_[h] = 0;
+        writesFailed_[h] = 0;
+    }
+
+    /**
+     * @brief Convert a MAC address "90:84:2B:C1:94:79" to bytes, zeros if invalid.
+     */
+    static void parseMac(const char* text, uint8_t out[6]) {
+        unsigned int b[6];
+        if (sscanf(text, "%x:%x:%x:%x:%x:%x", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) != 6) {
+            memset(out, 0, 6);
+            return;
+        }
+        for (uint8_t i = 0; i < 6; i++) out[i] = static_cast<uint8_t>(b[i]);
+    }
+
+    // Singleton: private constructor and deleted copy operations
+    HubStateStore() {}
+    HubStateStore(const HubStateStore&) = delete;
+    HubStateStore& operator=(const HubStateStore&) = delete;
+};
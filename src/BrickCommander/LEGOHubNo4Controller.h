@@ -11,6 +11,8 @@
 #pragma once
 
 #include "BLEController.h"
+#include "GattWriter.h"
+#include "BleStack.h"
 #include <BLEDevice.h>
 #include <BLEClient.h>
 #include <BLERemoteService.h>
@@ -32,24 +34,31 @@ public:
      * @param mac BLE MAC address of the LEGO Hub device.
      */
     explicit LEGOHubNo4Controller(const String& mac)
-        : macAddress_(mac), client_(nullptr), characteristic_(nullptr), connected_(false) {}
+        : BLEController(LEGOHUBNO4::TYPE_ID, LEGOHUBNO4::PORT_COUNT, mac),
+          macAddress_(mac), client_(nullptr), characteristic_(nullptr) {}
 
     /**
      * Destructor to ensure clean disconnection.
      */
     ~LEGOHubNo4Controller() {
         disconnect();
+        delete client_;
     }
 
     /**
      * Connects to the LEGO Hub via BLE.
      * Initializes BLE client, connects, and retrieves control characteristic.
+     * A hub that powers off or goes out of range is set disconnected by the
+     * client callbacks.
      *
      * @return true if connection succeeded, false otherwise.
      */
     bool connect() override {
-        BLEDevice::init("");
+        BleStack::getInstance().start();
+        delete client_;
+        characteristic_ = nullptr;
         client_ = BLEDevice::createClient();
+        client_->setClientCallbacks(new ClientCallbacks(this));
 
         if (!client_->connect(BLEAddress(macAddress_.c_str()))) {
             LOGE("[LEGOHubNo4Controller][connect] Failed to connect to LEGO Hub No.4");
@@ -70,7 +79,7 @@ public:
             return false;
         }
 
-        connected_ = true;
+        hubs().setLink(handle_, HubStateStore::LINK_CONNECTED);
         LOGI("[LEGOHubNo4Controller][connect] Connected to LEGO Hub No.4");
         return true;
     }
@@ -83,15 +92,16 @@ public:
             client_->disconnect();
             LOGI("[LEGOHubNo4Controller][Disconnect] Disconnected from LEGO Hub No.4");
         }
-        connected_ = false;
+        hubs().setLink(handle_, HubStateStore::LINK_DISCONNECTED);
     }
 
     /**
-     * Checks if the controller is connected.
-     * @return true if connected, false otherwise.
+     * Drops the BLE client, called before the BLE stack is released.
      */
-    bool isConnected() const override {
-        return connected_;
+    void releaseBle() override {
+        delete client_;
+        client_ = nullptr;
+        characteristic_ = nullptr;
     }
 
     /**
@@ -101,13 +111,8 @@ public:
      * @param power Signed power level (-127 to 127).
      */
     void setPortLevel(uint8_t port, int8_t power) override {
-        if (!characteristic_ || port > 1) return;
-
-        // Command format for LEGO Hub No.4 motor control
-        uint8_t cmd[] = {
-            0x08, 0x00, 0x81, port, 0x11, 0x51, 0x00,
-            static_cast<uint8_t>(power)
-        };
+        uint8_t cmd[PORT_COMMAND_SIZE];
+        if (!characteristic_ || !buildPortCommand(port, power, cmd)) return;
 
         LOGI("[LEGOHubNo4Controller][setPortLevel] port=%u power=%d", port, power);
         LOGIHEX("[LEGOHubNo4Controller][setPortLevel] cmd=", cmd, sizeof(cmd));
@@ -115,6 +120,40 @@ public:
         characteristic_->writeValue(cmd, sizeof(cmd), true);
     }
 
+    /**
+     * Sends a power command to a given port A(0) or B(1) without blocking.
+     *
+     * @param port Port (0 or 1).
+     * @param power Signed power level (-127 to 127).
+     * @param callback Completion callback with status and round-trip time.
+     * @return Handle of the write.
+     */
+    uint32_t setPortLevelAsync(uint8_t port, int8_t power, WriteCallback callback) override {
+        uint8_t cmd[PORT_COMMAND_SIZE];
+        if (!buildPortCommand(port, power, cmd)) {
+            return GattWriter::getInstance().completeLater(callback, WriteStatus::INVALID);
+        }
+
+        LOGI("[LEGOHubNo4Controller][setPortLevelAsync] port=%u power=%d", port, power);
+        LOGIHEX("[LEGOHubNo4Controller][setPortLevelAsync] cmd=", cmd, sizeof(cmd));
+
+        return GattWriter::getInstance().write(client_, characteristic_, cmd, sizeof(cmd), callback);
+    }
+
+    /**
+     * Returns the BLE MAC address of the device.
+     */
+    String getMacAddress() const override {
+        return macAddress_;
+    }
+
+    /**
+     * Returns the controller type id used in the binary telemetry.
+     */
+    uint8_t getTypeId() const override {
+        return LEGOHUBNO4::TYPE_ID;
+    }
+
     /**
      * Returns a JSON-formatted string representing the controller state.
      * Includes device name and connection status.
@@ -128,8 +167,61 @@ public:
     }
 
 private:
+    static constexpr size_t PORT_COMMAND_SIZE = 8;  ///< Size of a port power command
+
     String macAddress_;                      ///< BLE MAC address of the device
     BLEClient* client_;                      ///< BLE client instance
     BLERemoteCharacteristic* characteristic_; ///< Control characteristic for commands
-    bool connected_;                        ///< Connection status flag
+
+    /**
+     * ClientCallbacks
+     *
+     * BLE client callbacks, called from the BLE task.
+     */
+    class ClientCallbacks : public BLEClientCallbacks {
+    public:
+        /**
+         * @param ctrl Controller whose link state is updated.
+         */
+        explicit ClientCallbacks(LEGOHubNo4Controller* ctrl) : controller_(ctrl) {}
+
+        /**
+         * Called when the BLE client connects. The link is set connected by
+         * connect() once the control characteristic is found.
+         */
+        void onConnect(BLEClient*) override {
+            LOGI("[LEGOHubNo4Controller][onConnect] BLE client connected");
+        }
+
+        /**
+         * Called when the BLE client disconnects, e.g. the hub powered off or is out of range.
+         */
+        void onDisconnect(BLEClient*) override {
+            LOGI("[LEGOHubNo4Controller][onDisconnect] BLE client disconnected");
+            controller_->hubs().setLink(controller_->handle_, HubStateStore::LINK_DISCONNECTED);
+        }
+
+    private:
+        LEGOHubNo4Controller* controller_;
+    };
+
+    /**
+     * Builds the power command for a given port A(0) or B(1).
+     *
+     * @param port Port (0 or 1).
+     * @param power Signed power level (-127 to 127).
+     * @param cmd Destination of PORT_COMMAND_SIZE bytes.
+     * @return false if the port is invalid.
+     */
+    static bool buildPortCommand(uint8_t port, int8_t power, uint8_t* cmd) {
+        if (port > 1) return false;
+
+        // Command format for LEGO Hub No.4 motor control
+        const uint8_t command[PORT_COMMAND_SIZE] = {
+            0x08, 0x00, 0x81, port, 0x11, 0x51, 0x00,
+            static_cast<uint8_t>(power)
+        };
+        memcpy(cmd, command, PORT_COMMAND_SIZE);
+        return true;
+    }
 };
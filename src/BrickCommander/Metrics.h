@@ -0,0 +1,467 @@
+/**
+ * @file Metrics.h
+ *
+ * @brief Runtime metrics collected by BrickCommander and reported via the
+ *        config status request (status=2).
+ *
+ * MQTT receive delays are kept per WiFi power-save mode, so the latency cost
+ * of modem-sleep can be compared on the same installation after switching
+ * modes at runtime. The delay is measured with a loopback probe: the commander
+ * publishes a probe to the broker and times its return, which includes the
+ * wait for the next DTIM beacon in modem-sleep. Unlike the receive gaps (time
+ * between two received messages), it does not depend on how often clients send;
+ * the gaps are only comparable between modes with a fixed-rate sender.
+ * BLE connect attempts started by the ConnectionAdmission are counted with
+ * their duration, and the time needed to drain a burst of queued connects.
+ * Asynchronous GATT writes are counted with their round-trip time.
+ * The free heap low-water mark is sampled from the main loop and, unlike
+ * ESP.getMinFreeHeap(), restarts on reset (status=3) so benchmark runs can be
+ * compared.
+ * Telemetry messages are counted with their size and encoding time per
+ * encoding, so the encodings can be compared after switching at runtime.
+ * BLE stack starts are counted with their init time, releases with the heap
+ * they returned.
+ * The embedded broker (EMBEDDED_BROKER) counts client connects, messages
+ * received from and delivered to local clients, and messages forwarded upstream.
+ *
+ * Example output:
+ * {"wifi":{"ps":"min","listen_interval":0,"rssi":-61},
+ *  "rx_delay":{"none":{"n":30,"avg":9,"max":21,"hist":[28,2,0,0,0,0,0]},"min":{"n":30,"avg":61,"max":104,"hist":[2,5,21,2,0,0,0]}},
+ *  "rx_gap":{"min":{"n":42,"avg":118,"max":310,"hist":[0,3,9,22,8,0,0]}},
+ *  "ble_connect":{"attempts":5,"ok":4,"failed":1,"avg":1840,"max":3120,
+ *                 "dropped":0,"rejected":0,"queue_max":6,"drain_last":9320,"drain_max":9320},
+ *  "gatt_write":{"ok":120,"failed":0,"timeout":1,"retries":1,"avg_us":14200,"max_us":61000,"pending_max":4},
+ *  "heap":{"free":182340,"min":171020},
+ *  "telemetry":{"json":{"n":60,"bytes":9480,"avg_us":410,"max_us":690},"fixed":{"n":60,"bytes":1440,"avg_us":38,"max_us":55}},
+ *  "ble_stack":{"up":true,"starts":2,"releases":1,"init_last":412,"init_max":655,"freed_last":41236},
+ *  "broker":{"connects":3,"clients_max":2,"rx":140,"tx":610,"fwd":12,"errors":0}}
+ *
+ * Author: Robert W.B. Linn
+ * Copyright © 2025 Robert W.B. Linn
+ * License: MIT — see LICENSE file.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "Configuration.h"
+#include "Constants.h"
+
+/**
+ * @class Metrics
+ * @brief Collects counters and latency statistics.
+ */
+class Metrics {
+public:
+    /// Upper bounds (ms) of the receive delay and gap histogram buckets, last bucket is open.
+    static constexpr uint16_t RX_GAP_BUCKETS[] = { 20, 50, 100, 200, 500, 1000 };
+    static constexpr size_t   RX_GAP_BUCKET_COUNT = sizeof(RX_GAP_BUCKETS) / sizeof(RX_GAP_BUCKETS[0]) + 1;
+
+    /**
+     * @brief Receive delay or gap statistics for one power-save mode.
+     */
+    struct GapStats {
+        uint32_t count = 0;                         ///< Number of samples
+        uint64_t sumMs = 0;                         ///< Sum of samples
+        uint32_t maxMs = 0;                         ///< Largest sample
+        uint32_t hist[RX_GAP_BUCKET_COUNT] = {};    ///< Histogram
+    };
+
+    /**
+     * @brief BLE connect admission statistics.
+     */
+    struct ConnectStats {
+        uint32_t attempts = 0;      ///< Connect attempts started
+        uint32_t ok = 0;            ///< Successful attempts
+        uint32_t failed = 0;        ///< Failed attempts
+        uint64_t sumMs = 0;         ///< Sum of attempt durations
+        uint32_t maxMs = 0;         ///< Longest attempt
+        uint32_t dropped = 0;       ///< Queued commands dropped because the queue was full
+        uint32_t rejected = 0;      ///< Queued commands rejected after too many failed attempts
+        uint32_t queueMax = 0;      ///< Queued commands high-water mark
+        uint32_t drainLastMs = 0;   ///< Time from first queued command until the queue was empty, last burst
+        uint32_t drainMaxMs = 0;    ///< Same, longest burst
+    };
+
+    /**
+     * @brief Asynchronous GATT write statistics.
+     */
+    struct WriteStats {
+        uint32_t ok = 0;            ///< Writes acknowledged
+        uint32_t failed = 0;        ///< Writes failed (error response, not connected, busy)
+        uint32_t timeout = 0;       ///< Writes without response
+        uint32_t retries = 0;       ///< Writes retried
+        uint64_t sumUs = 0;         ///< Sum of round-trip times of acknowledged writes
+        uint32_t maxUs = 0;         ///< Longest round-trip time of acknowledged writes
+        uint32_t pendingMax = 0;    ///< Writes in flight high-water mark
+    };
+
+    /**
+     * @brief Telemetry statistics for one encoding.
+     */
+    struct TelemetryStats {
+        uint32_t count = 0;         ///< Messages encoded
+        uint64_t bytes = 0;         ///< Sum of message sizes
+        uint64_t sumUs = 0;         ///< Sum of encoding times
+        uint32_t maxUs = 0;         ///< Longest encoding time
+    };
+
+    /**
+     * @brief BLE stack lifecycle statistics.
+     */
+    struct BleStackStats {
+        bool     up = false;        ///< Stack running
+        uint32_t starts = 0;        ///< Stack starts
+        uint32_t releases = 0;      ///< Stack releases after idle time
+        uint32_t initLastMs = 0;    ///< Init time of the last start
+        uint32_t initMaxMs = 0;     ///< Longest init time
+        int32_t  freedLast = 0;     ///< Heap returned by the last release
+    };
+
+    /**
+     * @brief Embedded broker statistics.
+     */
+    struct BrokerStats {
+        uint32_t connects = 0;      ///< Accepted CONNECTs
+        uint8_t  clientsMax = 0;    ///< Most clients at the same time
+        uint32_t rx = 0;            ///< Messages received from local clients
+        uint32_t tx = 0;            ///< Messages delivered to local clients
+        uint32_t forwarded = 0;     ///< Messages of local clients forwarded upstream
+        uint32_t errors = 0;        ///< Rejected connections, protocol errors and failed deliveries
+    };
+
+    /**
+     * @brief Set the active WiFi power-save mode; following gaps are accounted to it.
+     * @param mode WIFI_POWER_SAVE::Mode
+     * @param listenInterval Listen interval in beacon intervals (0 = default)
+     */
+    void setPowerSaveMode(uint8_t mode, uint16_t listenInterval) {
+        if (mode >= WIFI_POWER_SAVE::MODE_COUNT) return;
+        powerSaveMode_ = mode;
+        listenInterval_ = listenInterval;
+        lastRxMs_ = 0;  // Do not attribute a gap spanning the switch
+    }
+
+    /**
+     * @brief Get the active WiFi power-save mode.
+     * @return WIFI_POWER_SAVE::Mode
+     */
+    uint8_t powerSaveMode() const {
+        return powerSaveMode_;
+    }
+
+    /**
+     * @brief Record the arrival of an MQTT message from a client.
+     * @param nowMs Arrival time in ms (millis()).
+     */
+    void recordMqttReceive(uint32_t nowMs) {
+        if (lastRxMs_ != 0) {
+            uint32_t gap = nowMs - lastRxMs_;
+            if (gap < CONFIG::METRICS_RX_GAP_IDLE_MS) {
+                addSample(rxGap_[powerSaveMode_], gap);
+            }
+        }
+        lastRxMs_ = nowMs;
+    }
+
+    /**
+     * @brief Record the delay of a loopback probe, from its publish until it was received back.
+     * Dropped if the power-save mode changed in between.
+     * @param delayMs Delay in ms.
+     * @param mode Power-save mode when the probe was published.
+     */
+    void recordProbeDelay(uint32_t delayMs, uint8_t mode) {
+        if (mode != powerSaveMode_) return;
+        addSample(rxDelay_[mode], delayMs);
+    }
+
+    /**
+     * @brief Record a finished BLE connect attempt.
+     * @param durationMs Duration of the attempt.
+     * @param ok true if connected.
+     */
+    void recordConnectAttempt(uint32_t durationMs, bool ok) {
+        connect_.attempts++;
+        if (ok) connect_.ok++; else connect_.failed++;
+        connect_.sumMs += durationMs;
+        if (durationMs > connect_.maxMs) connect_.maxMs = durationMs;
+    }
+
+    /**
+     * @brief Record the number of commands waiting for a connection.
+     * @param depth Current number of queued commands.
+     */
+    void recordConnectQueueDepth(uint32_t depth) {
+        if (depth > connect_.queueMax) connect_.queueMax = depth;
+    }
+
+    /**
+     * @brief Record queued commands removed without execution.
+     * @param dropped Commands dropped because the queue was full.
+     * @param rejected Commands rejected because the controller failed to connect.
+     */
+    void recordConnectDiscard(uint32_t dropped, uint32_t rejected) {
+        connect_.dropped += dropped;
+        connect_.rejected += rejected;
+    }
+
+    /**
+     * @brief Record the time needed to drain the connect queue.
+     * @param durationMs Time from first queued command until the queue was empty.
+     */
+    void recordConnectDrain(uint32_t durationMs) {
+        connect_.drainLastMs = durationMs;
+        if (durationMs > connect_.drainMaxMs) connect_.drainMaxMs = durationMs;
+    }
+
+    /**
+     * @brief Record a completed GATT write.
+     * @param ok true if acknowledged.
+     * @param timeout true if no response was received.
+     * @param rttUs Round-trip time.
+     */
+    void recordGattWrite(bool ok, bool timeout, uint32_t rttUs) {
+        if (ok) {
+            write_.ok++;
+            write_.sumUs += rttUs;
+            if (rttUs > write_.maxUs) write_.maxUs = rttUs;
+        } else if (timeout) {
+            write_.timeout++;
+        } else {
+            write_.failed++;
+        }
+    }
+
+    /**
+     * @brief Record the number of writes in flight.
+     * @param pending Current number of pending writes.
+     */
+    void recordGattPending(uint32_t pending) {
+        if (pending > write_.pendingMax) write_.pendingMax = pending;
+    }
+
+    /**
+     * @brief Record the free heap, sampled from the main loop.
+     * @param freeBytes Current free heap.
+     */
+    void recordHeap(uint32_t freeBytes) {
+        if (heapMin_ == 0 || freeBytes < heapMin_) heapMin_ = freeBytes;
+    }
+
+    /**
+     * @brief Record a retried GATT write.
+     */
+    void recordGattRetry() {
+        write_.retries++;
+    }
+
+    /**
+     * @brief Record an encoded telemetry message.
+     * @param encoding ENCODING::Format
+     * @param bytes Message size.
+     * @param encodeUs Encoding time.
+     */
+    void recordTelemetry(uint8_t encoding, size_t bytes, uint32_t encodeUs) {
+        if (encoding >= ENCODING::FORMAT_COUNT) return;
+        TelemetryStats& s = telemetry_[encoding];
+        s.count++;
+        s.bytes += bytes;
+        s.sumUs += encodeUs;
+        if (encodeUs > s.maxUs) s.maxUs = encodeUs;
+    }
+
+    /**
+     * @brief Record a BLE stack start.
+     * @param initMs Init time in ms.
+     */
+    void recordBleStart(uint32_t initMs) {
+        bleStack_.up = true;
+        bleStack_.starts++;
+        bleStack_.initLastMs = initMs;
+        if (initMs > bleStack_.initMaxMs) bleStack_.initMaxMs = initMs;
+    }
+
+    /**
+     * @brief Record a BLE stack release.
+     * @param freedBytes Heap returned by the release.
+     */
+    void recordBleRelease(int32_t freedBytes) {
+        bleStack_.up = false;
+        bleStack_.releases++;
+        bleStack_.freedLast = freedBytes;
+    }
+
+    /**
+     * @brief Record an accepted embedded broker client.
+     * @param clients Connected clients including the new one.
+     */
+    void recordBrokerConnect(uint8_t clients) {
+        broker_.connects++;
+        if (clients > broker_.clientsMax) broker_.clientsMax = clients;
+    }
+
+    /**
+     * @brief Record a message received by the embedded broker from a local client.
+     */
+    void recordBrokerReceive() {
+        broker_.rx++;
+    }
+
+    /**
+     * @brief Record the local deliveries of one message by the embedded broker.
+     * @param clients Clients the message was delivered to.
+     */
+    void recordBrokerDeliver(uint32_t clients) {
+        broker_.tx += clients;
+    }
+
+    /**
+     * @brief Record a message of a local client forwarded to the upstream broker.
+     */
+    void recordBrokerForward() {
+        broker_.forwarded++;
+    }
+
+    /**
+     * @brief Record a rejected connection, protocol error or failed delivery of the embedded broker.
+     */
+    void recordBrokerError() {
+        broker_.errors++;
+    }
+
+    /**
+     * @brief Reset all collected statistics.
+     */
+    void reset() {
+        for (auto& s : rxGap_) s = GapStats();
+        for (auto& s : rxDelay_) s = GapStats();
+        lastRxMs_ = 0;
+        connect_ = ConnectStats();
+        write_ = WriteStats();
+        for (auto& s : telemetry_) s = TelemetryStats();
+        broker_ = BrokerStats();
+        bleStack_ = BleStackStats{ bleStack_.up };
+        heapMin_ = 0;
+    }
+
+    /**
+     * @brief Get the metrics as a JSON string.
+     * @param rssi Current WiFi RSSI in dBm.
+     * @return JSON-formatted metrics.
+     */
+    String toJson(int8_t rssi) const {
+        DynamicJsonDocument doc(3072);
+
+        JsonObject wifi = doc.createNestedObject("wifi");
+        wifi["ps"] = powerSaveName(powerSaveMode_);
+        wifi["listen_interval"] = listenInterval_;
+        wifi["rssi"] = rssi;
+
+        addPerMode(doc.createNestedObject("rx_delay"), rxDelay_);
+        addPerMode(doc.createNestedObject("rx_gap"), rxGap_);
+
+        JsonObject conn = doc.createNestedObject("ble_connect");
+        conn["attempts"] = connect_.attempts;
+        conn["ok"] = connect_.ok;
+        conn["failed"] = connect_.failed;
+        conn["avg"] = connect_.attempts ? static_cast<uint32_t>(connect_.sumMs / connect_.attempts) : 0;
+        conn["max"] = connect_.maxMs;
+        conn["dropped"] = connect_.dropped;
+        conn["rejected"] = connect_.rejected;
+        conn["queue_max"] = connect_.queueMax;
+        conn["drain_last"] = connect_.drainLastMs;
+        conn["drain_max"] = connect_.drainMaxMs;
+
+        JsonObject write = doc.createNestedObject("gatt_write");
+        write["ok"] = write_.ok;
+        write["failed"] = write_.failed;
+        write["timeout"] = write_.timeout;
+        write["retries"] = write_.retries;
+        write["avg_us"] = write_.ok ? static_cast<uint32_t>(write_.sumUs / write_.ok) : 0;
+        write["max_us"] = write_.maxUs;
+        write["pending_max"] = write_.pendingMax;
+
+        JsonObject heap = doc.createNestedObject("heap");
+        heap["free"] = ESP.getFreeHeap();
+        heap["min"] = heapMin_;
+
+        JsonObject telemetry = doc.createNestedObject("telemetry");
+        for (uint8_t encoding = 0; encoding < ENCODING::FORMAT_COUNT; encoding++) {
+            const TelemetryStats& s = telemetry_[encoding];
+            if (s.count == 0) continue;
+            JsonObject e = telemetry.createNestedObject(encodingName(encoding));
+            e["n"] = s.count;
+            e["bytes"] = s.bytes;
+            e["avg_us"] = static_cast<uint32_t>(s.sumUs / s.count);
+            e["max_us"] = s.maxUs;
+        }
+
+        JsonObject ble = doc.createNestedObject("ble_stack");
+        ble["up"] = bleStack_.up;
+        ble["starts"] = bleStack_.starts;
+        ble["releases"] = bleStack_.releases;
+        ble["init_last"] = bleStack_.initLastMs;
+        ble["init_max"] = bleStack_.initMaxMs;
+        ble["freed_last"] = bleStack_.freedLast;
+
+        if (broker_.connects > 0) {
+            JsonObject broker = doc.createNestedObject("broker");
+            broker["connects"] = broker_.connects;
+            broker["clients_max"] = broker_.clientsMax;
+            broker["rx"] = broker_.rx;
+            broker["tx"] = broker_.tx;
+            broker["fwd"] = broker_.forwarded;
+            broker["errors"] = broker_.errors;
+        }
+
+        String json;
+        serializeJson(doc, json);
+        return json;
+    }
+
+private:
+    GapStats rxDelay_[WIFI_POWER_SAVE::MODE_COUNT];    ///< Loopback probe delays per power-save mode
+    GapStats rxGap_[WIFI_POWER_SAVE::MODE_COUNT];      ///< Receive gaps per power-save mode
+    ConnectStats connect_;                               ///< BLE connect admission statistics
+    WriteStats write_;                                   ///< GATT write statistics
+    TelemetryStats telemetry_[ENCODING::FORMAT_COUNT];   ///< Telemetry statistics per encoding
+    BrokerStats broker_;                                 ///< Embedded broker statistics
+    BleStackStats bleStack_;                             ///< BLE stack lifecycle statistics
+    uint8_t  powerSaveMode_ = WIFI_POWER_SAVE::MODE_MIN; ///< Active power-save mode
+    uint16_t listenInterval_ = 0;                        ///< Active listen interval
+    uint32_t lastRxMs_ = 0;                              ///< Arrival of the previous message
+    uint32_t heapMin_ = 0;                               ///< Lowest free heap since reset, 0 = not sampled
+
+    /**
+     * @brief Add a sample to the statistics and its histogram bucket.
+     */
+    static void addSample(GapStats& s, uint32_t ms) {
+        s.count++;
+        s.sumMs += ms;
+        if (ms > s.maxMs) s.maxMs = ms;
+        size_t bucket = 0;
+        while (bucket < RX_GAP_BUCKET_COUNT - 1 && ms >= RX_GAP_BUCKETS[bucket]) {
+            bucket++;
+        }
+        s.hist[bucket]++;
+    }
+
+    /**
+     * @brief Add the statistics of the power-save modes with samples to a JSON object.
+     */
+    static void addPerMode(JsonObject obj, const GapStats (&stats)[WIFI_POWER_SAVE::MODE_COUNT]) {
+        for (uint8_t mode = 0; mode < WIFI_POWER_SAVE::MODE_COUNT; mode++) {
+            const GapStats& s = stats[mode];
+            if (s.count == 0) continue;
+            JsonObject m = obj.createNestedObject(powerSaveName(mode));
+            m["n"] = s.count;
+            m["avg"] = static_cast<uint32_t>(s.sumMs / s.count);
+            m["max"] = s.maxMs;
+            JsonArray hist = m.createNestedArray("hist");
+            for (size_t i = 0; i < RX_GAP_BUCKET_COUNT; i++) hist.add(s.hist[i]);
+        }
+    }
+};
+
+inline Metrics metrics; // global instance
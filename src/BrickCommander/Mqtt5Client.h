@@ -0,0 +1,555 @@
+/**
+ * @file Mqtt5Client.h
+ *
+ * @brief Minimal MQTT 5 client with topic aliases and user properties.
+ *
+ * Offers the subset of the PubSubClient API used by the MqttHandler, so the
+ * MqttHandler can use either client (see MQTT_V5 in Configuration.h).
+ * QoS 0 only for publish and subscribe.
+ *
+ * MQTT 5 additions:
+ * - Topic aliases: topics registered with addTopicAlias() are sent in full
+ *   once per connection, after that only as a 2-byte alias. The number of
+ *   aliases is limited by the Topic Alias Maximum of the broker (CONNACK).
+ * - User properties: passed along with publish(), and available for the
+ *   message being handled in the callback via getUserProperty().
+ *
+ * Author: Robert W.B. Linn
+ * Copyright © 2025 Robert W.B. Linn
+ * License: MIT — see LICENSE file.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <Client.h>
+#include <functional>
+#include <vector>
+#include "Log.h"
+#include "Configuration.h"
+
+// Client state, same values as PubSubClient
+#define MQTT5_CONNECTION_TIMEOUT     -4
+#define MQTT5_CONNECTION_LOST        -3
+#define MQTT5_CONNECT_FAILED         -2
+#define MQTT5_DISCONNECTED           -1
+#define MQTT5_CONNECTED               0
+
+/**
+ * @brief A MQTT 5 user property (name/value pair).
+ */
+struct Mqtt5UserProperty {
+    String name;
+    String value;
+};
+
+/**
+ * @class Mqtt5Client
+ * @brief MQTT 5 client over an Arduino Client (e.g. WiFiClient).
+ */
+class Mqtt5Client {
+public:
+    using Callback = std::function<void(char*, uint8_t*, unsigned int)>;
+
+    static constexpr uint16_t BUFFER_SIZE    = CONFIG::MQTT_BUFFER_SIZE;   ///< Max packet size in and out
+    static constexpr uint16_t KEEPALIVE_S    = 15;     ///< Keep alive interval
+    static constexpr uint16_t SOCKET_TIMEOUT = 15;     ///< Seconds to wait for CONNACK and packet bytes
+    static constexpr uint8_t  MAX_ALIASES    = 8;      ///< Topics that can be registered for an alias
+
+    /**
+     * @brief Constructor.
+     * @param client Network client, e.g. WiFiClient.
+     */
+    explicit Mqtt5Client(Client& client) : net_(client) {}
+
+    Mqtt5Client& setServer(const char* host, uint16_t port) {
+        host_ = host;
+        port_ = port;
+        return *this;
+    }
+
+    Mqtt5Client& setCallback(Callback callback) {
+        callback_ = callback;
+        return *this;
+    }
+
+    /**
+     * @brief Register a topic to be published with a topic alias.
+     * @param topic Full topic name.
+     */
+    void addTopicAlias(const char* topic) {
+        if (aliasTopics_.size() >= MAX_ALIASES) return;
+        for (const String& t : aliasTopics_) {
+            if (t == topic) return;
+        }
+        aliasTopics_.push_back(String(topic));
+        aliasSent_.push_back(false);
+    }
+
+    /**
+     * @brief Connect to the broker with a last will (QoS and retain as given).
+     * @return true if the broker accepted the connection.
+     */
+    bool connect(const char* id, const char* user, const char* pass,
+                 const char* willTopic, uint8_t willQos, bool willRetain, const char* willMessage) {
+        if (connected()) return true;
+
+        if (!net_.connect(host_.c_str(), port_)) {
+            state_ = MQTT5_CONNECT_FAILED;
+            return false;
+        }
+
+        bool hasUser = user && *user;
+        bool hasPass = hasUser && pass && *pass;
+        bool hasWill = willTopic && *willTopic;
+
+        size_t pos = 5;  // Room for the fixed header
+        pos = writeString(pos, "MQTT");
+        buffer_[pos++] = 5;  // Protocol level
+        uint8_t flags = 0x02;  // Clean start
+        if (hasWill) flags |= 0x04 | ((willQos & 0x03) << 3) | (willRetain ? 0x20 : 0);
+        if (hasUser) flags |= 0x80;
+        if (hasPass) flags |= 0x40;
+        buffer_[pos++] = flags;
+        buffer_[pos++] = KEEPALIVE_S >> 8;
+        buffer_[pos++] = KEEPALIVE_S & 0xFF;
+        buffer_[pos++] = 0;  // No connect properties
+
+        pos = writeString(pos, id);
+        if (hasWill) {
+            buffer_[pos++] = 0;  // No will properties
+            pos = writeString(pos, willTopic);
+            pos = writeString(pos, willMessage);
+        }
+        if (hasUser) pos = writeString(pos, user);
+        if (hasPass) pos = writeString(pos, pass);
+
+        if (!sendPacket(0x10, pos)) {
+            net_.stop();
+            state_ = MQTT5_CONNECT_FAILED;
+            return false;
+        }
+
+        // Wait for CONNACK
+        uint32_t start = millis();
+        while (!net_.available()) {
+            if (millis() - start > SOCKET_TIMEOUT * 1000UL) {
+                net_.stop();
+                state_ = MQTT5_CONNECTION_TIMEOUT;
+                return false;
+            }
+            delay(10);
+        }
+
+        size_t len = 0;
+        uint8_t type = readPacket(len);
+        if (type != 0x20 || len < 2 || buffer_[1] != 0) {
+            LOGE("[Mqtt5Client][connect] Connection refused, type=0x%02x reason=0x%02x", type, len >= 2 ? buffer_[1] : 0);
+            net_.stop();
+            state_ = MQTT5_CONNECT_FAILED;
+            return false;
+        }
+        if (!parseConnackProperties(len)) {
+            LOGE("[Mqtt5Client][connect] Malformed CONNACK properties");
+            net_.stop();
+            state_ = MQTT5_CONNECT_FAILED;
+            return false;
+        }
+
+        for (size_t i = 0; i < aliasSent_.size(); i++) aliasSent_[i] = false;
+        lastInMs_ = lastOutMs_ = millis();
+        pingOutstanding_ = false;
+        state_ = MQTT5_CONNECTED;
+        LOGI("[Mqtt5Client][connect] Connected, broker topic alias maximum=%u", aliasMax_);
+        return true;
+    }
+
+    bool connected() {
+        bool ok = net_.connected() && state_ == MQTT5_CONNECTED;
+        if (!ok && state_ == MQTT5_CONNECTED) {
+            net_.stop();
+            state_ = MQTT5_CONNECTION_LOST;
+        }
+        return ok;
+    }
+
+    int state() const {
+        return state_;
+    }
+
+    void disconnect() {
+        buffer_[0] = 0xE0;
+        buffer_[1] = 0;
+        net_.write(buffer_, 2);
+        net_.stop();
+        state_ = MQTT5_DISCONNECTED;
+    }
+
+    /**
+     * @brief Subscribe with QoS 0.
+     */
+    bool subscribe(const char* topic) {
+        if (!connected()) return false;
+        size_t pos = 5;
+        uint16_t id = nextPacketId();
+        buffer_[pos++] = id >> 8;
+        buffer_[pos++] = id & 0xFF;
+        buffer_[pos++] = 0;  // No subscribe properties
+        pos = writeString(pos, topic);
+        buffer_[pos++] = 0;  // QoS 0
+        return sendPacket(0x82, pos);
+    }
+
+    bool publish(const char* topic, const char* payload, bool retained = false) {
+        return publish(topic, reinterpret_cast<const uint8_t*>(payload), strlen(payload), retained, nullptr, 0);
+    }
+
+    /**
+     * @brief Publish with QoS 0, optional user properties and topic alias.
+     * @param topic Topic name.
+     * @param payload Payload bytes.
+     * @param length Payload length.
+     * @param retained Retain flag.
+     * @param props User properties or nullptr.
+     * @param propCount Number of user properties.
+     * @return true if sent.
+     */
+    bool publish(const char* topic, const uint8_t* payload, size_t length, bool retained,
+                 const Mqtt5UserProperty* props, size_t propCount) {
+        if (!connected()) return false;
+
+        // Topic alias: full topic on first use, afterwards only the alias
+        int alias = aliasFor(topic);
+        bool sendTopic = alias < 0 || !aliasSent_[alias];
+
+        size_t pos = 5;
+        pos = writeString(pos, sendTopic ? topic : "");
+
+        // Properties
+        size_t propLen = 0;
+        if (alias >= 0) propLen += 3;
+        for (size_t i = 0; i < propCount; i++) {
+            propLen += 1 + 2 + props[i].name.length() + 2 + props[i].value.length();
+        }
+        if (pos + 4 + propLen + length > BUFFER_SIZE) {
+            LOGE("[Mqtt5Client][publish] Packet too large for %s", topic);
+            return false;
+        }
+        pos = writeVarInt(pos, propLen);
+        if (alias >= 0) {
+            buffer_[pos++] = 0x23;  // Topic Alias
+            buffer_[pos++] = 0;
+            buffer_[pos++] = alias + 1;
+        }
+        for (size_t i = 0; i < propCount; i++) {
+            buffer_[pos++] = 0x26;  // User Property
+            pos = writeString(pos, props[i].name.c_str());
+            pos = writeString(pos, props[i].value.c_str());
+        }
+
+        memcpy(buffer_ + pos, payload, length);
+        pos += length;
+
+        bool ok = sendPacket(0x30 | (retained ? 0x01 : 0x00), pos);
+        if (ok && alias >= 0) aliasSent_[alias] = true;
+        return ok;
+    }
+
+    /**
+     * @brief Get a user property of the message being handled in the callback.
+     * @param name Property name.
+     * @return Property value or empty if not present.
+     */
+    String getUserProperty(const char* name) const {
+        for (const auto& p : incomingProps_) {
+            if (p.name == name) return p.value;
+        }
+        return "";
+    }
+
+    /**
+     * @brief Process incoming packets and keep the connection alive.
+     * @return true if connected.
+     */
+    bool loop() {
+        if (!connected()) return false;
+
+        uint32_t now = millis();
+        if (now - lastInMs_ > KEEPALIVE_S * 1500UL) {
+            LOGW("[Mqtt5Client][loop] Keep alive timeout");
+            net_.stop();
+            state_ = MQTT5_CONNECTION_TIMEOUT;
+            return false;
+        }
+        if (!pingOutstanding_ && (now - lastOutMs_ > KEEPALIVE_S * 1000UL || now - lastInMs_ > KEEPALIVE_S * 1000UL)) {
+            buffer_[0] = 0xC0;
+            buffer_[1] = 0;
+            net_.write(buffer_, 2);
+            lastOutMs_ = now;
+            pingOutstanding_ = true;
+        }
+
+        while (net_.available()) {
+            size_t len = 0;
+            uint8_t type = readPacket(len);
+            if (type == 0) break;
+            lastInMs_ = millis();
+
+            switch (type & 0xF0) {
+                case 0x30: handlePublish(type, len); break;
+                case 0xD0: pingOutstanding_ = false; break;
+                case 0xE0:
+                    LOGW("[Mqtt5Client][loop] Disconnected by broker, reason=0x%02x", len > 0 ? buffer_[0] : 0);
+                    net_.stop();
+                    state_ = MQTT5_DISCONNECTED;
+                    return false;
+                default: break;  // SUBACK and others are ignored
+            }
+        }
+        return true;
+    }
+
+private:
+    Client& net_;
+    String host_;
+    uint16_t port_ = 1883;
+    Callback callback_;
+    int state_ = MQTT5_DISCONNECTED;
+    uint8_t buffer_[BUFFER_SIZE];
+    uint16_t packetId_ = 0;
+    uint16_t aliasMax_ = 0;                         ///< Topic Alias Maximum of the broker
+    std::vector<String> aliasTopics_;               ///< Topics registered for an alias, alias = index + 1
+    std::vector<bool> aliasSent_;                   ///< Full topic sent on this connection
+    std::vector<Mqtt5UserProperty> incomingProps_;  ///< User properties of the message being handled
+    uint32_t lastInMs_ = 0;
+    uint32_t lastOutMs_ = 0;
+    bool pingOutstanding_ = false;
+
+    uint16_t nextPacketId() {
+        if (++packetId_ == 0) packetId_ = 1;
+        return packetId_;
+    }
+
+    int aliasFor(const char* topic) const {
+        for (size_t i = 0; i < aliasTopics_.size() && i < aliasMax_; i++) {
+            if (aliasTopics_[i] == topic) return static_cast<int>(i);
+        }
+        return -1;
+    }
+
+    size_t writeString(size_t pos, const char* str) {
+        size_t len = strlen(str);
+        if (pos + 2 + len > BUFFER_SIZE) return pos;
+        buffer_[pos++] = len >> 8;
+        buffer_[pos++] = len & 0xFF;
+        memcpy(buffer_ + pos, str, len);
+        return pos + len;
+    }
+
+    size_t writeVarInt(size_t pos, size_t value) {
+        do {
+            uint8_t b = value & 0x7F;
+            value >>= 7;
+            buffer_[pos++] = b | (value ? 0x80 : 0);
+        } while (value);
+        return pos;
+    }
+
+    /**
+     * @brief Send the packet in buffer_[5..end) with the fixed header placed in front.
+     */
+    bool sendPacket(uint8_t header, size_t end) {
+        size_t remaining = end - 5;
+        uint8_t lenBytes[4];
+        size_t n = 0;
+        do {
+            uint8_t b = remaining & 0x7F;
+            remaining >>= 7;
+            lenBytes[n++] = b | (remaining ? 0x80 : 0);
+        } while (remaining);
+
+        size_t start = 5 - 1 - n;
+        buffer_[start] = header;
+        memcpy(buffer_ + start + 1, lenBytes, n);
+        size_t total = end - start;
+        bool ok = net_.write(buffer_ + start, total) == total;
+        if (ok) lastOutMs_ = millis();
+        return ok;
+    }
+
+    bool readByte(uint8_t& b) {
+        uint32_t start = millis();
+        while (!net_.available()) {
+            if (millis() - start > SOCKET_TIMEOUT * 1000UL) return false;
+            delay(1);
+        }
+        b = static_cast<uint8_t>(net_.read());
+        return true;
+    }
+
+    /**
+     * @brief Read one packet, the variable header and payload go to buffer_.
+     * @param len Receives the remaining length.
+     * @return Fixed header byte, 0 on error or if the packet is too large (skipped).
+     */
+    uint8_t readPacket(size_t& len) {
+        uint8_t header;
+        if (!readByte(header)) return 0;
+
+        len = 0;
+        uint8_t b;
+        uint8_t shift = 0;
+        do {
+            if (!readByte(b)) return 0;
+            len |= static_cast<size_t>(b & 0x7F) << shift;
+            shift += 7;
+        } while ((b & 0x80) && shift < 28);
+
+        bool fits = len <= BUFFER_SIZE;
+        for (size_t i = 0; i < len; i++) {
+            if (!readByte(b)) return 0;
+            if (fits) buffer_[i] = b;
+        }
+        if (!fits) {
+            LOGW("[Mqtt5Client][readPacket] Packet of %u bytes skipped", static_cast<unsigned>(len));
+            return 0;
+        }
+        return header;
+    }
+
+    /**
+     * @brief Read a variable byte integer.
+     * @return Position after the integer, 0 if it is truncated or longer than 4 bytes.
+     */
+    size_t readVarInt(size_t pos, size_t end, size_t& value) const {
+        value = 0;
+        for (uint8_t shift = 0; shift < 28 && pos < end; shift += 7) {
+            uint8_t b = buffer_[pos++];
+            value |= static_cast<size_t>(b & 0x7F) << shift;
+            if (!(b & 0x80)) return pos;
+        }
+        return 0;
+    }
+
+    /**
+     * @brief Walk a property list, storing user properties and the topic alias maximum.
+     * Every value is checked against the end of the property list.
+     * @param pos Position of the property length, receives the position after the properties.
+     * @param end End of the packet.
+     * @return false if the property list is malformed, the packet must be dropped.
+     */
+    bool parseProperties(size_t& pos, size_t end, bool storeUserProps) {
+        size_t propLen;
+        size_t p = readVarInt(pos, end, propLen);
+        if (p == 0 || propLen > end - p) return false;
+        size_t propEnd = p + propLen;
+
+        while (p < propEnd) {
+            uint8_t id = buffer_[p++];
+            size_t size;
+            switch (id) {
+                // Byte
+                case 0x01: case 0x17: case 0x19: case 0x24: case 0x25: case 0x28: case 0x29: case 0x2A:
+                    size = 1; break;
+                // Two byte integer
+                case 0x13: case 0x21: case 0x22: case 0x23:
+                    size = 2; break;
+                // Four byte integer
+                case 0x02: case 0x11: case 0x18: case 0x27:
+                    size = 4; break;
+                // Variable byte integer
+                case 0x0B: {
+                    size_t v;
+                    p = readVarInt(p, propEnd, v);
+                    if (p == 0) return false;
+                    continue;
+                }
+                // UTF-8 string or binary data
+                case 0x03: case 0x08: case 0x09: case 0x12: case 0x15: case 0x16: case 0x1A: case 0x1C: case 0x1F:
+                    if (!readLength(p, propEnd, size)) return false;
+                    size += 2;
+                    break;
+                // User property
+                case 0x26: {
+                    Mqtt5UserProperty up;
+                    if (!readString(p, propEnd, up.name) || !readString(p, propEnd, up.value)) return false;
+                    if (storeUserProps) incomingProps_.push_back(up);
+                    continue;
+                }
+                default:
+                    size = propEnd - p;  // Unknown property, skip the rest
+                    break;
+            }
+            if (size > propEnd - p) return false;
+            if (id == 0x22) aliasMax_ = (buffer_[p] << 8) | buffer_[p + 1];
+            p += size;
+        }
+        pos = propEnd;
+        return true;
+    }
+
+    /**
+     * @brief Read the 2 byte length of a string or binary data.
+     * @return false if the length or the data does not fit before end.
+     */
+    bool readLength(size_t pos, size_t end, size_t& len) const {
+        if (end - pos < 2) return false;
+        len = (buffer_[pos] << 8) | buffer_[pos + 1];
+        return len <= end - pos - 2;
+    }
+
+    /**
+     * @brief Read a string, pos is advanced past it.
+     * @return false if the string does not fit before end.
+     */
+    bool readString(size_t& pos, size_t end, String& out) const {
+        size_t len;
+        if (!readLength(pos, end, len)) return false;
+        pos += 2;
+        out = "";
+        out.reserve(len);
+        for (size_t i = 0; i < len; i++) out += static_cast<char>(buffer_[pos + i]);
+        pos += len;
+        return true;
+    }
+
+    /**
+     * @brief Read the topic alias maximum from the CONNACK properties.
+     * @return false if the properties are malformed.
+     */
+    bool parseConnackProperties(size_t len) {
+        aliasMax_ = 0;
+        size_t pos = 2;
+        if (len > 2 && !parseProperties(pos, len, false)) {
+            aliasMax_ = 0;
+            return false;
+        }
+        if (aliasMax_ > MAX_ALIASES) aliasMax_ = MAX_ALIASES;
+        return true;
+    }
+
+    void handlePublish(uint8_t header, size_t len) {
+        if (len < 2) return;
+        size_t topicLen = (buffer_[0] << 8) | buffer_[1];
+        size_t pos = 2 + topicLen;
+        if ((header & 0x06) != 0) pos += 2;  // Packet id for QoS > 0
+        if (pos > len) return;
+
+        incomingProps_.clear();
+        if (!parseProperties(pos, len, true)) {
+            LOGW("[Mqtt5Client][handlePublish] Malformed properties, packet dropped");
+            incomingProps_.clear();
+            return;
+        }
+        size_t payloadStart = pos;
+
+        // Terminate the topic in place, the length bytes are not needed anymore
+        memmove(buffer_, buffer_ + 2, topicLen);
+        buffer_[topicLen] = '\0';
+
+        if (callback_) {
+            callback_(reinterpret_cast<char*>(buffer_), buffer_ + payloadStart, len - payloadStart);
+        }
+        incomingProps_.clear();
+    }
+};
@@ -3,6 +3,29 @@
  *
  * @brief Handles MQTT connection, subscription, and command message processing.
  *
+ * Uses PubSubClient (MQTT 3.1.1) or, if MQTT_V5 is defined in Configuration.h,
+ * Mqtt5Client (MQTT 5). With MQTT 5 the status and backpressure topics are
+ * published with topic aliases, and the correlation id and service time of a
+ * command are sent as user properties instead of JSON fields.
+ *
+ * The telemetry topic carries the state of all controllers at a fixed
+ * interval. Telemetry and status payloads are encoded as JSON, MessagePack
+ * or (telemetry only) a fixed binary schema, set per topic via the config topic.
+ *
+ * Assets (sequences, rule tables, calibration curves, group definitions) are
+ * uploaded into the AssetStore in chunks on the asset topic, each chunk is the
+ * asset offset (u32 little-endian) followed by the data. The upload is started,
+ * committed and listed with the config key "asset".
+ *
+ * With PROFILER defined the sampling profiler is controlled with the config
+ * key "profile" and its histogram is published on the profile topic.
+ *
+ * With EMBEDDED_BROKER defined in Configuration.h the commander also runs a
+ * MQTT 3.1.1 broker for local clients (see EmbeddedBroker.h). Their commands
+ * and config messages are handled directly, messages to other topics are
+ * forwarded to the upstream broker. Everything the commander publishes goes
+ * to the local clients and, if configured and connected, the upstream broker.
+ *
  * Author: Robert W.B. Linn
  * Copyright © 2025 Robert W.B. Linn
  * License: MIT — see LICENSE file.
@@ -10,12 +33,28 @@
 
 #pragma once
 
-#include <PubSubClient.h>
 #include <WiFi.h>
 #include "Log.h"
 #include "Configuration.h"
+#ifdef MQTT_V5
+#include "Mqtt5Client.h"
+#else
+#include <PubSubClient.h>
+#endif
 #include "StringUtils.h"
+#include "Metrics.h"
+#include "WiFiMod.h"
+#include "Telemetry.h"
+#include "RssiMonitor.h"
 #include "CommandHandler.h"
+#include "BleStack.h"
+#include "AssetStore.h"
+#ifdef PROFILER
+#include "Profiler.h"
+#endif
+#ifdef EMBEDDED_BROKER
+#include "EmbeddedBroker.h"
+#endif
 
 /**
  * @brief Handles MQTT connection, subscription, and command messages.
@@ -34,6 +73,11 @@ public:
         configTopic         = baseTopic + "/" + CONFIG::MQTT_TOPIC_CONFIG_SUFFIX;
         stateTopic          = baseTopic + "/" + CONFIG::MQTT_TOPIC_STATUS_SUFFIX;
         availabilityTopic   = baseTopic + "/" + CONFIG::MQTT_TOPIC_AVAILABILITY_SUFFIX;
+        backpressureTopic   = baseTopic + "/" + CONFIG::MQTT_TOPIC_BACKPRESSURE_SUFFIX;
+        telemetryTopic      = baseTopic + "/" + CONFIG::MQTT_TOPIC_TELEMETRY_SUFFIX;
+        assetTopic          = baseTopic + "/" + CONFIG::MQTT_TOPIC_ASSET_SUFFIX;
+        profileTopic        = baseTopic + "/" + CONFIG::MQTT_TOPIC_PROFILE_SUFFIX;
+        probeTopic          = baseTopic + "/" + CONFIG::MQTT_TOPIC_PROBE_SUFFIX;
         brokerUsername      = "";
         brokerPassword      = "";
     }
@@ -58,39 +102,173 @@ public:
 
         // Set the MQTT broker using ip & port
         client.setServer(broker, port);
+#ifndef MQTT_V5
+        client.setBufferSize(CONFIG::MQTT_BUFFER_SIZE);
+#endif
         LOGI("[MqttHandler][begin] Broker set to %s:%d", broker, port);
 
         client.setCallback([this](char* topic, byte* payload, unsigned int length) {
             handleMessage(topic, payload, length);
         });
+
+#ifdef MQTT_V5
+        // High-rate topics are sent with a topic alias after the first publish
+        client.addTopicAlias(stateTopic.c_str());
+        client.addTopicAlias(backpressureTopic.c_str());
+        client.addTopicAlias(telemetryTopic.c_str());
+#endif
+
+        // Payload encodings per topic, invalid stored names fall back to JSON
+        int8_t telemetryEncoding = Telemetry::parseEncoding(config.telemetry_encoding);
+        Telemetry::getInstance().configure(telemetryEncoding < 0 ? ENCODING::FORMAT_JSON : telemetryEncoding,
+                                           config.telemetry_interval);
+        int8_t encoding = Telemetry::parseEncoding(config.status_encoding);
+        statusEncoding = (encoding == ENCODING::FORMAT_MSGPACK) ? ENCODING::FORMAT_MSGPACK : ENCODING::FORMAT_JSON;
+
+        // Commands queued until their controller is connected, and port level
+        // writes waiting for their acknowledge, reply from the main loop
+        ConnectionAdmission::getInstance().setHandlers(
+            [](const String& jsonCommand, const CommandContext& context) {
+                CommandContext queued = context;
+                return handleCommand(jsonCommand, queued);
+            },
+            [this](const String& msg, const String& key, const CommandContext& context) { sendCommandStatus(msg, key, context); });
+        commandReplyHandler = [this](const String& msg, const String& key, const CommandContext& context) {
+            sendCommandStatus(msg, key, context);
+        };
+
+#ifdef EMBEDDED_BROKER
+        // Local clients, their commands and config are handled without the upstream broker
+        EmbeddedBroker& embedded = EmbeddedBroker::getInstance();
+        // Local clients authenticate with the configured MQTT credentials
+        embedded.begin(CONFIG::BROKER_PORT, [this](const char* topic, const uint8_t* payload, size_t length, bool retain) {
+            handleLocalMessage(topic, payload, length, retain);
+        }, brokerUsername, brokerPassword);
+        embedded.publish(availabilityTopic.c_str(), reinterpret_cast<const uint8_t*>(CONFIG::MQTT_AVAILABILITY_ONLINE),
+                         strlen(CONFIG::MQTT_AVAILABILITY_ONLINE), true);
+        if (!hasUpstream()) {
+            LOGI("[MqttHandler][begin] No upstream broker, local clients only");
+        }
+#endif
     }
 
     /**
      * @brief Keep MQTT connection alive and process incoming messages.
      */
     void loop() {
+#ifdef EMBEDDED_BROKER
+        // Local clients first, the upstream broker is optional and retried without blocking
+        EmbeddedBroker::getInstance().loop();
+        if (hasUpstream() && !client.connected() && millis() - lastConnectMs >= CONFIG::MQTT_RECONNECT_MS) {
+            lastConnectMs = millis();
+            connectUpstream();
+        }
+#else
         if (!client.connected()) {
             reconnect();
         }
+#endif
         client.loop();
+
+        // Complete acknowledged, failed and timed out GATT writes
+        GattWriter::getInstance().poll();
+
+        // Start the next queued BLE connect attempt, if any
+        ConnectionAdmission::getInstance().loop();
+
+        // Publish the backpressure signal if changed
+        Backpressure& backpressure = Backpressure::getInstance();
+        uint32_t now = millis();
+        if (canPublish() && backpressure.isDue(now)) {
+            String json = backpressure.takeJson(now);
+            if (!publish(backpressureTopic, reinterpret_cast<const uint8_t*>(json.c_str()), json.length(), true)) {
+                LOGE("[MqttHandler][loop] Failed to publish backpressure to %s", backpressureTopic.c_str());
+            }
+        }
+
+        // Loopback probe measuring the receive delay of the active power-save mode
+        if (CONFIG::METRICS_PROBE_INTERVAL_MS > 0 && client.connected() &&
+            now - probeSentMs >= CONFIG::METRICS_PROBE_INTERVAL_MS) {
+            sendProbe(now);
+        }
+
+        // BLE RSSI of the next connected hub
+        RssiMonitor::getInstance().loop(now);
+
+        // Release the BLE stack when no BLE controller is active
+        BleStack::getInstance().loop(now);
+
+        // Free heap low-water mark
+        metrics.recordHeap(ESP.getFreeHeap());
+
+        // Publish the telemetry of all controllers
+        Telemetry& telemetry = Telemetry::getInstance();
+        if (canPublish() && telemetry.isDue(now)) {
+            telemetry.publish(now, WiFi.RSSI(), [this](const uint8_t* data, size_t length) {
+                return publish(telemetryTopic, data, length);
+            });
+        }
     }
 
     /**
      * @brief Publish a status message as JSON to the state topic with retained false.
      * @param status Short status string (e.g., "ok", "error")
      * @param message More detailed description
+     * @param controllerKey Optional controller key (type|mac), adds its backpressure signal as "bp"
+     * @param context Optional command context, adds the correlation id and service time
      */
-    void sendMqttStatus(const String& status, const String& message) {
-        StaticJsonDocument<256> doc;
+    void sendMqttStatus(const String& status, const String& message, const String& controllerKey = "",
+                        const CommandContext& context = CommandContext()) {
+        DynamicJsonDocument doc(384 + message.length());
         doc["status"] = status;
         doc["message"] = message;
+        if (!controllerKey.isEmpty()) {
+            Backpressure::getInstance().fill(doc.createNestedObject("bp"), controllerKey);
+        }
 
-        char buf[256];
-        size_t len = serializeJson(doc, buf, sizeof(buf));
+        bool hasContext = !context.correlationId.isEmpty();
+        uint32_t serviceMs = millis() - context.receivedMs;
+#if !defined(MQTT_V5) || defined(EMBEDDED_BROKER)
+        // MQTT 3.1.1 (also used by the embedded broker) has no user properties, return them in the JSON body
+        if (hasContext) {
+            doc[COMMAND::CORRELATION_ID] = context.correlationId;
+            doc[USER_PROPERTY::SERVICE_TIME] = serviceMs;
+        }
+#endif
+
+        // The packet also holds the MQTT header, the topic and with MQTT 5 the user properties;
+        // a status that does not fit is replaced by an error instead of being truncated
+        size_t limit = sizeof(statusBuffer) - stateTopic.length() - 16;
+#ifdef MQTT_V5
+        if (hasContext) limit -= context.correlationId.length() + 32;
+#endif
+        size_t needed = (statusEncoding == ENCODING::FORMAT_MSGPACK) ? measureMsgPack(doc) : measureJson(doc) + 1;
+        if (needed > limit) {
+            LOGE("[MqttHandler][sendMqttStatus] Status of %u bytes exceeds the limit of %u bytes",
+                 static_cast<unsigned>(needed), static_cast<unsigned>(limit));
+            sendMqttStatus(COMMAND_STATUS::ERROR, "Status too large: " + String(needed) + " bytes",
+                           controllerKey, context);
+            return;
+        }
 
-        if (client.connected()) {
-            if (client.publish(stateTopic.c_str(), buf, false)) {
-                LOGI("[MqttHandler][sendMqttStatus] Published status to %s: %s", stateTopic.c_str(), buf);
+        char* buf = statusBuffer;
+        size_t len = (statusEncoding == ENCODING::FORMAT_MSGPACK)
+            ? serializeMsgPack(doc, buf, sizeof(statusBuffer))
+            : serializeJson(doc, buf, sizeof(statusBuffer));
+
+        if (canPublish()) {
+#ifdef MQTT_V5
+            Mqtt5UserProperty props[2] = {
+                { USER_PROPERTY::CORRELATION_ID, context.correlationId },
+                { USER_PROPERTY::SERVICE_TIME, String(serviceMs) }
+            };
+            bool published = publish(stateTopic, reinterpret_cast<const uint8_t*>(buf), len,
+                                     false, props, hasContext ? 2 : 0);
+#else
+            bool published = publish(stateTopic, reinterpret_cast<const uint8_t*>(buf), len);
+#endif
+            if (published) {
+                LOGI("[MqttHandler][sendMqttStatus] Published status to %s: %s", stateTopic.c_str(), message.c_str());
             } else {
                 LOGE("[MqttHandler][sendMqttStatus] Failed to publish status to %s", stateTopic.c_str());
             }
@@ -101,50 +279,162 @@ public:
 
 private:
     WiFiClient espClient;       //< Underlying WiFi client used by MQTT
+#ifdef MQTT_V5
+    Mqtt5Client client;         //< MQTT 5 client instance
+#else
     PubSubClient client;        //< MQTT client instance
+#endif
 
     String commandTopic;        //< Topic for incoming commands
     String configTopic;         //< Topic for incoming config change
     String stateTopic;          //< Topic for publishing status
     String availabilityTopic;   //< Topic for publishing availability (online/offline)
+    String backpressureTopic;   //< Topic for publishing the backpressure signal
+    String telemetryTopic;      //< Topic for publishing the controller telemetry
+    String assetTopic;          //< Topic for incoming asset chunks
+    String profileTopic;        //< Topic for publishing the profiler histogram
+    String probeTopic;          //< Topic of the loopback probe measuring the receive delay
+    uint32_t probeSeq = 0;      //< Sequence number of the last probe
+    uint32_t probeSentMs = 0;   //< Publish time of the last probe
+    uint8_t probeMode = 0;      //< Power-save mode when the last probe was published
+    bool probePending = false;  //< Last probe not received back yet
+    uint8_t statusEncoding = ENCODING::FORMAT_JSON; //< Encoding of the status topic (json or msgpack)
+    char statusBuffer[CONFIG::MQTT_BUFFER_SIZE];    //< Encoded status, kept off the loop task stack
     String brokerUsername;      //< Username for client connection
     String brokerPassword;      //< Password for client connection
+#ifdef EMBEDDED_BROKER
+    uint32_t lastConnectMs = 0; //< Time of the last upstream connect attempt
+#endif
+
+    /**
+     * @brief Publish a payload, with EMBEDDED_BROKER also to the local clients.
+     * @param topic Topic to publish to.
+     * @param data Payload.
+     * @param length Payload length.
+     * @param retain Retain flag.
+     * @return true if published; with EMBEDDED_BROKER and no upstream connection always true.
+     */
+    bool publish(const String& topic, const uint8_t* data, size_t length, bool retain = false
+#ifdef MQTT_V5
+                 , const Mqtt5UserProperty* props = nullptr, size_t propCount = 0
+#endif
+                 ) {
+#ifdef EMBEDDED_BROKER
+        EmbeddedBroker::getInstance().publish(topic.c_str(), data, length, retain);
+        if (!client.connected()) return true;
+#endif
+#ifdef MQTT_V5
+        return client.publish(topic.c_str(), data, length, retain, props, propCount);
+#else
+        return client.publish(topic.c_str(), data, length, retain);
+#endif
+    }
+
+    /**
+     * @brief Check if a message can be published, upstream or to local clients.
+     */
+    bool canPublish() {
+#ifdef EMBEDDED_BROKER
+        if (EmbeddedBroker::getInstance().isRunning()) return true;
+#endif
+        return client.connected();
+    }
+
+    /**
+     * @brief Connect once to the MQTT broker and subscribe to the command and config topics.
+     * @return true if connected.
+     */
+    bool connectUpstream() {
+        LOGI("[MqttHandler][connectUpstream] Connecting to broker …");
+        String clientId = String(CONFIG::PROJECT_NAME) + "-" + String(random(0xffff), HEX);
+
+        if (!client.connect(clientId.c_str(),                // ClientID unique
+                            brokerUsername.c_str(),          // Username can be ""
+                            brokerPassword.c_str(),          // Password can be ""
+                            availabilityTopic.c_str(),       // Will topic
+                            1,                               // Qos
+                            true,                            // Retain
+                            "offline")                       // Message
+                            ) {
+            LOGE("[MqttHandler][connectUpstream] Connection failed, rc=%d.", client.state());
+            return false;
+        }
+        LOGI("[MqttHandler][connectUpstream] Connected to MQTT broker.");
+
+        // Subscribe to the command topics
+        client.subscribe(commandTopic.c_str());
+        LOGI("[MqttHandler][connectUpstream] Subscribed to: %s", commandTopic.c_str());
+
+        // Subscribe to the config topics, like broker, port
+        client.subscribe(configTopic.c_str());
+        LOGI("[MqttHandler][connectUpstream] Subscribed to: %s", configTopic.c_str());
+
+        // Subscribe to the asset chunks
+        client.subscribe(assetTopic.c_str());
+        LOGI("[MqttHandler][connectUpstream] Subscribed to: %s", assetTopic.c_str());
+
+        // Subscribe to the own loopback probes
+        if (CONFIG::METRICS_PROBE_INTERVAL_MS > 0) {
+            client.subscribe(probeTopic.c_str());
+            probePending = false;
+        }
+
+        client.publish(availabilityTopic.c_str(), "online", false);
+        return true;
+    }
 
     /**
      * @brief Reconnect to MQTT broker and subscribe to command topic.
-     * Retries indefinitely with a 5-second delay between attempts.
+     * Retries indefinitely with CONFIG::MQTT_RECONNECT_MS between attempts.
      */
     void reconnect() {
         while (!client.connected()) {
-            LOGI("[MqttHandler][reconnect] Connecting to broker …");
-            String clientId = String(CONFIG::PROJECT_NAME) + "-" + String(random(0xffff), HEX);
-
-            if (client.connect(clientId.c_str(),                // ClientID unique
-                               brokerUsername.c_str(),          // Username can be ""
-                               brokerPassword.c_str(),          // Password can be ""
-                               availabilityTopic.c_str(),       // Will topic
-                               1,                               // Qos
-                               true,                            // Retain
-                               "offline")                       // Message
-                               ) {
-                LOGI("[MqttHandler][reconnect] Connected to MQTT broker.");
-
-                // Subscribe to the command topics
-                client.subscribe(commandTopic.c_str());
-                LOGI("[MqttHandler][reconnect] Subscribed to: %s", commandTopic.c_str());
-
-                // Subscribe to the config topics, like broker, port
-                client.subscribe(configTopic.c_str());
-                LOGI("[MqttHandler][reconnect] Subscribed to: %s", configTopic.c_str());
-
-                client.publish(availabilityTopic.c_str(), "online", false);
-            } else {
-                LOGE("[MqttHandler][reconnect] Connection failed, rc=%d. Retrying in 5s.", client.state());
-                delay(5000);
+            if (!connectUpstream()) {
+                LOGI("[MqttHandler][reconnect] Retrying in %u ms.", CONFIG::MQTT_RECONNECT_MS);
+                delay(CONFIG::MQTT_RECONNECT_MS);
             }
         }
     }
 
+#ifdef EMBEDDED_BROKER
+    /**
+     * @brief Check if an upstream broker is configured and reachable over the WiFi network.
+     */
+    bool hasUpstream() const {
+        return WiFi.status() == WL_CONNECTED &&
+               !config.mqtt_broker.isEmpty() &&
+               config.mqtt_broker != CONFIG::MQTT_BROKER &&
+               !config.mqtt_broker.equalsIgnoreCase("none");
+    }
+
+    /**
+     * @brief Handle a message published by a local client of the embedded broker.
+     * Commands and config are handled here, other topics are forwarded upstream.
+     * @param topic Topic name.
+     * @param payload Payload.
+     * @param length Payload length.
+     * @param retain Retain flag of the message.
+     */
+    void handleLocalMessage(const char* topic, const uint8_t* payload, size_t length, bool retain) {
+        if (commandTopic == topic || configTopic == topic || assetTopic == topic) {
+            handleMessage(topic, payload, length, true);
+            return;
+        }
+        if (!client.connected()) return;
+
+#ifdef MQTT_V5
+        bool forwarded = client.publish(topic, payload, length, retain, nullptr, 0);
+#else
+        bool forwarded = client.publish(topic, payload, length, retain);
+#endif
+        if (forwarded) {
+            metrics.recordBrokerForward();
+        } else {
+            LOGE("[MqttHandler][handleLocalMessage] Failed to forward %s upstream", topic);
+        }
+    }
+#endif
+
     /*
      * @brief Update the configuration like mqtt broker ip, port, username, password.
      * @param jsonConfig String with the configuration items.
@@ -160,6 +450,7 @@ private:
             LOGE("[MqttHandler][handleConfig] JSON parse error: %s", err.c_str());
             sendMqttStatus(COMMAND_STATUS::ERROR,
                            "Failed to parse the JSON configuration payload");
+            return;
         }
 
         // Assign the configuration items.
@@ -169,7 +460,7 @@ private:
 
         // Check status request, send and leave
         if (!status != -1) {
-            if (status == 1) {
+            if (status == CONFIG_STATUS::HEAP) {
                 LOGI("[MqttHandler][handleConfig] Status request");
                 char buf[128];
                 snprintf(buf, 
@@ -182,9 +473,107 @@ private:
                 sendMqttStatus(COMMAND_STATUS::OK, String(buf));
                 return;
             }
+            if (status == CONFIG_STATUS::METRICS) {
+                LOGI("[MqttHandler][handleConfig] Metrics request");
+                sendMqttStatus(COMMAND_STATUS::OK, metrics.toJson(WiFi.RSSI()));
+                return;
+            }
+            if (status == CONFIG_STATUS::METRICS_RESET) {
+                LOGI("[MqttHandler][handleConfig] Metrics reset");
+                metrics.reset();
+                sendMqttStatus(COMMAND_STATUS::OK, "Metrics reset");
+                return;
+            }
             // Add more status request options
         } 
 
+        // WiFi power-save, applied at runtime without restart
+        if (doc.containsKey(CONFIG::MQTT_TOPIC_CONFIG_WIFI_POWER_SAVE) ||
+            doc.containsKey(CONFIG::MQTT_TOPIC_CONFIG_WIFI_LISTEN_INTERVAL)) {
+            String wifi_power_save        = doc[CONFIG::MQTT_TOPIC_CONFIG_WIFI_POWER_SAVE]      | config.wifi_power_save;
+            uint16_t wifi_listen_interval = doc[CONFIG::MQTT_TOPIC_CONFIG_WIFI_LISTEN_INTERVAL] | config.wifi_listen_interval;
+            wifi_power_save.toLowerCase();
+
+            if (wifi_power_save != WIFI_POWER_SAVE::NONE &&
+                wifi_power_save != WIFI_POWER_SAVE::MIN &&
+                wifi_power_save != WIFI_POWER_SAVE::MAX) {
+                LOGE("[MqttHandler][handleConfig] Invalid WiFi power-save mode: %s", wifi_power_save.c_str());
+                sendMqttStatus(COMMAND_STATUS::ERROR,
+                               "Invalid WiFi power-save mode, use none, min or max.");
+                return;
+            }
+
+            config.wifi_power_save = wifi_power_save;
+            config.wifi_listen_interval = wifi_listen_interval;
+            config.save();
+
+            if (wifi.setPowerSave(wifi_power_save, wifi_listen_interval)) {
+                sendMqttStatus(COMMAND_STATUS::OK, "WiFi power-save set to " + wifi_power_save);
+            } else {
+                sendMqttStatus(COMMAND_STATUS::ERROR,
+                               "WiFi power-save " + wifi_power_save + " saved but not accepted while BLE is active, using " + powerSaveName(wifi.getPowerSave()));
+            }
+            return;
+        }
+
+        // Asset upload, list and removal, stored in the asset partition
+        if (doc.containsKey(CONFIG::MQTT_TOPIC_CONFIG_ASSET)) {
+            handleAssetConfig(doc[CONFIG::MQTT_TOPIC_CONFIG_ASSET]);
+            return;
+        }
+
+#ifdef PROFILER
+        // Sampling profiler, not stored
+        if (doc.containsKey(CONFIG::MQTT_TOPIC_CONFIG_PROFILE)) {
+            handleProfileConfig(doc[CONFIG::MQTT_TOPIC_CONFIG_PROFILE]);
+            return;
+        }
+#endif
+
+#ifdef SIMULATED_HUBS
+        // Link of the simulated hubs, not stored
+        if (doc.containsKey(CONFIG::MQTT_TOPIC_CONFIG_SIM)) {
+            handleSimConfig(doc[CONFIG::MQTT_TOPIC_CONFIG_SIM]);
+            return;
+        }
+#endif
+
+        // Payload encodings and telemetry interval, applied at runtime without restart
+        if (doc.containsKey(CONFIG::MQTT_TOPIC_CONFIG_TELEMETRY_ENCODING) ||
+            doc.containsKey(CONFIG::MQTT_TOPIC_CONFIG_TELEMETRY_INTERVAL) ||
+            doc.containsKey(CONFIG::MQTT_TOPIC_CONFIG_STATUS_ENCODING)) {
+            String telemetry_encoding   = doc[CONFIG::MQTT_TOPIC_CONFIG_TELEMETRY_ENCODING] | config.telemetry_encoding;
+            uint32_t telemetry_interval = doc[CONFIG::MQTT_TOPIC_CONFIG_TELEMETRY_INTERVAL] | config.telemetry_interval;
+            String status_encoding      = doc[CONFIG::MQTT_TOPIC_CONFIG_STATUS_ENCODING]    | config.status_encoding;
+
+            int8_t telemetryFormat = Telemetry::parseEncoding(telemetry_encoding);
+            int8_t statusFormat = Telemetry::parseEncoding(status_encoding);
+            if (telemetryFormat < 0) {
+                LOGE("[MqttHandler][handleConfig] Invalid telemetry encoding: %s", telemetry_encoding.c_str());
+                sendMqttStatus(COMMAND_STATUS::ERROR,
+                               "Invalid telemetry encoding, use json, msgpack or fixed.");
+                return;
+            }
+            if (statusFormat != ENCODING::FORMAT_JSON && statusFormat != ENCODING::FORMAT_MSGPACK) {
+                LOGE("[MqttHandler][handleConfig] Invalid status encoding: %s", status_encoding.c_str());
+                sendMqttStatus(COMMAND_STATUS::ERROR,
+                               "Invalid status encoding, use json or msgpack.");
+                return;
+            }
+
+            config.telemetry_encoding = encodingName(telemetryFormat);
+            config.telemetry_interval = telemetry_interval;
+            config.status_encoding = encodingName(statusFormat);
+            config.save();
+
+            Telemetry::getInstance().configure(telemetryFormat, telemetry_interval);
+            statusEncoding = statusFormat;
+            sendMqttStatus(COMMAND_STATUS::OK,
+                           "Telemetry " + config.telemetry_encoding + " every " + String(telemetry_interval) +
+                           " ms, status " + config.status_encoding);
+            return;
+        }
+
         // MQTT
         String mqtt_broker      = doc[CONFIG::MQTT_TOPIC_CONFIG_BROKER]     | "";
         uint16_t mqtt_port      = doc[CONFIG::MQTT_TOPIC_CONFIG_PORT]       | CONFIG::MQTT_PORT;
@@ -214,14 +603,270 @@ private:
         ESP.restart();
     }
 
+    /**
+     * @brief Handle an asset operation of the config topic.
+     * - {"op":"begin","name":"loop1","type":"sequence","v":2,"len":96,"rs":8,"crc":305419896}
+     *   starts an upload, the data follows on the asset topic.
+     * - {"op":"commit"} activates the uploaded asset, {"op":"abort"} drops it.
+     * - {"op":"remove","name":"loop1"} removes an asset.
+     * - {"op":"list","from":0} lists the assets from index "from" (default 0),
+     *   CONFIG::ASSET_LIST_PAGE_SIZE per status; "next" is set if more follow.
+     * @param asset Object with the operation.
+     */
+    void handleAssetConfig(JsonVariant asset) {
+        AssetStore& assets = AssetStore::getInstance();
+        String op = asset["op"] | "";
+        String error;
+
+        if (op == "begin") {
+            String name = asset["name"] | "";
+            String typeName = asset["type"] | ASSET::RAW;
+            uint8_t type = ASSET::TYPE_COUNT;
+            for (uint8_t t = 0; t < ASSET::TYPE_COUNT; t++) {
+                if (typeName.equalsIgnoreCase(assetTypeName(t))) type = t;
+            }
+            uint16_t version    = asset["v"]   | 0;
+            uint16_t recordSize = asset["rs"]  | 0;
+            uint32_t length     = asset["len"] | 0;
+            uint32_t crc        = asset["crc"] | 0;
+            if (assets.beginUpdate(name.c_str(), type, version, recordSize, length, crc, error)) {
+                sendMqttStatus(COMMAND_STATUS::OK, "Asset upload started: " + name);
+                return;
+            }
+        } else if (op == "commit") {
+            if (assets.commitUpdate(error)) {
+                sendMqttStatus(COMMAND_STATUS::OK, "Asset stored, generation " + String(assets.generation()));
+                return;
+            }
+        } else if (op == "abort") {
+            assets.abortUpdate();
+            sendMqttStatus(COMMAND_STATUS::OK, "Asset upload aborted");
+            return;
+        } else if (op == "remove") {
+            String name = asset["name"] | "";
+            if (assets.removeAsset(name.c_str(), error)) {
+                sendMqttStatus(COMMAND_STATUS::OK, "Asset removed: " + name);
+                return;
+            }
+        } else if (op == "list") {
+            // One page of entries per status, "next" is the first entry of the next page
+            uint16_t from = asset["from"] | 0;
+            DynamicJsonDocument doc(256 + CONFIG::ASSET_LIST_PAGE_SIZE * 96);
+            doc["gen"] = assets.generation();
+            doc["used"] = assets.used();
+            doc["free"] = assets.capacity() - assets.used();
+            JsonArray list = doc.createNestedArray("assets");
+            AssetEntry entry;
+            uint16_t i = from;
+            for (; i < from + CONFIG::ASSET_LIST_PAGE_SIZE && assets.entryAt(i, entry); i++) {
+                JsonObject a = list.createNestedObject();
+                a["name"] = String(entry.name);
+                a["type"] = assetTypeName(entry.type);
+                a["v"] = entry.version;
+                a["len"] = entry.length;
+                a["rs"] = entry.recordSize;
+            }
+            if (assets.entryAt(i, entry)) doc["next"] = i;
+            String json;
+            serializeJson(doc, json);
+            sendMqttStatus(COMMAND_STATUS::OK, json);
+            return;
+        } else {
+            error = "Unknown asset operation: " + op;
+        }
+
+        LOGE("[MqttHandler][handleAssetConfig] %s failed: %s", op.c_str(), error.c_str());
+        sendMqttStatus(COMMAND_STATUS::ERROR, error);
+    }
+
+    /**
+     * @brief Write an asset chunk, offset (u32 little-endian) followed by the data.
+     * Only failures are reported, so the upload is not slowed down by status messages.
+     * @param payload Chunk.
+     * @param length Chunk length.
+     */
+    void handleAssetChunk(const byte* payload, unsigned int length) {
+        if (length < 4) {
+            sendMqttStatus(COMMAND_STATUS::ERROR, "Asset chunk too short");
+            return;
+        }
+        uint32_t offset = payload[0] | (payload[1] << 8) | (payload[2] << 16) | (static_cast<uint32_t>(payload[3]) << 24);
+        if (!AssetStore::getInstance().writeUpdate(offset, payload + 4, length - 4)) {
+            LOGE("[MqttHandler][handleAssetChunk] Chunk at %u rejected", offset);
+            sendMqttStatus(COMMAND_STATUS::ERROR,
+                           "Asset chunk at " + String(offset) + " rejected, expected " +
+                           String(AssetStore::getInstance().updateReceived()));
+        }
+    }
+
+#ifdef PROFILER
+    /**
+     * @brief Handle a profiler operation of the config topic.
+     * - {"op":"start","hz":997,"duration_ms":10000,"cores":3} clears the histogram and starts sampling.
+     * - {"op":"stop"} stops sampling, {"op":"clear"} releases the histogram.
+     * - {"op":"dump"} stops sampling and publishes the histogram on the profile topic.
+     * - {"op":"status"} returns the sample counts.
+     * @param profile Object with the operation.
+     */
+    void handleProfileConfig(JsonVariant profile) {
+        Profiler& profiler = Profiler::getInstance();
+        String op = profile["op"] | "status";
+
+        if (op == "start") {
+            uint32_t hz         = profile["hz"]          | CONFIG::PROFILER_HZ;
+            uint32_t durationMs = profile["duration_ms"] | CONFIG::PROFILER_DURATION_MS;
+            uint8_t cores       = profile["cores"]       | CONFIG::PROFILER_CORES;
+            String error;
+            if (!profiler.start(hz, durationMs, cores, error)) {
+                sendMqttStatus(COMMAND_STATUS::ERROR, error);
+                return;
+            }
+        } else if (op == "stop") {
+            profiler.stop();
+        } else if (op == "clear") {
+            profiler.clear();
+        } else if (op == "dump") {
+            profiler.stop();
+            // The status buffer is free until the status below is sent
+            uint8_t* buffer = reinterpret_cast<uint8_t*>(statusBuffer);
+            size_t messages = 0;
+            for (uint8_t core = 0; core < portNUM_PROCESSORS; core++) {
+                size_t slot = 0;
+                size_t length;
+                while ((length = profiler.encode(core, slot, buffer, sizeof(statusBuffer))) > 0) {
+                    if (!publish(profileTopic, buffer, length)) {
+                        sendMqttStatus(COMMAND_STATUS::ERROR, "Failed to publish the profile");
+                        return;
+                    }
+                    messages++;
+                }
+            }
+            sendMqttStatus(COMMAND_STATUS::OK, "Profile sent: " + String(messages) + " messages");
+            return;
+        } else if (op != "status") {
+            sendMqttStatus(COMMAND_STATUS::ERROR, "Unknown profile operation: " + op);
+            return;
+        }
+        sendMqttStatus(COMMAND_STATUS::OK, profiler.statusJson());
+    }
+#endif
+
+#ifdef SIMULATED_HUBS
+    /**
+     * @brief Set the link of all or one simulated hub, or drop all simulated links.
+     * @param sim Object with optional mac, latency_ms, jitter_ms, loss_pct, connect_ms, disconnect_all.
+     */
+    void handleSimConfig(JsonVariant sim) {
+        String mac = sim["mac"] | "";
+        bool disconnectAll = sim["disconnect_all"] | false;
+        size_t count = 0;
+
+        auto apply = [&](SimulatedLink& link) {
+            link.latencyMs = sim["latency_ms"] | link.latencyMs;
+            link.jitterMs  = sim["jitter_ms"]  | link.jitterMs;
+            link.lossPct   = sim["loss_pct"]   | link.lossPct;
+            link.connectMs = sim["connect_ms"] | link.connectMs;
+        };
+        if (mac.isEmpty()) apply(SimulatedController::defaultLink());
+
+        ControllerRegistry::getInstance().forEach([&](const String& key, BLEController* ctrl) {
+            if (ctrl->getTypeId() != SIMHUB::TYPE_ID) return;
+            if (!mac.isEmpty() && !mac.equalsIgnoreCase(ctrl->getMacAddress())) return;
+
+            SimulatedController* hub = static_cast<SimulatedController*>(ctrl);
+            SimulatedLink link = hub->getLink();
+            apply(link);
+            hub->setLink(link);
+            if (disconnectAll) hub->disconnect();
+            count++;
+        });
+
+        LOGI("[MqttHandler][handleSimConfig] Updated %u simulated hubs", static_cast<unsigned>(count));
+        sendMqttStatus(COMMAND_STATUS::OK, "Simulated hubs updated: " + String(count));
+    }
+#endif
+
+    /**
+     * @brief Publish a loopback probe to the upstream broker: sequence number and publish time.
+     * @param now Current time in ms.
+     */
+    void sendProbe(uint32_t now) {
+        probeSeq++;
+        probeSentMs = now;
+        probeMode = metrics.powerSaveMode();
+        probePending = true;
+
+        uint8_t payload[8];
+        for (uint8_t i = 0; i < 4; i++) {
+            payload[i] = (probeSeq >> (8 * i)) & 0xFF;
+            payload[4 + i] = (now >> (8 * i)) & 0xFF;
+        }
+#ifdef MQTT_V5
+        client.publish(probeTopic.c_str(), payload, sizeof(payload), false, nullptr, 0);
+#else
+        client.publish(probeTopic.c_str(), payload, sizeof(payload), false);
+#endif
+    }
+
+    /**
+     * @brief Record the receive delay of the last probe when it is received back.
+     * Older probes, e.g. delayed beyond the probe interval, are ignored.
+     * @param payload Probe payload.
+     * @param length Payload length.
+     */
+    void handleProbe(const byte* payload, unsigned int length) {
+        if (length != 8 || !probePending) return;
+        uint32_t seq = 0;
+        for (uint8_t i = 0; i < 4; i++) seq |= static_cast<uint32_t>(payload[i]) << (8 * i);
+        if (seq != probeSeq) return;
+
+        probePending = false;
+        metrics.recordProbeDelay(millis() - probeSentMs, probeMode);
+    }
+
+    /**
+     * @brief Publish the status JSON returned by handleCommand.
+     * @param msg JSON string with keys status and message.
+     * @param controllerKey Key (type|mac) of the addressed controller, empty if unknown.
+     * @param context Context of the command.
+     */
+    void sendCommandStatus(const String& msg, const String& controllerKey, const CommandContext& context) {
+        StaticJsonDocument<256> doc;
+        DeserializationError err = deserializeJson(doc, msg);
+        if (err) {
+            sendMqttStatus(COMMAND_STATUS::ERROR, "Failed to parse response JSON");
+            return;
+        }
+
+        String status  = doc["status"]  | COMMAND_STATUS::ERROR;
+        String message = doc["message"] | "Unknown error";
+
+        sendMqttStatus(status, message, controllerKey, context);
+    }
+
     /**
      * @brief Handle incoming MQTT message.
      * Converts payload to String and processes commands on the command topic.
      * @param topic Topic string of the received message
      * @param payload Pointer to payload bytes
      * @param length Length of the payload
+     * @param local true if published by a local client of the embedded broker
      */
-    void handleMessage(char* topic, byte* payload, unsigned int length) {
+    void handleMessage(const char* topic, const byte* payload, unsigned int length, bool local = false) {
+        // Loopback probes are not client messages, they do not count as receive gaps
+        if (probeTopic == topic) {
+            if (!local) handleProbe(payload, length);
+            return;
+        }
+
+        metrics.recordMqttReceive(millis());
+
+        // Asset chunks are binary, written without a copy
+        if (assetTopic == topic) {
+            handleAssetChunk(payload, length);
+            return;
+        }
+
         String payloadBuffer;
         for (unsigned int i = 0; i < length; i++) {
             payloadBuffer += (char)payload[i];
@@ -240,21 +885,20 @@ private:
         if (String(topic) == commandTopic) {
             LOGI("[MqttHandler][handleMessage] Processing command payload.");
 
-            // Handle the command which returns a JSON string status ok or error and the message
-            String msg = handleCommand(payloadBuffer);
-
-            StaticJsonDocument<256> doc;
-            DeserializationError err = deserializeJson(doc, msg);
-            if (err) {
-                sendMqttStatus(COMMAND_STATUS::ERROR, "Failed to parse response JSON");
-                return;
+            // Handle the command which returns a JSON string status ok or error and the message.
+            // An empty string means the command is queued and its status is sent later.
+            CommandContext context;
+            context.receivedMs = millis();
+#ifdef MQTT_V5
+            if (!local) context.correlationId = client.getUserProperty(USER_PROPERTY::CORRELATION_ID);
+#endif
+
+            String key;
+            String msg = handleCommand(payloadBuffer, context, &key);
+            if (!msg.isEmpty()) {
+                sendCommandStatus(msg, key, context);
             }
 
-            String status  = doc["status"]  | COMMAND_STATUS::ERROR;
-            String message = doc["message"] | "Unknown error";
-
-            sendMqttStatus(status, message);
-
             return;
         }
 
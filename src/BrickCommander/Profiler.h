@@ -0,0 +1,386 @@
+/**
+ * @file Profiler.h
+ *
+ * @brief Statistical sampling profiler, built if PROFILER is defined in Configuration.h.
+ *
+ * A hardware timer interrupt on each sampled core records the program counter
+ * of the interrupted task into a per-core histogram (PC → samples). Under real
+ * load the histogram shows where the CPU time goes, also in code without
+ * region timers: ArduinoJson, String operations, Serial logging, the BLE and
+ * WiFi stacks or the idle task.
+ *
+ * The interrupted PC is read from the exception frame the FreeRTOS port saves
+ * on the task stack when the interrupt is entered. Code running with
+ * interrupts disabled (critical sections, other interrupts) is sampled late,
+ * at the first instruction after interrupts are enabled again.
+ *
+ * The histogram is a hash table of CONFIG::PROFILER_SLOTS per core, allocated
+ * on start() and released by clear(); samples of PCs not fitting are counted
+ * as dropped. The CPU cycles spent in the interrupt per sample are reported
+ * as isr_cycles, the profiling overhead is isr_cycles × hz per second.
+ *
+ * Control via the config topic key "profile" or the terminal command "profile":
+ * {"profile":{"op":"start","hz":997,"duration_ms":10000,"cores":3}}
+ * {"profile":{"op":"dump"}}   Histogram on the profile topic, binary (see PROFILE in Constants.h)
+ * Terminal "profile dump" prints the histogram as text.
+ *
+ * tools/profiler.py downloads the histogram and symbolizes it against the ELF.
+ *
+ * Author: Robert W.B. Linn
+ * Copyright © 2025 Robert W.B. Linn
+ * License: MIT — see LICENSE file.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <new>
+#include <driver/gptimer.h>
+#include <esp_cpu.h>
+#if defined(__XTENSA__)
+#include <xtensa_context.h>
+#elif defined(__riscv)
+#include <riscv/rvruntime-frames.h>
+#endif
+#include "Log.h"
+#include "Configuration.h"
+#include "Constants.h"
+
+static_assert((CONFIG::PROFILER_SLOTS & (CONFIG::PROFILER_SLOTS - 1)) == 0, "PROFILER_SLOTS must be a power of 2");
+
+/**
+ * @brief Histogram slot, samples at one program counter.
+ */
+struct ProfileSlot {
+    uint32_t pc;
+    uint32_t count;     ///< 0 = slot free
+};
+
+/**
+ * @class Profiler
+ * @brief Singleton sampling the program counter of each core from a timer interrupt.
+ */
+class Profiler {
+public:
+    /**
+     * @brief Access the singleton instance.
+     */
+    static Profiler& getInstance() {
+        static Profiler instance;
+        return instance;
+    }
+
+    /**
+     * @brief Clear the histogram and start sampling.
+     * @param hz Samples per second and core, a prime avoids aliasing with the 1 kHz tick.
+     * @param durationMs Sampling stops after this time, 0 = until stop().
+     * @param coreMask Cores to sample, bit 0 = core 0.
+     * @param error Receives the reason if not started.
+     * @return true if sampling.
+     */
+    bool start(uint32_t hz, uint32_t durationMs, uint8_t coreMask, String& error) {
+        stop();
+        if (hz < 1 || hz > CONFIG::PROFILER_MAX_HZ) { error = "Rate must be 1…" + String(CONFIG::PROFILER_MAX_HZ) + " Hz"; return false; }
+        coreMask &= (1 << portNUM_PROCESSORS) - 1;
+        if (coreMask == 0) { error = "No core selected"; return false; }
+
+        hz_ = hz;
+        durationMs_ = durationMs;
+        for (uint8_t core = 0; core < portNUM_PROCESSORS; core++) {
+            Core& c = cores_[core];
+            c.samples = 0;
+            c.dropped = 0;
+            c.cycles = 0;
+            if (!(coreMask & (1 << core))) {
+                delete[] c.slots;   // No stale histogram of an earlier run
+                c.slots = nullptr;
+                continue;
+            }
+
+            if (!c.slots) c.slots = new (std::nothrow) ProfileSlot[CONFIG::PROFILER_SLOTS];
+            if (!c.slots) { error = "No memory for the histogram"; stop(); return false; }
+            memset(c.slots, 0, CONFIG::PROFILER_SLOTS * sizeof(ProfileSlot));
+
+            // The timer interrupt is allocated on the core that registers it
+            c.done = false;
+            if (xTaskCreatePinnedToCore(setupTask, "profiler", 3072, &c, configMAX_PRIORITIES - 1, nullptr, core) != pdPASS) {
+                error = "Setup task failed";
+                stop();
+                return false;
+            }
+            for (uint8_t wait = 0; !c.done && wait < 100; wait++) delay(1);
+            if (!c.done || c.result != ESP_OK) {
+                error = "Timer on core " + String(core) + " failed: " + esp_err_to_name(c.done ? c.result : ESP_ERR_TIMEOUT);
+                stop();
+                return false;
+            }
+        }
+
+        running_ = true;
+        startMs_ = millis();
+        LOGI("[Profiler][start] %u Hz, cores 0x%02x, %u ms", hz_, coreMask, durationMs_);
+        return true;
+    }
+
+    /**
+     * @brief Stop sampling, the histogram is kept.
+     */
+    void stop() {
+        for (Core& c : cores_) {
+            if (!c.timer) continue;
+            gptimer_stop(c.timer);
+            gptimer_disable(c.timer);
+            gptimer_del_timer(c.timer);
+            c.timer = nullptr;
+        }
+        if (running_) {
+            running_ = false;
+            LOGI("[Profiler][stop] %u samples, %u dropped", totalSamples(), totalDropped());
+        }
+    }
+
+    /**
+     * @brief Stop sampling and release the histogram memory.
+     */
+    void clear() {
+        stop();
+        for (Core& c : cores_) {
+            delete[] c.slots;
+            c.slots = nullptr;
+            c.samples = c.dropped = c.cycles = 0;
+        }
+    }
+
+    /**
+     * @brief Stop sampling when the duration has passed. Call from loop().
+     * @param nowMs Current time in ms.
+     */
+    void loop(uint32_t nowMs) {
+        if (running_ && durationMs_ > 0 && nowMs - startMs_ >= durationMs_) stop();
+    }
+
+    /**
+     * @brief Check if sampling.
+     */
+    bool isRunning() const {
+        return running_;
+    }
+
+    /**
+     * @brief Get the samples of all cores.
+     */
+    uint32_t totalSamples() const {
+        uint32_t total = 0;
+        for (const Core& c : cores_) total += c.samples;
+        return total;
+    }
+
+    /**
+     * @brief Get the dropped samples of all cores.
+     */
+    uint32_t totalDropped() const {
+        uint32_t total = 0;
+        for (const Core& c : cores_) total += c.dropped;
+        return total;
+    }
+
+    /**
+     * @brief Get the state as JSON, e.g.
+     * {"running":false,"hz":997,"cores":[{"core":0,"samples":9970,"dropped":0,"slots":214,"isr_cycles":96}]}
+     */
+    String statusJson() const {
+        String json = "{\"running\":" + String(running_ ? "true" : "false") + ",\"hz\":" + String(hz_) + ",\"cores\":[";
+        bool first = true;
+        for (uint8_t core = 0; core < portNUM_PROCESSORS; core++) {
+            const Core& c = cores_[core];
+            if (!c.slots) continue;
+            if (!first) json += ",";
+            first = false;
+            json += "{\"core\":" + String(core) +
+                    ",\"samples\":" + String(c.samples) +
+                    ",\"dropped\":" + String(c.dropped) +
+                    ",\"slots\":" + String(usedSlots(c)) +
+                    ",\"isr_cycles\":" + String(c.samples ? c.cycles / c.samples : 0) + "}";
+        }
+        json += "]}";
+        return json;
+    }
+
+    /**
+     * @brief Encode the next part of the histogram of a core into a message.
+     * Call with slot 0 and repeat while it returns a length; sampling should be stopped.
+     * @param core Core number.
+     * @param slot Next slot to encode, updated.
+     * @param buffer Destination.
+     * @param size Buffer size, at least PROFILE::HEADER_SIZE + PROFILE::RECORD_SIZE.
+     *             At most PROFILE::MAX_RECORDS records are encoded per message.
+     * @return Message length, 0 if the core has no more slots.
+     */
+    size_t encode(uint8_t core, size_t& slot, uint8_t* buffer, size_t size) const {
+        if (core >= portNUM_PROCESSORS || slot >= CONFIG::PROFILER_SLOTS) return 0;
+        const Core& c = cores_[core];
+        if (!c.slots) return 0;
+
+        size_t pos = PROFILE::HEADER_SIZE;
+        uint16_t records = 0;
+        for (; slot < CONFIG::PROFILER_SLOTS && records < PROFILE::MAX_RECORDS &&
+               pos + PROFILE::RECORD_SIZE <= size; slot++) {
+            const ProfileSlot& s = c.slots[slot];
+            if (s.count == 0) continue;
+            pos = putU32(buffer, pos, s.pc);
+            pos = putU32(buffer, pos, s.count);
+            records++;
+        }
+        // Skip the free slots at the end, so the last message is flagged
+        while (slot < CONFIG::PROFILER_SLOTS && c.slots[slot].count == 0) slot++;
+
+        buffer[0] = PROFILE::MAGIC;
+        buffer[1] = PROFILE::VERSION;
+        buffer[2] = core;
+        buffer[3] = slot >= CONFIG::PROFILER_SLOTS ? PROFILE::FLAG_LAST : 0;
+        buffer[4] = hz_ & 0xFF;
+        buffer[5] = hz_ >> 8;
+        buffer[6] = records & 0xFF;
+        buffer[7] = records >> 8;
+        putU32(buffer, 8, c.samples);
+        putU32(buffer, 12, c.dropped);
+        putU32(buffer, 16, c.samples ? c.cycles / c.samples : 0);
+        return pos;
+    }
+
+    /**
+     * @brief Print the histogram as text for tools/profiler.py:
+     * PROFILE <version> <hz>, then per core CORE <core> <samples> <dropped> <isr cycles>
+     * followed by lines <pc hex> <count>, and END.
+     */
+    void dump() const {
+        Serial.printf("PROFILE %u %u\n", PROFILE::VERSION, hz_);
+        for (uint8_t core = 0; core < portNUM_PROCESSORS; core++) {
+            const Core& c = cores_[core];
+            if (!c.slots) continue;
+            Serial.printf("CORE %u %u %u %u\n", core, c.samples, c.dropped, c.samples ? c.cycles / c.samples : 0);
+            for (size_t i = 0; i < CONFIG::PROFILER_SLOTS; i++) {
+                if (c.slots[i].count) Serial.printf("%08x %u\n", c.slots[i].pc, c.slots[i].count);
+            }
+        }
+        Serial.println("END");
+    }
+
+private:
+    /**
+     * @brief Timer and histogram of one core.
+     */
+    struct Core {
+        gptimer_handle_t timer = nullptr;
+        ProfileSlot* slots = nullptr;
+        volatile uint32_t samples = 0;
+        volatile uint32_t dropped = 0;              ///< PC did not fit the histogram
+        volatile uint32_t cycles = 0;               ///< CPU cycles spent in the interrupt
+        volatile bool done = false;                 ///< Setup task finished
+        volatile esp_err_t result = ESP_OK;         ///< Setup task result
+    };
+
+    static constexpr uint32_t TIMER_RESOLUTION_HZ = 1000000;   ///< 1 µs ticks
+    static constexpr uint8_t  MAX_PROBES = 8;                  ///< Slots tried per sample
+
+    Core cores_[portNUM_PROCESSORS];
+    uint32_t hz_ = CONFIG::PROFILER_HZ;
+    uint32_t durationMs_ = 0;
+    uint32_t startMs_ = 0;
+    bool running_ = false;
+
+    /**
+     * @brief Create and start the sampling timer, runs pinned to the sampled core.
+     */
+    static void setupTask(void* arg) {
+        Core& c = *static_cast<Core*>(arg);
+
+        gptimer_config_t config = {};
+        config.clk_src = GPTIMER_CLK_SRC_DEFAULT;
+        config.direction = GPTIMER_COUNT_UP;
+        config.resolution_hz = TIMER_RESOLUTION_HZ;
+
+        gptimer_event_callbacks_t callbacks = {};
+        callbacks.on_alarm = onAlarm;
+
+        gptimer_alarm_config_t alarm = {};
+        alarm.alarm_count = TIMER_RESOLUTION_HZ / getInstance().hz_;
+        alarm.reload_count = 0;
+        alarm.flags.auto_reload_on_alarm = 1;
+
+        esp_err_t err = gptimer_new_timer(&config, &c.timer);
+        if (err == ESP_OK) err = gptimer_register_event_callbacks(c.timer, &callbacks, &c);
+        if (err == ESP_OK) err = gptimer_set_alarm_action(c.timer, &alarm);
+        if (err == ESP_OK) err = gptimer_enable(c.timer);
+        if (err == ESP_OK) err = gptimer_start(c.timer);
+        if (err != ESP_OK && c.timer) {
+            gptimer_del_timer(c.timer);
+            c.timer = nullptr;
+        }
+
+        c.result = err;
+        c.done = true;
+        vTaskDelete(nullptr);
+    }
+
+    /**
+     * @brief Get the program counter of the task interrupted on this core.
+     * On interrupt entry the port stores the stack pointer of the interrupted
+     * task, which points at its exception frame, in the first TCB field.
+     */
+    static inline uint32_t IRAM_ATTR interruptedPc() {
+        void* frame = *static_cast<void**>(xTaskGetCurrentTaskHandle());
+#if defined(__XTENSA__)
+        return static_cast<const XtExcFrame*>(frame)->pc;
+#elif defined(__riscv)
+        return static_cast<const RvExcFrame*>(frame)->mepc;
+#else
+        return reinterpret_cast<uintptr_t>(frame);  // Architecture without known frame layout
+#endif
+    }
+
+    /**
+     * @brief Timer interrupt: count the interrupted PC in the histogram of the core.
+     */
+    static bool IRAM_ATTR onAlarm(gptimer_handle_t, const gptimer_alarm_event_data_t*, void* arg) {
+        uint32_t startCycles = esp_cpu_get_cycle_count();
+        Core& c = *static_cast<Core*>(arg);
+        uint32_t pc = interruptedPc();
+
+        uint32_t hash = ((pc >> 1) * 2654435761u) >> 8;    // Multiplicative hash, instructions are 2 or 3 bytes
+        bool counted = false;
+        for (uint8_t probe = 0; probe < MAX_PROBES && !counted; probe++) {
+            ProfileSlot& s = c.slots[(hash + probe) & (CONFIG::PROFILER_SLOTS - 1)];
+            if (s.count == 0) {
+                s.pc = pc;
+                s.count = 1;
+                counted = true;
+            } else if (s.pc == pc) {
+                s.count++;
+                counted = true;
+            }
+        }
+        if (!counted) c.dropped++;
+        c.samples++;
+        c.cycles += esp_cpu_get_cycle_count() - startCycles;
+        return false;   // No task woken
+    }
+
+    static size_t usedSlots(const Core& c) {
+        size_t used = 0;
+        for (size_t i = 0; i < CONFIG::PROFILER_SLOTS; i++) {
+            if (c.slots[i].count) used++;
+        }
+        return used;
+    }
+
+    static size_t putU32(uint8_t* buffer, size_t pos, uint32_t value) {
+        for (uint8_t i = 0; i < 4; i++) buffer[pos++] = (value >> (8 * i)) & 0xFF;
+        return pos;
+    }
+
+    // Singleton: private constructor and deleted copy operations
+    Profiler() {}
+    Profiler(const Profiler&) = delete;
+    Profiler& operator=(const Profiler&) = delete;
+};
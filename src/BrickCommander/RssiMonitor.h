@@ -0,0 +1,85 @@
+/**
+ * @file RssiMonitor.h
+ *
+ * @brief Periodic BLE RSSI reading of the connected hubs.
+ *
+ * Every CONFIG::BLE_RSSI_POLL_MS the RSSI of one connected hub is requested
+ * with esp_ble_gap_read_rssi(), round-robin over the HubStateStore handles.
+ * The result arrives in a custom GAP event handler on the BLE task, which
+ * writes it to the store. The value is published with the telemetry.
+ *
+ * Simulated hubs have no BLE link and set their RSSI themselves.
+ *
+ * Author: Robert W.B. Linn
+ * Copyright © 2025 Robert W.B. Linn
+ * License: MIT — see LICENSE file.
+ */
+
+#pragma once
+
+#include <BLEDevice.h>
+#include <esp_gap_ble_api.h>
+#include "Log.h"
+#include "Configuration.h"
+#include "Constants.h"
+#include "HubStateStore.h"
+
+/**
+ * @class RssiMonitor
+ * @brief Singleton polling the RSSI of the connected hubs one at a time.
+ */
+class RssiMonitor {
+public:
+    /**
+     * @brief Access the singleton instance.
+     */
+    static RssiMonitor& getInstance() {
+        static RssiMonitor instance;
+        return instance;
+    }
+
+    /**
+     * @brief Request the RSSI of the next connected hub if due. Call from the main loop.
+     * @param nowMs Current time in ms.
+     */
+    void loop(uint32_t nowMs) {
+        if (nowMs - lastMs_ < CONFIG::BLE_RSSI_POLL_MS) return;
+        lastMs_ = nowMs;
+
+        HubStateStore& hubs = HubStateStore::getInstance();
+        for (uint8_t i = 0; i < HubStateStore::MAX_HUBS; i++) {
+            next_ = (next_ + 1) % HubStateStore::MAX_HUBS;
+            if (!hubs.isConnected(next_) || hubs.type(next_) == SIMHUB::TYPE_ID) continue;
+
+            esp_bd_addr_t addr;
+            memcpy(addr, hubs.mac(next_), sizeof(addr));
+            if (esp_ble_gap_read_rssi(addr) != 0) {
+                LOGW("[RssiMonitor][loop] RSSI request for hub %u failed", next_);
+            }
+            return;
+        }
+    }
+
+private:
+    uint32_t lastMs_ = 0;                           ///< Time of the last request
+    HubHandle next_ = HubStateStore::MAX_HUBS - 1;  ///< Last polled handle
+
+    /**
+     * @brief GAP event handler on the BLE task, stores the RSSI of the hub.
+     */
+    static void gapEventHandler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t* param) {
+        if (event != ESP_GAP_BLE_READ_RSSI_COMPLETE_EVT) return;
+        if (param->read_rssi_cmpl.status != ESP_BT_STATUS_SUCCESS) return;
+
+        HubStateStore& hubs = HubStateStore::getInstance();
+        HubHandle h = hubs.findByMac(param->read_rssi_cmpl.remote_addr);
+        if (h != INVALID_HUB) hubs.setRssi(h, param->read_rssi_cmpl.rssi);
+    }
+
+    // Singleton: private constructor and deleted copy operations
+    RssiMonitor() {
+        BLEDevice::setCustomGapHandler(gapEventHandler);
+    }
+    RssiMonitor(const RssiMonitor&) = delete;
+    RssiMonitor& operator=(const RssiMonitor&) = delete;
+};
@@ -13,6 +13,11 @@
 #pragma once
 
 #include "ControllerRegistry.h"
+#include "ConnectionAdmission.h"
+#include "Backpressure.h"
+#include "GattWriter.h"
+#include "HubStateStore.h"
+#include "BleStack.h"
 #include "Log.h"
 
 /**
@@ -21,7 +26,13 @@
  * Call this at program exit or when WiFi/BLE failure detected.
  */
 inline void shutdownBrickCommander() {
-    LOGI("[Shutdown][shutdownBrickCommander] Cleaning up all controllers …");
+    HubStateStore& hubs = HubStateStore::getInstance();
+    LOGI("[Shutdown][shutdownBrickCommander] Cleaning up all controllers (%u, %u connected) …",
+         hubs.count(), hubs.connectedCount());
+    ConnectionAdmission::getInstance().clear();
+    Backpressure::getInstance().clear();
+    GattWriter::getInstance().clear();
     ControllerRegistry::getInstance().clear();
+    BleStack::getInstance().release();
     LOGI("[Shutdown][shutdownBrickCommander] Done.");
 }
@@ -0,0 +1,156 @@
+/**
+ * @file SimulatedController.h
+ *
+ * @brief Simulated hub without BLE, for benchmarks of the full commander.
+ *
+ * Only built if SIMULATED_HUBS is defined in Configuration.h. Commands with
+ * "controller":"simhub" and any MAC address create a simulated hub, which
+ * runs through the same pipeline as a real hub: ConnectionAdmission,
+ * GattWriter completions, backpressure, telemetry and metrics.
+ *
+ * - connect() blocks for the connect time, like BLEClient::connect(), and
+ *   fails with the loss probability.
+ * - setPortLevelAsync() completes after the write latency plus a random
+ *   jitter; a lost write completes as TIMEOUT after CONFIG::GATT_WRITE_TIMEOUT_MS.
+ *
+ * Latency, jitter, loss and connect time are set for all or a single
+ * simulated hub via the config topic, e.g.:
+ * {"sim":{"latency_ms":30,"jitter_ms":10,"loss_pct":2,"connect_ms":800}}
+ * {"sim":{"mac":"02:00:00:00:00:01","latency_ms":120}}
+ * {"sim":{"disconnect_all":true}}
+ *
+ * Author: Robert W.B. Linn
+ * Copyright © 2025 Robert W.B. Linn
+ * License: MIT — see LICENSE file.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include "Log.h"
+#include "Configuration.h"
+#include "Constants.h"
+#include "BLEController.h"
+#include "GattWriter.h"
+
+/**
+ * @brief Link behaviour of a simulated hub.
+ */
+struct SimulatedLink {
+    uint32_t latencyMs = CONFIG::SIM_LATENCY_MS;    ///< Write round-trip time
+    uint32_t jitterMs  = CONFIG::SIM_JITTER_MS;     ///< Random extra round-trip time, 0…jitter
+    uint8_t  lossPct   = CONFIG::SIM_LOSS_PCT;      ///< Probability of a lost write or failed connect
+    uint32_t connectMs = CONFIG::SIM_CONNECT_MS;    ///< Duration of a connect attempt
+};
+
+/**
+ * @class SimulatedController
+ * @brief BLEController with simulated latency and loss.
+ */
+class SimulatedController : public BLEController {
+public:
+    /**
+     * @brief Construct a simulated hub with the default link.
+     * @param mac MAC address used as identity.
+     */
+    explicit SimulatedController(const String& mac)
+        : BLEController(SIMHUB::TYPE_ID, SIMHUB::PORT_COUNT, mac),
+          macAddress_(mac), link_(defaultLink()) {}
+
+    /**
+     * @brief Link used by simulated hubs created from now on.
+     */
+    static SimulatedLink& defaultLink() {
+        static SimulatedLink link;
+        return link;
+    }
+
+    /**
+     * @brief Set the link behaviour of this hub.
+     */
+    void setLink(const SimulatedLink& link) {
+        link_ = link;
+    }
+
+    /**
+     * @brief Get the link behaviour of this hub.
+     */
+    const SimulatedLink& getLink() const {
+        return link_;
+    }
+
+    /**
+     * @brief Simulate a connect attempt, blocks for the connect time.
+     * @return false with the loss probability.
+     */
+    bool connect() override {
+        delay(link_.connectMs);
+        bool connected = !lost();
+        hubs().setLink(handle_, connected ? HubStateStore::LINK_AWAKE : HubStateStore::LINK_DISCONNECTED);
+        if (connected) hubs().setRssi(handle_, -50 - static_cast<int8_t>(random(30)));
+        LOGI("[SimulatedController][connect] %s %s", macAddress_.c_str(), connected ? "connected" : "failed");
+        return connected;
+    }
+
+    /**
+     * @brief Drop the simulated link.
+     */
+    void disconnect() override {
+        hubs().setLink(handle_, HubStateStore::LINK_DISCONNECTED);
+    }
+
+    /**
+     * @brief Set a port level, returns at once.
+     */
+    void setPortLevel(uint8_t port, int8_t level) override {
+        hubs().setAppliedLevel(handle_, port, level);
+    }
+
+    /**
+     * @brief Simulate an asynchronous write with latency, jitter and loss.
+     * @param port Port number (0–3).
+     * @param level Raw power level (-127…127).
+     * @param callback Completion callback with status and round-trip time.
+     * @return Handle of the write.
+     */
+    uint32_t setPortLevelAsync(uint8_t port, int8_t level, WriteCallback callback) override {
+        GattWriter& writer = GattWriter::getInstance();
+        if (port >= SIMHUB::PORT_COUNT) {
+            return writer.completeLater(callback, WriteStatus::INVALID);
+        }
+        if (!isConnected()) {
+            return writer.completeLater(callback, WriteStatus::NOT_CONNECTED);
+        }
+        if (lost()) {
+            return writer.completeLater(callback, WriteStatus::TIMEOUT,
+                                        CONFIG::GATT_WRITE_TIMEOUT_MS * 1000UL, CONFIG::GATT_WRITE_TIMEOUT_MS);
+        }
+
+        uint32_t rttMs = link_.latencyMs + (link_.jitterMs ? random(link_.jitterMs + 1) : 0);
+        return writer.completeLater(callback, WriteStatus::OK, rttMs * 1000UL, rttMs);
+    }
+
+    String getMacAddress() const override {
+        return macAddress_;
+    }
+
+    uint8_t getTypeId() const override {
+        return SIMHUB::TYPE_ID;
+    }
+
+    String getStateJson() override {
+        String json = "{";
+        json += "\"device\":\"" + String(SIMHUB::NAME) + "\",";
+        json += "\"connected\":" + String(isConnected() ? "true" : "false");
+        json += "}";
+        return json;
+    }
+
+private:
+    String macAddress_;                         ///< Identity of the simulated hub
+    SimulatedLink link_;                        ///< Latency, jitter, loss, connect time
+
+    bool lost() const {
+        return link_.lossPct > 0 && random(100) < link_.lossPct;
+    }
+};
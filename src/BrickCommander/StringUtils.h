@@ -86,6 +86,21 @@ namespace StringUtils {
         return result;
     }
 
+    /**
+    * @brief Check if a C-string is a MAC address "90:84:2B:C1:94:79" (hex digits in any case).
+    * 
+    * @param str Input C-string.
+    * @return true if six colon-separated hex byte pairs.
+    */
+    inline bool isMacAddress(const char* str) {
+        for (uint8_t i = 0; i < 17; i++) {
+            char c = str[i];
+            bool ok = (i % 3 == 2) ? (c == ':') : isxdigit(static_cast<unsigned char>(c));
+            if (!ok) return false;
+        }
+        return str[17] == '\0';
+    }
+
     /**
     * @brief Formats a status + message JSON string.
     *
@@ -0,0 +1,251 @@
+/**
+ * @file Telemetry.h
+ *
+ * @brief Periodic telemetry of all controllers in a selectable encoding.
+ *
+ * Encodings (see ENCODING in Constants.h):
+ * - json     JSON text, built with ArduinoJson into a reused document.
+ * - msgpack  MessagePack with the same structure as the JSON.
+ * - fixed    Fixed binary schema (see TELEMETRY in Constants.h), written
+ *            directly into the buffer without a document. 20 bytes per
+ *            controller instead of about 120 bytes JSON.
+ *
+ * JSON / MessagePack structure:
+ * {"v":2,"t":123456,"rssi":-61,"heap":182340,
+ *  "c":[{"mac":"90:84:2B:C1:94:79","type":1,"conn":true,"awake":false,"bat":0,"q":0,
+ *        "rssi":-70,"set":[63,0,0,0],"lvl":[63,0,0,0]}]}
+ *
+ * - t     Uptime in ms.
+ * - type  Controller type id (LEGOHUBNO4::TYPE_ID, BUWIZZ2::TYPE_ID).
+ * - bat   Battery voltage in mV, 0 if not reported by the controller.
+ * - q     Commands queued waiting for the connection.
+ * - rssi  BLE RSSI of the hub in dBm, 0 if not measured yet.
+ * - set   Port levels requested, lvl port levels acknowledged by the hub.
+ *
+ * The values are read from the HubStateStore in handle order.
+ * At most CONFIG::TELEMETRY_CONTROLLERS_PER_MESSAGE controllers are sent per
+ * message, larger installations are split over several messages.
+ * The host decoder tools/brickcodec.py detects the encoding from the first byte.
+ *
+ * Author: Robert W.B. Linn
+ * Copyright © 2025 Robert W.B. Linn
+ * License: MIT — see LICENSE file.
+ */
+
+#pragma once
+
+#include <functional>
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "Log.h"
+#include "Configuration.h"
+#include "Constants.h"
+#include "Metrics.h"
+#include "HubStateStore.h"
+
+/**
+ * @class Telemetry
+ * @brief Singleton collecting the controller telemetry and encoding it into messages.
+ */
+class Telemetry {
+public:
+    /**
+     * @brief Sends one encoded message, returns true if published.
+     */
+    using SendHandler = std::function<bool(const uint8_t* data, size_t length)>;
+
+    /**
+     * @brief Access the singleton instance.
+     */
+    static Telemetry& getInstance() {
+        static Telemetry instance;
+        return instance;
+    }
+
+    /**
+     * @brief Convert an encoding config name to its format.
+     * @param name Encoding name, e.g. "msgpack" (case-insensitive).
+     * @return ENCODING::Format or -1 if unknown.
+     */
+    static int8_t parseEncoding(String name) {
+        name.toLowerCase();
+        for (uint8_t format = 0; format < ENCODING::FORMAT_COUNT; format++) {
+            if (name == encodingName(format)) return format;
+        }
+        return -1;
+    }
+
+    /**
+     * @brief Set the encoding and publish interval.
+     * @param encoding ENCODING::Format.
+     * @param intervalMs Publish interval in ms, 0 = off.
+     */
+    void configure(uint8_t encoding, uint32_t intervalMs) {
+        encoding_ = (encoding < ENCODING::FORMAT_COUNT) ? encoding : ENCODING::FORMAT_JSON;
+        intervalMs_ = intervalMs;
+        LOGI("[Telemetry][configure] encoding=%s interval=%u ms", encodingName(encoding_), intervalMs_);
+    }
+
+    /**
+     * @brief Get the active encoding (ENCODING::Format).
+     */
+    uint8_t getEncoding() const {
+        return encoding_;
+    }
+
+    /**
+     * @brief Check if the telemetry is due to be published.
+     * @param nowMs Current time in ms.
+     */
+    bool isDue(uint32_t nowMs) const {
+        return intervalMs_ > 0 && nowMs - lastMs_ >= intervalMs_;
+    }
+
+    /**
+     * @brief Encode the telemetry of all controllers and send it.
+     * @param nowMs Current time in ms.
+     * @param wifiRssi WiFi RSSI in dBm.
+     * @param send Handler publishing one message.
+     * @return Number of messages sent.
+     */
+    size_t publish(uint32_t nowMs, int8_t wifiRssi, const SendHandler& send) {
+        lastMs_ = nowMs;
+
+        // Handles of all hubs, in handle order
+        HubHandle handles[HubStateStore::MAX_HUBS];
+        size_t total = 0;
+        HubStateStore::getInstance().forEach([&](HubHandle h) { handles[total++] = h; });
+
+        size_t sent = 0;
+        size_t index = 0;
+        do {
+            size_t count = total - index;
+            if (count > CONFIG::TELEMETRY_CONTROLLERS_PER_MESSAGE) count = CONFIG::TELEMETRY_CONTROLLERS_PER_MESSAGE;
+
+            uint32_t startUs = micros();
+            size_t length = (encoding_ == ENCODING::FORMAT_FIXED)
+                ? encodeFixed(&handles[index], count, nowMs, wifiRssi)
+                : encodeDocument(&handles[index], count, nowMs, wifiRssi);
+            metrics.recordTelemetry(encoding_, length, micros() - startUs);
+
+            if (length == 0) {
+                LOGE("[Telemetry][publish] Encoding %s failed", encodingName(encoding_));
+                break;
+            }
+            if (send(buffer_, length)) {
+                sent++;
+            } else {
+                LOGE("[Telemetry][publish] Failed to send %u bytes", static_cast<unsigned>(length));
+            }
+            index += count;
+        } while (index < total);
+
+        return sent;
+    }
+
+private:
+    static constexpr size_t JSON_CAPACITY =
+        JSON_OBJECT_SIZE(5) +
+        JSON_ARRAY_SIZE(CONFIG::TELEMETRY_CONTROLLERS_PER_MESSAGE) +
+        CONFIG::TELEMETRY_CONTROLLERS_PER_MESSAGE * (JSON_OBJECT_SIZE(9) + 2 * JSON_ARRAY_SIZE(HubStateStore::MAX_PORTS));
+
+    DynamicJsonDocument doc_{JSON_CAPACITY};        ///< Reused between publishes
+    char macText_[CONFIG::TELEMETRY_CONTROLLERS_PER_MESSAGE][18];  ///< MAC strings referenced by doc_
+    uint8_t buffer_[CONFIG::MQTT_BUFFER_SIZE];      ///< Encoded message
+    uint8_t encoding_ = ENCODING::FORMAT_JSON;      ///< Active encoding
+    uint32_t intervalMs_ = 0;                       ///< Publish interval, 0 = off
+    uint32_t lastMs_ = 0;                           ///< Time of the last publish
+
+    /**
+     * @brief Get the TELEMETRY::FLAG_* of a hub.
+     */
+    static uint8_t flags(const HubStateStore& hubs, HubHandle h) {
+        uint8_t f = 0;
+        if (hubs.isConnected(h)) f |= TELEMETRY::FLAG_CONNECTED;
+        if (hubs.isAwake(h))     f |= TELEMETRY::FLAG_AWAKE;
+        if (hubs.queued(h) > 0)  f |= TELEMETRY::FLAG_QUEUED;
+        if (hubs.isPending(h))   f |= TELEMETRY::FLAG_PENDING;
+        return f;
+    }
+
+    /**
+     * @brief Encode hubs into the fixed binary schema.
+     * @return Message length.
+     */
+    size_t encodeFixed(const HubHandle* handles, size_t count, uint32_t nowMs, int8_t wifiRssi) {
+        const HubStateStore& hubs = HubStateStore::getInstance();
+        size_t pos = 0;
+        buffer_[pos++] = TELEMETRY::MAGIC;
+        buffer_[pos++] = TELEMETRY::VERSION;
+        buffer_[pos++] = static_cast<uint8_t>(count);
+        buffer_[pos++] = static_cast<uint8_t>(wifiRssi);
+        pos = putU32(pos, nowMs);
+        pos = putU32(pos, ESP.getFreeHeap());
+
+        for (size_t i = 0; i < count; i++) {
+            HubHandle h = handles[i];
+            memcpy(&buffer_[pos], hubs.mac(h), 6);
+            pos += 6;
+            buffer_[pos++] = hubs.type(h);
+            buffer_[pos++] = flags(hubs, h);
+            uint16_t mv = hubs.batteryMv(h);
+            buffer_[pos++] = mv & 0xFF;
+            buffer_[pos++] = mv >> 8;
+            buffer_[pos++] = hubs.queued(h);
+            buffer_[pos++] = static_cast<uint8_t>(hubs.rssi(h));
+            for (uint8_t p = 0; p < HubStateStore::MAX_PORTS; p++) buffer_[pos++] = static_cast<uint8_t>(hubs.desiredLevel(h, p));
+            for (uint8_t p = 0; p < HubStateStore::MAX_PORTS; p++) buffer_[pos++] = static_cast<uint8_t>(hubs.appliedLevel(h, p));
+        }
+        return pos;
+    }
+
+    /**
+     * @brief Encode hubs as JSON or MessagePack.
+     * @return Message length, 0 if the document or buffer overflowed.
+     */
+    size_t encodeDocument(const HubHandle* handles, size_t count, uint32_t nowMs, int8_t wifiRssi) {
+        const HubStateStore& hubs = HubStateStore::getInstance();
+        doc_.clear();
+        doc_["v"] = TELEMETRY::VERSION;
+        doc_["t"] = nowMs;
+        doc_["rssi"] = wifiRssi;
+        doc_["heap"] = ESP.getFreeHeap();
+
+        JsonArray ctrls = doc_.createNestedArray("c");
+        for (size_t i = 0; i < count; i++) {
+            HubHandle h = handles[i];
+            uint8_t f = flags(hubs, h);
+            hubs.macText(h, macText_[i]);
+
+            JsonObject c = ctrls.createNestedObject();
+            c["mac"] = static_cast<const char*>(macText_[i]);  // stored by pointer, outlives the document use
+            c["type"] = hubs.type(h);
+            c["conn"] = (f & TELEMETRY::FLAG_CONNECTED) != 0;
+            c["awake"] = (f & TELEMETRY::FLAG_AWAKE) != 0;
+            c["bat"] = hubs.batteryMv(h);
+            c["q"] = hubs.queued(h);
+            c["rssi"] = hubs.rssi(h);
+            JsonArray set = c.createNestedArray("set");
+            JsonArray lvl = c.createNestedArray("lvl");
+            for (uint8_t p = 0; p < HubStateStore::MAX_PORTS; p++) {
+                set.add(hubs.desiredLevel(h, p));
+                lvl.add(hubs.appliedLevel(h, p));
+            }
+        }
+        if (doc_.overflowed()) return 0;
+
+        return (encoding_ == ENCODING::FORMAT_MSGPACK)
+            ? serializeMsgPack(doc_, buffer_, sizeof(buffer_))
+            : serializeJson(doc_, buffer_, sizeof(buffer_));
+    }
+
+    size_t putU32(size_t pos, uint32_t value) {
+        for (uint8_t i = 0; i < 4; i++) buffer_[pos++] = (value >> (8 * i)) & 0xFF;
+        return pos;
+    }
+
+    // Singleton: private constructor and deleted copy operations
+    Telemetry() {}
+    Telemetry(const Telemetry&) = delete;
+    Telemetry& operator=(const Telemetry&) = delete;
+};
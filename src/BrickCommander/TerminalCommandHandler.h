@@ -5,6 +5,7 @@
  *        restart - Restart the ESP32 BrickCommander
  *        reset - Reset the configuration to defaults set in Configuration.h
  *        status - Obtain Heap information
+ *        profile start [hz] [ms] | stop | dump | clear - Sampling profiler (PROFILER only)
  *
  * Author: Robert W.B. Linn
  * Copyright © 2025 Robert W.B. Linn
@@ -17,6 +18,9 @@
 #include "Constants.h"
 #include "Log.h"
 #include "ConfigManager.h"
+#ifdef PROFILER
+#include "Profiler.h"
+#endif
 
 /**
  * @class TerminalCommandHandler
@@ -69,8 +73,43 @@ private:
         } else if (cmd == TERMINAL_COMMAND::STATUS) {
             LOGI("[TerminalCommandHandler][processCommand] Status: OK.");
             LOGIHEAP("HeapCheck");
+#ifdef PROFILER
+        } else if (cmd.startsWith(TERMINAL_COMMAND::PROFILE)) {
+            processProfileCommand(cmd.substring(strlen(TERMINAL_COMMAND::PROFILE)));
+#endif
         } else {
             LOGW("[TerminalCommandHandler][processCommand] Unknown command: ", cmd);
         }
     }
+
+#ifdef PROFILER
+    /**
+     * @brief Handle the arguments of the profile command, e.g. "start 997 10000".
+     */
+    void processProfileCommand(String args) {
+        Profiler& profiler = Profiler::getInstance();
+        args.trim();
+        if (args.startsWith("start")) {
+            // Optional rate and duration, separated by spaces
+            String rest = args.substring(5);
+            rest.trim();
+            int space = rest.indexOf(' ');
+            uint32_t hz = rest.isEmpty() ? CONFIG::PROFILER_HZ : rest.substring(0, space < 0 ? rest.length() : space).toInt();
+            uint32_t durationMs = space < 0 ? CONFIG::PROFILER_DURATION_MS : rest.substring(space + 1).toInt();
+            String error;
+            if (!profiler.start(hz, durationMs, CONFIG::PROFILER_CORES, error)) {
+                LOGE("[TerminalCommandHandler][processProfileCommand] %s", error.c_str());
+            }
+        } else if (args == "stop") {
+            profiler.stop();
+        } else if (args == "dump") {
+            profiler.stop();
+            profiler.dump();
+        } else if (args == "clear") {
+            profiler.clear();
+        } else {
+            LOGI("[TerminalCommandHandler][processProfileCommand] %s", profiler.statusJson().c_str());
+        }
+    }
+#endif
 };
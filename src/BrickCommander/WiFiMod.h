@@ -11,8 +11,13 @@
 #pragma once
 
 #include <WiFi.h>
+#include <esp_wifi.h>
+#include <BLEDevice.h>
 #include "Log.h"
 #include "Configuration.h"
+#include "Constants.h"
+#include "ConfigManager.h"
+#include "Metrics.h"
 #include "Pins.h"
 
 /**
@@ -39,6 +44,7 @@ public:
         if (WiFi.status() == WL_CONNECTED) {
             LOGI("[WiFi][connect] Connected with IP %s", WiFi.localIP().toString().c_str());
             setConnectedLED(true);
+            setPowerSave(config.wifi_power_save, config.wifi_listen_interval);
             return true;
         }
 
@@ -47,6 +53,35 @@ public:
         return false;
     }
 
+    /**
+     * @brief Starts an access point for local clients of the embedded broker,
+     *        used if the WiFi network is not found.
+     *
+     * @return true if the access point is running
+     */
+    bool startAccessPoint() {
+        WiFi.mode(WIFI_AP);
+        String password = config.apPassword();
+        accessPoint_ = WiFi.softAP(CONFIG::BROKER_AP_SSID, password.c_str());
+        if (accessPoint_) {
+            LOGI("[WiFi][startAccessPoint] Access point %s, password %s, IP %s",
+                 CONFIG::BROKER_AP_SSID, password.c_str(), WiFi.softAPIP().toString().c_str());
+            setConnectedLED(true);
+        } else {
+            LOGE("[WiFi][startAccessPoint] Access point %s failed.", CONFIG::BROKER_AP_SSID);
+        }
+        return accessPoint_;
+    }
+
+    /**
+     * @brief Checks if the access point is running.
+     *
+     * @return true if started with startAccessPoint()
+     */
+    bool isAccessPoint() const {
+        return accessPoint_;
+    }
+
     /**
      * @brief Checks if WiFi is currently connected.
      *
@@ -56,7 +91,90 @@ public:
         return WiFi.status() == WL_CONNECTED;
     }
 
+    /**
+     * @brief Sets the WiFi power-save mode and listen interval.
+     *
+     * "none" keeps the radio on so incoming packets are not held back until
+     * the next DTIM beacon. WiFi/BLE coexistence requires modem sleep, the
+     * ESP32 aborts if BLE runs with "none". It is therefore only applied while
+     * BLE is not initialised, otherwise "min" is applied instead. Call
+     * beforeBleInit() before BLEDevice::init().
+     * The listen interval is used by "max" and takes effect on the next association.
+     *
+     * @param mode "none", "min" or "max"
+     * @param listenInterval Beacon intervals between wake-ups (0 = driver default)
+     * @return true if the requested mode is active, false otherwise
+     */
+    bool setPowerSave(const String& mode, uint16_t listenInterval) {
+        uint8_t psMode;
+        wifi_ps_type_t psType;
+        if (mode == WIFI_POWER_SAVE::NONE) {
+            psMode = WIFI_POWER_SAVE::MODE_NONE;
+            psType = WIFI_PS_NONE;
+        } else if (mode == WIFI_POWER_SAVE::MIN) {
+            psMode = WIFI_POWER_SAVE::MODE_MIN;
+            psType = WIFI_PS_MIN_MODEM;
+        } else if (mode == WIFI_POWER_SAVE::MAX) {
+            psMode = WIFI_POWER_SAVE::MODE_MAX;
+            psType = WIFI_PS_MAX_MODEM;
+        } else {
+            LOGE("[WiFi][setPowerSave] Unknown power-save mode: %s", mode.c_str());
+            return false;
+        }
+
+        wifi_config_t wifiConfig;
+        if (esp_wifi_get_config(WIFI_IF_STA, &wifiConfig) == ESP_OK &&
+            wifiConfig.sta.listen_interval != listenInterval) {
+            wifiConfig.sta.listen_interval = listenInterval;
+            esp_wifi_set_config(WIFI_IF_STA, &wifiConfig);
+        }
+
+        bool ok = true;
+        if (psType == WIFI_PS_NONE && BLEDevice::getInitialized()) {
+            LOGW("[WiFi][setPowerSave] Mode %s not allowed while BLE runs, using %s", mode.c_str(), WIFI_POWER_SAVE::MIN);
+            psMode = WIFI_POWER_SAVE::MODE_MIN;
+            psType = WIFI_PS_MIN_MODEM;
+            ok = false;
+        }
+
+        esp_err_t err = esp_wifi_set_ps(psType);
+        if (err != ESP_OK) {
+            LOGW("[WiFi][setPowerSave] Mode %s rejected (err=0x%x), using %s", mode.c_str(), err, WIFI_POWER_SAVE::MIN);
+            psMode = WIFI_POWER_SAVE::MODE_MIN;
+            esp_wifi_set_ps(WIFI_PS_MIN_MODEM);
+            ok = false;
+        }
+
+        powerSaveMode_ = psMode;
+        metrics.setPowerSaveMode(psMode, listenInterval);
+        LOGI("[WiFi][setPowerSave] Power-save=%s, listen interval=%u", powerSaveName(psMode), listenInterval);
+        return ok;
+    }
+
+    /**
+     * @brief Lowers the power-save mode "none" to "min" before BLE is initialised.
+     *
+     * The configured mode is applied again with setPowerSave() once BLE is released.
+     */
+    void beforeBleInit() {
+        if (powerSaveMode_ == WIFI_POWER_SAVE::MODE_NONE) {
+            setPowerSave(WIFI_POWER_SAVE::MIN, config.wifi_listen_interval);
+        }
+    }
+
+    /**
+     * @brief Gets the active WiFi power-save mode.
+     *
+     * @return WIFI_POWER_SAVE::Mode
+     */
+    uint8_t getPowerSave() const {
+        return powerSaveMode_;
+    }
+
 private:
+    uint8_t powerSaveMode_ = WIFI_POWER_SAVE::MODE_MIN; ///< Active power-save mode
+    bool accessPoint_ = false;                          ///< Access point running instead of station
+
     /**
      * @brief Turns the connected LED on or off if defined.
      *
@@ -69,3 +187,5 @@ private:
 #endif
     }
 };
+
+inline WiFiMod wifi; // global instance
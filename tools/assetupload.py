@@ -0,0 +1,146 @@
+"""
+BrickCommander - assetupload
+----------------------------
+Uploads an asset (sequence, rule table, calibration curve, group definition
+or raw blob) into the BrickCommander asset store, lists or removes assets.
+
+The upload is started with {"asset":{"op":"begin",...}} on the config topic,
+the data is sent in chunks on the asset topic (offset u32 little-endian
+followed by the data) and activated with {"asset":{"op":"commit"}}. The
+asset is written into the inactive flash bank and only becomes visible
+with the commit, a failed upload leaves the stored assets unchanged.
+
+The version must be higher than the stored version of the asset, by default
+the stored version + 1 is used.
+
+Requires paho-mqtt.
+
+Usage:
+python3 assetupload.py --broker 192.168.1.10 upload loop1 loop1.bin --type sequence --record-size 4
+python3 assetupload.py --broker 192.168.1.10 list
+python3 assetupload.py --broker 192.168.1.10 remove loop1
+"""
+
+import argparse
+import json
+import queue
+import struct
+import sys
+import zlib
+import paho.mqtt.client as mqtt
+from brickcodec import decode
+
+TOPIC_BASE = "brickcommander"
+TOPIC_CONFIG = f"{TOPIC_BASE}/config"
+TOPIC_STATUS = f"{TOPIC_BASE}/status"
+TOPIC_ASSET = f"{TOPIC_BASE}/asset"
+
+ASSET_TYPES = ["raw", "sequence", "rules", "calibration", "group"]
+CHUNK_SIZE = 768        # Fits MQTT_BUFFER_SIZE and BROKER_PACKET_SIZE of the commander
+TIMEOUT_S = 10
+
+
+class AssetClient:
+    """Sends asset operations and waits for their status."""
+
+    def __init__(self, broker, port):
+        self.statuses = queue.Queue()
+        self.client = mqtt.Client()
+        self.client.on_message = lambda c, u, msg: self.statuses.put(decode(msg.payload))
+        self.client.connect(broker, port)
+        self.client.subscribe(TOPIC_STATUS)
+        self.client.loop_start()
+
+    def request(self, asset):
+        """Send an asset operation, return the message of its status or exit on error."""
+        self.drain()
+        self.client.publish(TOPIC_CONFIG, json.dumps({"asset": asset}), qos=1).wait_for_publish()
+        return self.wait()
+
+    def drain(self):
+        """Drop the statuses received so far."""
+        while not self.statuses.empty():
+            self.statuses.get_nowait()
+
+    def wait(self):
+        """Wait for the next status, exit on error or timeout."""
+        try:
+            status = self.statuses.get(timeout=TIMEOUT_S)
+        except queue.Empty:
+            sys.exit("No status from the BrickCommander")
+        if status.get("status") != "OK":
+            sys.exit(f"Error: {status.get('message')}")
+        return status.get("message", "")
+
+    def list(self):
+        """Return the asset list as dict, requested page by page."""
+        store = json.loads(self.request({"op": "list"}))
+        while "next" in store:
+            page = json.loads(self.request({"op": "list", "from": store["next"]}))
+            if page["gen"] != store["gen"]:
+                # Changed between two pages, start again
+                store = json.loads(self.request({"op": "list"}))
+                continue
+            store["assets"] += page["assets"]
+            store["next"] = page.get("next")
+            if store["next"] is None:
+                del store["next"]
+        return store
+
+    def upload(self, name, data, asset_type, version, record_size):
+        """Upload data as asset, return the commit status message."""
+        if version is None:
+            stored = [a for a in self.list()["assets"] if a["name"] == name]
+            version = stored[0]["v"] + 1 if stored else 1
+
+        self.request({"op": "begin", "name": name, "type": asset_type, "v": version,
+                      "len": len(data), "rs": record_size, "crc": zlib.crc32(data)})
+
+        # Chunks are acknowledged only on error, sent with QoS 1 so they arrive in order
+        for offset in range(0, len(data), CHUNK_SIZE):
+            chunk = struct.pack("<I", offset) + data[offset:offset + CHUNK_SIZE]
+            self.client.publish(TOPIC_ASSET, chunk, qos=1).wait_for_publish()
+            if not self.statuses.empty():
+                self.wait()
+            print(f"\r{min(offset + CHUNK_SIZE, len(data))}/{len(data)} bytes", end="", flush=True)
+        print()
+
+        return self.request({"op": "commit"})
+
+
+def main():
+    parser = argparse.ArgumentParser(description="BrickCommander asset store")
+    parser.add_argument("--broker", required=True)
+    parser.add_argument("--port", type=int, default=1883)
+    commands = parser.add_subparsers(dest="command", required=True)
+
+    upload = commands.add_parser("upload", help="Add or replace an asset")
+    upload.add_argument("name", help="Asset name, at most 15 characters")
+    upload.add_argument("file", help="Binary asset data")
+    upload.add_argument("--type", choices=ASSET_TYPES, default="raw")
+    upload.add_argument("--version", type=int, help="Default: stored version + 1")
+    upload.add_argument("--record-size", type=int, default=0, help="Size of one record, 0 = unstructured")
+
+    commands.add_parser("list", help="List the assets")
+
+    remove = commands.add_parser("remove", help="Remove an asset")
+    remove.add_argument("name")
+
+    args = parser.parse_args()
+    client = AssetClient(args.broker, args.port)
+
+    if args.command == "upload":
+        with open(args.file, "rb") as f:
+            data = f.read()
+        print(client.upload(args.name, data, args.type, args.version, args.record_size))
+    elif args.command == "list":
+        store = client.list()
+        for a in store["assets"]:
+            print(f"{a['name']:<16} {a['type']:<12} v{a['v']:<5} {a['len']:>8} bytes  record {a['rs']}")
+        print(f"generation {store['gen']}, {store['used']} bytes used, {store['free']} bytes free")
+    elif args.command == "remove":
+        print(client.request({"op": "remove", "name": args.name}))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,319 @@
+"""
+BrickCommander - benchmark
+--------------------------
+Scalability benchmark of the full BrickCommander against N simulated hubs.
+
+Requires a BrickCommander built with SIMULATED_HUBS defined in
+Configuration.h, an MQTT broker and paho-mqtt (matplotlib for the plots).
+The simulated hubs run through the same pipeline as real hubs: connect
+admission, asynchronous writes, backpressure, telemetry and metrics.
+
+Scenarios:
+- steady     Each hub gets --rate commands per second.
+- bursty     Consist starts: every --burst-period s all hubs get a power ramp
+             of 5 commands at once, quiet in between.
+- reconnect  Reconnect storms: every --storm-period s all simulated links are
+             dropped and every hub gets a command, so all hubs reconnect.
+- flood      As steady, with telemetry every 20 ms.
+
+For each scenario and hub count the result contains throughput (acknowledged
+commands/s), p50/p99 command latency (publish to status, matched by cid),
+loss (commands without OK status), free heap low-water mark, and the queue
+depths (connect queue, writes in flight, backpressure q).
+
+Output: <out>/results.csv and, if matplotlib is installed, one PNG per
+metric with a curve per scenario over the hub count.
+
+Usage:
+python3 benchmark.py --broker 192.168.1.10
+python3 benchmark.py --broker 192.168.1.10 --hubs 1,4,16 --scenarios steady,reconnect --latency 40 --loss 2
+"""
+
+import argparse
+import csv
+import json
+import os
+import threading
+import time
+import paho.mqtt.client as mqtt
+from brickcodec import decode
+
+TOPIC_BASE = "brickcommander"
+TOPIC_COMMAND = f"{TOPIC_BASE}/command"
+TOPIC_CONFIG = f"{TOPIC_BASE}/config"
+TOPIC_STATUS = f"{TOPIC_BASE}/status"
+TOPIC_BACKPRESSURE = f"{TOPIC_BASE}/backpressure"
+
+SCENARIOS = ["steady", "bursty", "reconnect", "flood"]
+FIELDS = ["scenario", "hubs", "sent", "ok", "loss_pct", "throughput", "p50_ms", "p99_ms",
+          "heap_min", "connect_queue_max", "writes_pending_max", "backpressure_q_max"]
+
+
+def percentile(values, pct):
+    """Nearest-rank percentile, None for no values."""
+    if not values:
+        return None
+    ordered = sorted(values)
+    rank = max(1, -(-len(ordered) * pct // 100))  # ceil
+    return ordered[int(rank) - 1]
+
+
+def hub_mac(index):
+    """MAC address of simulated hub 1…N (locally administered)."""
+    return f"02:00:00:00:00:{index:02X}"
+
+
+class Bench:
+    """MQTT connection to the BrickCommander and per-run bookkeeping."""
+
+    def __init__(self, args):
+        self.args = args
+        self.lock = threading.Lock()
+        self.sent = {}          # cid -> publish time
+        self.latency = []       # ms of acknowledged commands
+        self.errors = 0
+        self.bp_q_max = 0
+        self.expect = None      # (predicate, event, result list) for config replies
+        self.seq = 0
+
+        protocol = mqtt.MQTTv5 if args.mqtt5 else mqtt.MQTTv311
+        self.client = mqtt.Client(protocol=protocol)
+        self.client.on_message = self.on_message
+        self.client.connect(args.broker, args.port, 60)
+        self.client.subscribe(TOPIC_STATUS)
+        self.client.subscribe(TOPIC_BACKPRESSURE)
+        self.client.loop_start()
+
+    def on_message(self, client, userdata, msg):
+        #pylint: disable=unused-argument
+        now = time.monotonic()
+        try:
+            data = decode(msg.payload)
+        except ValueError:
+            return
+        if msg.topic == TOPIC_BACKPRESSURE:
+            with self.lock:
+                self.bp_q_max = max(self.bp_q_max, data.get("q", 0))
+            return
+
+        cid = data.get("cid")
+        props = getattr(msg, "properties", None)
+        for name, value in getattr(props, "UserProperty", []) or []:
+            if name == "cid":
+                cid = value
+        with self.lock:
+            if cid is not None and cid in self.sent:
+                start = self.sent.pop(cid)
+                if data.get("status") == "OK":
+                    self.latency.append((now - start) * 1000.0)
+                else:
+                    self.errors += 1
+                return
+            expect = self.expect
+        if expect and expect[0](data):
+            expect[2].append(data)
+            expect[1].set()
+
+    def config(self, payload, match, timeout=5.0):
+        """Publish to the config topic and wait for the status whose message contains match."""
+        event = threading.Event()
+        result = []
+        with self.lock:
+            self.expect = (lambda d: match in str(d.get("message", "")), event, result)
+        self.client.publish(TOPIC_CONFIG, json.dumps(payload))
+        if not event.wait(timeout):
+            raise TimeoutError(f"no reply to {payload}")
+        with self.lock:
+            self.expect = None
+        return result[0]
+
+    def metrics(self):
+        """Request the metrics (status=2) and return them as dict."""
+        reply = self.config({"status": 2}, '"gatt_write"')
+        return json.loads(reply["message"])
+
+    def command(self, hub, power):
+        """Send a power command to a simulated hub, tracked by cid."""
+        with self.lock:
+            self.seq += 1
+            cid = str(self.seq)
+            self.sent[cid] = time.monotonic()
+        cmd = {"controller": "simhub", "mac": hub_mac(hub), "port": 0, "power": power, "cid": cid}
+        self.client.publish(TOPIC_COMMAND, json.dumps(cmd))
+
+    def reset_run(self):
+        """Clear the per-run bookkeeping."""
+        with self.lock:
+            self.sent.clear()
+            self.latency.clear()
+            self.errors = 0
+            self.bp_q_max = 0
+
+    def wait_idle(self, timeout):
+        """Wait until all sent commands got a status or the timeout expired."""
+        end = time.monotonic() + timeout
+        while time.monotonic() < end:
+            with self.lock:
+                if not self.sent:
+                    return
+            time.sleep(0.05)
+
+
+def schedule(scenario, hubs, args):
+    """Yield (time offset s, hub, power, action) for a scenario run."""
+    duration = args.duration
+    if scenario in ("steady", "flood"):
+        interval = 1.0 / args.rate
+        t = 0.0
+        while t < duration:
+            for hub in range(1, hubs + 1):
+                # Spread the hubs over the interval
+                yield t + interval * (hub - 1) / hubs, hub, int(t * 10) % 100, None
+            t += interval
+    elif scenario == "bursty":
+        t = 0.0
+        while t < duration:
+            for power in (20, 40, 60, 80, 100):
+                for hub in range(1, hubs + 1):
+                    yield t, hub, power, None
+            t += args.burst_period
+    elif scenario == "reconnect":
+        t = 0.0
+        while t < duration:
+            yield t, 0, 0, "disconnect_all"
+            for hub in range(1, hubs + 1):
+                yield t, hub, 50, None
+            t += args.storm_period
+
+
+def run(bench, scenario, hubs, args):
+    """Run one scenario with a number of hubs and return its result row."""
+    link = {"latency_ms": args.latency, "jitter_ms": args.jitter,
+            "loss_pct": args.loss, "connect_ms": args.connect_ms}
+    bench.config({"sim": link}, "Simulated hubs updated")
+    interval = 20 if scenario == "flood" else args.telemetry_interval
+    bench.config({"telemetry_interval": interval}, "Telemetry")
+
+    # Connect all hubs first, the connect storm is measured by the reconnect scenario
+    for hub in range(1, hubs + 1):
+        bench.command(hub, 0)
+    bench.wait_idle(10 + hubs * (args.connect_ms / 1000.0 + 0.5))
+    bench.config({"status": 3}, "Metrics reset")
+    bench.reset_run()
+
+    start = time.monotonic()
+    sent = 0
+    for offset, hub, power, action in sorted(schedule(scenario, hubs, args), key=lambda e: e[0]):
+        delay = start + offset - time.monotonic()
+        if delay > 0:
+            time.sleep(delay)
+        if action == "disconnect_all":
+            bench.client.publish(TOPIC_CONFIG, json.dumps({"sim": {"disconnect_all": True}}))
+            continue
+        bench.command(hub, power)
+        sent += 1
+    elapsed = time.monotonic() - start
+
+    # Commands still in the connect queue need up to one connect per hub
+    bench.wait_idle(5 + hubs * (args.connect_ms / 1000.0 + 0.5))
+    metrics = bench.metrics()
+
+    with bench.lock:
+        latency = list(bench.latency)
+        bp_q_max = bench.bp_q_max
+    ok = len(latency)
+    p50 = percentile(latency, 50)
+    p99 = percentile(latency, 99)
+    return {
+        "scenario": scenario,
+        "hubs": hubs,
+        "sent": sent,
+        "ok": ok,
+        "loss_pct": round(100.0 * (sent - ok) / sent, 2) if sent else 0,
+        "throughput": round(ok / elapsed, 2),
+        "p50_ms": round(p50, 1) if p50 is not None else "",
+        "p99_ms": round(p99, 1) if p99 is not None else "",
+        "heap_min": metrics.get("heap", {}).get("min", ""),
+        "connect_queue_max": metrics.get("ble_connect", {}).get("queue_max", ""),
+        "writes_pending_max": metrics.get("gatt_write", {}).get("pending_max", ""),
+        "backpressure_q_max": bp_q_max,
+    }
+
+
+def plot(rows, out):
+    """One PNG per metric, a curve per scenario over the hub count."""
+    try:
+        import matplotlib  # pylint: disable=import-outside-toplevel
+        matplotlib.use("Agg")
+        import matplotlib.pyplot as plt  # pylint: disable=import-outside-toplevel
+    except ImportError:
+        print("[BENCH] matplotlib not installed, no plots")
+        return
+    for metric in FIELDS[4:]:
+        fig, ax = plt.subplots()
+        for scenario in sorted({r["scenario"] for r in rows}):
+            points = [(r["hubs"], r[metric]) for r in rows if r["scenario"] == scenario and r[metric] != ""]
+            if points:
+                ax.plot(*zip(*points), marker="o", label=scenario)
+        ax.set_xscale("log", base=2)
+        ax.set_xlabel("hubs")
+        ax.set_ylabel(metric)
+        ax.legend()
+        ax.grid(True)
+        fig.savefig(os.path.join(out, f"{metric}.png"))
+        plt.close(fig)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="BrickCommander multi-hub benchmark")
+    parser.add_argument("--broker", required=True)
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--mqtt5", action="store_true", help="BrickCommander built with MQTT_V5")
+    parser.add_argument("--hubs", default="1,2,4,8,16,32", help="hub counts, 1…32")
+    parser.add_argument("--scenarios", default=",".join(SCENARIOS))
+    parser.add_argument("--duration", type=float, default=20.0, help="s per run")
+    parser.add_argument("--rate", type=float, default=2.0, help="commands/s per hub (steady, flood)")
+    parser.add_argument("--burst-period", type=float, default=5.0, help="s between consist starts")
+    parser.add_argument("--storm-period", type=float, default=10.0, help="s between reconnect storms")
+    parser.add_argument("--latency", type=int, default=20, help="write round-trip ms per hub")
+    parser.add_argument("--jitter", type=int, default=10, help="random extra ms per write")
+    parser.add_argument("--loss", type=int, default=0, help="lost writes and failed connects in %%")
+    parser.add_argument("--connect-ms", type=int, default=800, help="duration of a connect")
+    parser.add_argument("--telemetry-interval", type=int, default=1000, help="ms, restored after each run")
+    parser.add_argument("--p99-limit", type=float, default=200.0, help="ms, for the hub count summary")
+    parser.add_argument("--out", default="benchmark-results")
+    args = parser.parse_args()
+
+    hub_counts = [n for n in (int(h) for h in args.hubs.split(",")) if 1 <= n <= 32]
+    scenarios = [s for s in args.scenarios.split(",") if s in SCENARIOS]
+    os.makedirs(args.out, exist_ok=True)
+
+    bench = Bench(args)
+    rows = []
+    for scenario in scenarios:
+        for hubs in hub_counts:
+            print(f"[BENCH] {scenario} with {hubs} hubs …")
+            row = run(bench, scenario, hubs, args)
+            print("[BENCH] " + ", ".join(f"{k}={row[k]}" for k in FIELDS[2:]))
+            rows.append(row)
+    bench.config({"telemetry_interval": args.telemetry_interval}, "Telemetry")
+
+    with open(os.path.join(args.out, "results.csv"), "w", newline="", encoding="utf-8") as f:
+        writer = csv.DictWriter(f, fieldnames=FIELDS)
+        writer.writeheader()
+        writer.writerows(rows)
+    plot(rows, args.out)
+
+    # Hubs per commander before p99 latency first exceeds the limit
+    for scenario in scenarios:
+        supported = 0
+        for r in sorted((r for r in rows if r["scenario"] == scenario), key=lambda r: r["hubs"]):
+            if r["p99_ms"] == "" or r["p99_ms"] > args.p99_limit:
+                break
+            supported = r["hubs"]
+        print(f"[BENCH] {scenario}: p99 <= {args.p99_limit} ms up to {supported} hubs")
+    print(f"[BENCH] Results in {args.out}/")
+
+
+if __name__ == "__main__":
+    main()
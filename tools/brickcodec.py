@@ -0,0 +1,171 @@
+"""
+BrickCommander - brickcodec
+---------------------------
+Decodes BrickCommander payloads in any of the encodings selectable per topic:
+- json     JSON text
+- msgpack  MessagePack, same structure as the JSON
+- fixed    Fixed binary telemetry schema (see TELEMETRY in Constants.h)
+
+The encoding is detected from the first byte, so clients do not need to know
+the configured encoding. All encodings decode to the same dict, e.g.:
+
+{"v": 1, "t": 123456, "rssi": -61, "heap": 182340,
+ "c": [{"mac": "90:84:2B:C1:94:79", "type": 1, "conn": True, "awake": False, "bat": 0, "q": 0}]}
+
+Uses the msgpack package if installed, else the built-in decoder.
+
+Usage:
+python3 brickcodec.py <hex payload>
+"""
+
+import json
+import struct
+import sys
+
+TELEMETRY_MAGIC = 0xC1
+TELEMETRY_HEADER = struct.Struct("<BBBbII")   # magic, version, count, rssi, uptime ms, free heap
+TELEMETRY_RECORDS = {
+    1: struct.Struct("<6sBBHBx"),          # mac, type, flags, battery mV, queued
+    2: struct.Struct("<6sBBHBb4b4b"),      # ... ble rssi, requested levels[4], acknowledged levels[4]
+}
+
+FLAG_CONNECTED = 0x01
+FLAG_AWAKE = 0x02
+
+CONTROLLER_TYPES = {1: "legohubno4", 2: "buwizz2", 3: "simhub"}
+
+try:
+    import msgpack as _msgpack
+except ImportError:
+    _msgpack = None
+
+
+def detect(payload: bytes) -> str:
+    """Return the encoding of a payload: json, msgpack or fixed."""
+    if not payload:
+        return "json"
+    first = payload[0]
+    if first == TELEMETRY_MAGIC:
+        return "fixed"
+    if first in b"{[\" \t\r\n" or payload.isascii():
+        return "json"
+    return "msgpack"
+
+
+def decode(payload: bytes):
+    """Decode a payload of any encoding into Python objects."""
+    encoding = detect(payload)
+    if encoding == "fixed":
+        return decode_fixed(payload)
+    if encoding == "msgpack":
+        return decode_msgpack(payload)
+    return json.loads(payload.decode("utf-8"))
+
+
+def decode_fixed(payload: bytes) -> dict:
+    """Decode a fixed schema telemetry message."""
+    magic, version, count, rssi, uptime, heap = TELEMETRY_HEADER.unpack_from(payload, 0)
+    record = TELEMETRY_RECORDS.get(version)
+    if magic != TELEMETRY_MAGIC or record is None:
+        raise ValueError(f"unsupported telemetry schema {magic:#x} v{version}")
+    controllers = []
+    offset = TELEMETRY_HEADER.size
+    for _ in range(count):
+        fields = record.unpack_from(payload, offset)
+        offset += record.size
+        mac, ctype, flags, battery, queued = fields[:5]
+        controller = {
+            "mac": ":".join(f"{b:02X}" for b in mac),
+            "type": ctype,
+            "conn": bool(flags & FLAG_CONNECTED),
+            "awake": bool(flags & FLAG_AWAKE),
+            "bat": battery,
+            "q": queued,
+        }
+        if version >= 2:
+            controller["rssi"] = fields[5]
+            controller["set"] = list(fields[6:10])
+            controller["lvl"] = list(fields[10:14])
+        controllers.append(controller)
+    return {"v": version, "t": uptime, "rssi": rssi, "heap": heap, "c": controllers}
+
+
+def decode_msgpack(payload: bytes):
+    """Decode MessagePack, with the msgpack package if available."""
+    if _msgpack is not None:
+        return _msgpack.unpackb(payload, raw=False)
+    value, _ = _unpack(payload, 0)
+    return value
+
+
+def _unpack(data: bytes, pos: int):
+    """Minimal MessagePack decoder for the types ArduinoJson writes."""
+    # pylint: disable=too-many-return-statements,too-many-branches
+    b = data[pos]
+    pos += 1
+    if b <= 0x7F:
+        return b, pos
+    if b >= 0xE0:
+        return b - 0x100, pos
+    if 0x80 <= b <= 0x8F:
+        return _unpack_map(data, pos, b & 0x0F)
+    if 0x90 <= b <= 0x9F:
+        return _unpack_array(data, pos, b & 0x0F)
+    if 0xA0 <= b <= 0xBF:
+        n = b & 0x1F
+        return data[pos:pos + n].decode("utf-8"), pos + n
+    if b == 0xC0:
+        return None, pos
+    if b == 0xC2:
+        return False, pos
+    if b == 0xC3:
+        return True, pos
+    fixed = {
+        0xCA: ">f", 0xCB: ">d",
+        0xCC: ">B", 0xCD: ">H", 0xCE: ">I", 0xCF: ">Q",
+        0xD0: ">b", 0xD1: ">h", 0xD2: ">i", 0xD3: ">q",
+    }
+    if b in fixed:
+        fmt = struct.Struct(fixed[b])
+        return fmt.unpack_from(data, pos)[0], pos + fmt.size
+    sized = {0xD9: ">B", 0xDA: ">H", 0xDB: ">I",   # str
+             0xC4: ">B", 0xC5: ">H", 0xC6: ">I",   # bin
+             0xDC: ">H", 0xDD: ">I",               # array
+             0xDE: ">H", 0xDF: ">I"}               # map
+    if b in sized:
+        fmt = struct.Struct(sized[b])
+        n = fmt.unpack_from(data, pos)[0]
+        pos += fmt.size
+        if b in (0xDC, 0xDD):
+            return _unpack_array(data, pos, n)
+        if b in (0xDE, 0xDF):
+            return _unpack_map(data, pos, n)
+        raw = data[pos:pos + n]
+        return (raw.decode("utf-8") if b >= 0xD9 else bytes(raw)), pos + n
+    raise ValueError(f"unsupported MessagePack type {b:#x} at {pos - 1}")
+
+
+def _unpack_array(data: bytes, pos: int, n: int):
+    items = []
+    for _ in range(n):
+        item, pos = _unpack(data, pos)
+        items.append(item)
+    return items, pos
+
+
+def _unpack_map(data: bytes, pos: int, n: int):
+    items = {}
+    for _ in range(n):
+        key, pos = _unpack(data, pos)
+        value, pos = _unpack(data, pos)
+        items[key] = value
+    return items, pos
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 2:
+        print(__doc__)
+        sys.exit(1)
+    raw = bytes.fromhex(sys.argv[1])
+    print(f"{detect(raw)} ({len(raw)} bytes)")
+    print(json.dumps(decode(raw), indent=2))
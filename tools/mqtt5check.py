@@ -0,0 +1,222 @@
+"""
+BrickCommander - mqtt5check
+---------------------------
+Interoperability check of the BrickCommander MQTT 5 client (MQTT_V5) against
+a MQTT 5 broker, e.g. Mosquitto 2.x.
+
+Requires a BrickCommander built with MQTT_V5 and SIMULATED_HUBS defined in
+Configuration.h and paho-mqtt. No real hubs are needed.
+
+Steps:
+1. Start Mosquitto with topic aliases enabled:
+       printf 'listener 1883\\nallow_anonymous true\\nmax_topic_alias 10\\n' > mosquitto.conf
+       mosquitto -v -c mosquitto.conf
+2. Flash the BrickCommander and set the broker (config topic, mqtt_broker).
+   The serial log shows "[Mqtt5Client][connect] Connected, broker topic
+   alias maximum=8" (at most 8 aliases are used).
+3. Run: python3 mqtt5check.py --broker <broker ip>
+4. Repeat with max_topic_alias 0 in mosquitto.conf, the BrickCommander then
+   sends full topic names only ("alias maximum=0").
+
+Checks:
+- connect        the simulated hub connects and its first status arrives
+- user-property  cid user property of a command returned with the status, with svc_ms
+- json-cid       cid command field returned as user property
+- error-cid      cid returned with a validation error (synchronous reply)
+- long-property  200 character cid, property length above 127 (2 byte varint)
+- alias          a series of statuses and telemetry messages arrive on their full
+                 topic names, the commander sends them as topic alias after the first
+- connection     the commander stays connected: Mosquitto disconnects a client
+                 on a malformed packet or an invalid topic alias, which publishes
+                 the last will "offline" on the availability topic
+
+Exit code 1 if a check failed.
+
+Usage:
+python3 mqtt5check.py --broker 192.168.1.10
+"""
+
+import argparse
+import json
+import sys
+import threading
+import time
+import paho.mqtt.client as mqtt
+from paho.mqtt.packettypes import PacketTypes
+from paho.mqtt.properties import Properties
+from brickcodec import decode
+
+TOPIC_BASE = "brickcommander"
+TOPIC_COMMAND = f"{TOPIC_BASE}/command"
+TOPIC_CONFIG = f"{TOPIC_BASE}/config"
+TOPIC_STATUS = f"{TOPIC_BASE}/status"
+TOPIC_AVAILABILITY = f"{TOPIC_BASE}/availability"
+TOPIC_TELEMETRY = f"{TOPIC_BASE}/telemetry"
+
+HUB_MAC = "02:00:00:00:00:01"
+SERIES = 20             # Statuses in a row for the alias check
+TIMEOUT_S = 5
+
+
+class Check:
+    """MQTT 5 connection to the BrickCommander, statuses matched by cid."""
+
+    def __init__(self, broker, port):
+        self.lock = threading.Lock()
+        self.replies = {}       # cid -> (data, user properties)
+        self.other = []         # statuses without cid
+        self.telemetry = 0
+        self.offline = False
+        self.failed = 0
+        self.seq = 0
+
+        self.client = mqtt.Client(protocol=mqtt.MQTTv5)
+        self.client.on_message = self.on_message
+        self.client.connect(broker, port, 60)
+        self.client.subscribe(TOPIC_STATUS)
+        self.client.subscribe(TOPIC_AVAILABILITY)
+        self.client.subscribe(TOPIC_TELEMETRY)
+        self.client.loop_start()
+
+    def on_message(self, client, userdata, msg):
+        #pylint: disable=unused-argument
+        with self.lock:
+            if msg.topic == TOPIC_AVAILABILITY:
+                if msg.payload == b"offline":
+                    self.offline = True
+                return
+            if msg.topic == TOPIC_TELEMETRY:
+                self.telemetry += 1
+                return
+            if msg.topic != TOPIC_STATUS:
+                print(f"[CHECK] Unexpected topic {msg.topic}")
+                self.failed += 1
+                return
+            try:
+                data = decode(msg.payload)
+            except ValueError:
+                return
+            props = dict(getattr(msg.properties, "UserProperty", []) or [])
+            if "cid" in props:
+                self.replies[props["cid"]] = (data, props)
+            else:
+                self.other.append(data)
+
+    def next_cid(self):
+        """Unique correlation id."""
+        self.seq += 1
+        return f"m5-{self.seq}"
+
+    def command(self, cmd, cid=None):
+        """Publish a command, with cid as user property if given."""
+        props = None
+        if cid is not None:
+            props = Properties(PacketTypes.PUBLISH)
+            props.UserProperty = [("cid", cid)]
+        self.client.publish(TOPIC_COMMAND, json.dumps(cmd), properties=props)
+
+    def wait_reply(self, cid, timeout=TIMEOUT_S):
+        """Wait for the status with cid, None on timeout."""
+        end = time.monotonic() + timeout
+        while time.monotonic() < end:
+            with self.lock:
+                if cid in self.replies:
+                    return self.replies.pop(cid)
+            time.sleep(0.02)
+        return None
+
+    def config(self, payload, match):
+        """Publish to the config topic and wait for the status whose message contains match."""
+        with self.lock:
+            self.other.clear()
+        self.client.publish(TOPIC_CONFIG, json.dumps(payload))
+        end = time.monotonic() + TIMEOUT_S
+        while time.monotonic() < end:
+            with self.lock:
+                if any(match in str(d.get("message", "")) for d in self.other):
+                    return True
+            time.sleep(0.02)
+        return False
+
+    def result(self, name, ok, detail=""):
+        """Print the result of a check."""
+        print(f"[CHECK] {name:<15} {'ok' if ok else 'FAILED'} {detail}")
+        if not ok:
+            self.failed += 1
+
+
+def power(value, cid=None):
+    """Power command for the simulated hub."""
+    cmd = {"controller": "simhub", "mac": HUB_MAC, "port": 0, "power": value}
+    if cid is not None:
+        cmd["cid"] = cid
+    return cmd
+
+
+def main():
+    parser = argparse.ArgumentParser(description="BrickCommander MQTT 5 interoperability check")
+    parser.add_argument("--broker", required=True)
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--telemetry-interval", type=int, default=1000, help="ms, restored after the check")
+    args = parser.parse_args()
+
+    check = Check(args.broker, args.port)
+    time.sleep(1)
+
+    # Connect the simulated hub first, the first status may wait for the connect
+    cid = check.next_cid()
+    check.command(power(0), cid)
+    reply = check.wait_reply(cid, TIMEOUT_S * 2)
+    check.result("connect", reply is not None and reply[0].get("status") == "OK", str(reply))
+
+    cid = check.next_cid()
+    check.command(power(30), cid)
+    reply = check.wait_reply(cid)
+    ok = reply is not None and reply[0].get("status") == "OK" and reply[1].get("svc_ms", "").isdigit()
+    check.result("user-property", ok, str(reply))
+
+    cid = check.next_cid()
+    check.command(power(40, cid))
+    reply = check.wait_reply(cid)
+    check.result("json-cid", reply is not None and reply[0].get("status") == "OK", str(reply))
+
+    cid = check.next_cid()
+    check.command({"controller": "simhub", "mac": HUB_MAC, "port": 9, "power": 50}, cid)
+    reply = check.wait_reply(cid)
+    check.result("error-cid", reply is not None and reply[0].get("status") == "ERROR", str(reply))
+
+    cid = "L" * 200
+    check.command(power(50), cid)
+    reply = check.wait_reply(cid)
+    check.result("long-property", reply is not None and reply[0].get("status") == "OK")
+
+    cids = [check.next_cid() for _ in range(SERIES)]
+    for i, c in enumerate(cids):
+        check.command(power(i * 5), c)
+    missing = [c for c in cids if check.wait_reply(c) is None]
+    check.result("alias", not missing, f"{SERIES - len(missing)}/{SERIES} statuses")
+
+    with check.lock:
+        check.telemetry = 0
+    if check.config({"telemetry_interval": 200}, "Telemetry"):
+        time.sleep(2)
+        with check.lock:
+            received = check.telemetry
+        check.config({"telemetry_interval": args.telemetry_interval}, "Telemetry")
+        check.result("alias", received >= 5, f"{received} telemetry messages")
+    else:
+        check.result("alias", False, "no reply to telemetry_interval")
+
+    check.command(power(0))
+    time.sleep(1)
+    with check.lock:
+        offline = check.offline
+    check.result("connection", not offline, "offline seen" if offline else "")
+
+    check.client.loop_stop()
+    check.client.disconnect()
+    sys.exit(1 if check.failed else 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,275 @@
+"""
+BrickCommander - profiler
+-------------------------
+Downloads the histogram of the on-device sampling profiler (Profiler.h) and
+symbolizes it against the firmware ELF.
+
+Requires a BrickCommander built with PROFILER defined in Configuration.h.
+The histogram is read
+- over MQTT (--broker): optionally started with --start, then requested with
+  {"profile":{"op":"dump"}} and received on the profile topic (paho-mqtt),
+- over serial (--serial): the terminal command "profile dump" (pyserial),
+- from a file (--file): a saved serial dump, or the --save output.
+
+The program counters are resolved with addr2line of the ESP32 toolchain
+(xtensa-esp32-elf-addr2line, see --addr2line). Arduino IDE keeps the ELF in
+the build folder, "Sketch > Export Compiled Binary" copies it to the sketch.
+
+Output: the samples per category (idle, ArduinoJson, String, Serial/log,
+BLE, WiFi/TCP, FreeRTOS, other) and the top functions, or source lines
+with --lines.
+
+Usage:
+python3 profiler.py --broker 192.168.1.10 --start 15 --elf build/BrickCommander.ino.elf
+python3 profiler.py --serial /dev/ttyUSB0 --elf BrickCommander.ino.elf --lines
+python3 profiler.py --file dump.txt --elf BrickCommander.ino.elf --core 1
+"""
+
+import argparse
+import json
+import queue
+import re
+import struct
+import subprocess
+import sys
+import time
+from collections import Counter, defaultdict
+
+TOPIC_BASE = "brickcommander"
+TOPIC_CONFIG = f"{TOPIC_BASE}/config"
+TOPIC_STATUS = f"{TOPIC_BASE}/status"
+TOPIC_PROFILE = f"{TOPIC_BASE}/profile"
+
+PROFILE_MAGIC = 0xC2
+PROFILE_HEADER = struct.Struct("<BBBBHHIII")    # magic, version, core, flags, hz, records, samples, dropped, isr cycles
+PROFILE_RECORD = struct.Struct("<II")           # pc, samples
+FLAG_LAST = 0x01
+
+# First match wins, tested against "function file"
+CATEGORIES = [
+    ("idle",        r"idle|esp_cpu_wait_for_intr|esp_pm_impl_waiti|cpu_ll_waiti"),
+    ("ArduinoJson", r"ArduinoJson"),
+    ("String",      r"\bString::|WString"),
+    ("Serial/log",  r"HardwareSerial|Print::|uart_|esp_log|printf"),
+    ("BLE",         r"/bt/|\bBLE[A-Z]|\b(btc|btu|btm|bta|gatt|l2c|hci|ble|r_ble|lld|r_lld)_"),
+    ("WiFi/TCP",    r"/lwip/|wifi|ieee80211|\b(pp|esf|wdev|lmac|net80211|tcp)_|ppTask|PubSubClient|WiFiClient"),
+    ("FreeRTOS",    r"/freertos/|\b(xTask|vTask|xQueue|xPort|vPort|prv)|_frxt_|_xt_"),
+]
+
+
+class Profile:
+    """Histogram of all cores: samples per pc, counters per core."""
+
+    def __init__(self):
+        self.hz = 0
+        self.pcs = defaultdict(Counter)     # core -> pc -> samples
+        self.cores = {}                     # core -> {"samples", "dropped", "isr_cycles"}
+
+    def add_message(self, payload):
+        """Add a binary profile message, return True if it was the last of its core."""
+        magic, _version, core, flags, hz, records, samples, dropped, cycles = PROFILE_HEADER.unpack_from(payload, 0)
+        if magic != PROFILE_MAGIC:
+            raise ValueError(f"not a profile message: {magic:#x}")
+        self.hz = hz
+        self.cores[core] = {"samples": samples, "dropped": dropped, "isr_cycles": cycles}
+        for i in range(records):
+            pc, count = PROFILE_RECORD.unpack_from(payload, PROFILE_HEADER.size + i * PROFILE_RECORD.size)
+            self.pcs[core][pc] += count
+        return bool(flags & FLAG_LAST)
+
+    def add_text(self, lines):
+        """Parse a serial dump: PROFILE, CORE and pc lines up to END."""
+        core = None
+        for line in lines:
+            fields = line.split()
+            if not fields:
+                continue
+            if fields[0] == "PROFILE":
+                self.hz = int(fields[2])
+            elif fields[0] == "CORE":
+                core = int(fields[1])
+                self.cores[core] = {"samples": int(fields[2]), "dropped": int(fields[3]),
+                                    "isr_cycles": int(fields[4])}
+            elif fields[0] == "END":
+                return True
+            elif core is not None and len(fields) == 2 and re.fullmatch(r"[0-9a-fA-F]{8}", fields[0]):
+                self.pcs[core][int(fields[0], 16)] += int(fields[1])
+        return False
+
+    def to_text(self):
+        """Serial dump format, for --save."""
+        lines = [f"PROFILE 1 {self.hz}"]
+        for core in sorted(self.cores):
+            c = self.cores[core]
+            lines.append(f"CORE {core} {c['samples']} {c['dropped']} {c['isr_cycles']}")
+            lines += [f"{pc:08x} {count}" for pc, count in sorted(self.pcs[core].items())]
+        lines.append("END")
+        return "\n".join(lines) + "\n"
+
+
+def read_mqtt(args):
+    """Start (optional) and download the profile over MQTT."""
+    import paho.mqtt.client as mqtt  # pylint: disable=import-outside-toplevel
+    from brickcodec import decode   # pylint: disable=import-outside-toplevel
+
+    messages = queue.Queue()
+    client = mqtt.Client()
+    client.on_message = lambda c, u, msg: messages.put((msg.topic, msg.payload))
+    client.connect(args.broker, args.port)
+    client.subscribe([(TOPIC_STATUS, 0), (TOPIC_PROFILE, 0)])
+    client.loop_start()
+
+    def request(op, **fields):
+        client.publish(TOPIC_CONFIG, json.dumps({"profile": dict(op=op, **fields)}), qos=1).wait_for_publish()
+
+    if args.start:
+        request("start", hz=args.hz, duration_ms=int(args.start * 1000), cores=args.cores)
+        print(f"Sampling {args.start} s at {args.hz} Hz …", file=sys.stderr)
+        time.sleep(args.start + 0.5)
+
+    profile = Profile()
+    request("dump")
+    deadline = time.time() + 10
+    while time.time() < deadline:
+        try:
+            topic, payload = messages.get(timeout=1)
+        except queue.Empty:
+            continue
+        if topic == TOPIC_PROFILE:
+            profile.add_message(payload)
+            continue
+        status = decode(payload)
+        if str(status.get("message", "")).startswith("Profile sent"):
+            break
+        if status.get("status") != "OK":
+            sys.exit(f"Error: {status.get('message')}")
+    else:
+        sys.exit("No profile from the BrickCommander")
+    client.loop_stop()
+    return profile
+
+
+def read_serial(args):
+    """Download the profile with the terminal command profile dump."""
+    import serial  # pylint: disable=import-outside-toplevel
+
+    with serial.Serial(args.serial, args.baud, timeout=5) as port:
+        if args.start:
+            port.write(f"profile start {args.hz} {int(args.start * 1000)}\n".encode())
+            print(f"Sampling {args.start} s at {args.hz} Hz …", file=sys.stderr)
+            time.sleep(args.start + 0.5)
+        port.reset_input_buffer()
+        port.write(b"profile dump\n")
+
+        lines = []
+        started = False
+        while True:
+            line = port.readline().decode("utf-8", "replace")
+            if not line:
+                sys.exit("No profile from the BrickCommander")
+            started = started or line.startswith("PROFILE ")
+            if started:
+                lines.append(line)
+                if line.startswith("END"):
+                    break
+    profile = Profile()
+    profile.add_text(lines)
+    return profile
+
+
+def symbolize(pcs, elf, addr2line):
+    """Resolve program counters to (function, file:line) with addr2line."""
+    if not pcs:
+        return {}
+    addresses = "\n".join(f"{pc:#x}" for pc in pcs) + "\n"
+    result = subprocess.run([addr2line, "-f", "-C", "-e", elf], input=addresses,
+                            capture_output=True, text=True, check=True)
+    lines = result.stdout.splitlines()
+    return {pc: (lines[2 * i], lines[2 * i + 1]) for i, pc in enumerate(pcs)}
+
+
+def category(function, location):
+    """Category of a symbol, see CATEGORIES."""
+    text = f"{function} {location}"
+    for name, pattern in CATEGORIES:
+        if re.search(pattern, text):
+            return name
+    return "other"
+
+
+def report(profile, symbols, args):
+    """Print the categories and the top functions or lines."""
+    cores = [args.core] if args.core is not None else sorted(profile.cores)
+    samples = Counter()
+    for core in cores:
+        samples.update(profile.pcs[core])
+    total = sum(samples.values())
+
+    for core in cores:
+        c = profile.cores.get(core, {"samples": 0, "dropped": 0, "isr_cycles": 0})
+        print(f"core {core}: {c['samples']} samples at {profile.hz} Hz, {c['dropped']} dropped, "
+              f"{c['isr_cycles']} cycles per sample")
+    if total == 0:
+        return
+
+    by_category = Counter()
+    by_key = Counter()
+    where = {}
+    for pc, count in samples.items():
+        function, location = symbols.get(pc, ("??", "??:0"))
+        by_category[category(function, location)] += count
+        key = location if args.lines else function
+        if function == "??":
+            key = f"{pc:#010x}"
+        by_key[key] += count
+        where.setdefault(key, location if not args.lines else function)
+
+    print(f"\n{'category':<14} {'samples':>8} {'%':>6}")
+    for name, count in by_category.most_common():
+        print(f"{name:<14} {count:>8} {100 * count / total:>6.1f}")
+
+    print(f"\n{'samples':>8} {'%':>6}  {'line' if args.lines else 'function'}")
+    for key, count in by_key.most_common(args.top):
+        print(f"{count:>8} {100 * count / total:>6.1f}  {key}  [{where[key]}]")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="BrickCommander sampling profiler")
+    source = parser.add_mutually_exclusive_group(required=True)
+    source.add_argument("--broker", help="Download over MQTT")
+    source.add_argument("--serial", help="Download over the serial port, e.g. /dev/ttyUSB0")
+    source.add_argument("--file", help="Read a saved dump")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("--start", type=float, help="Sample this many seconds before the download")
+    parser.add_argument("--hz", type=int, default=997)
+    parser.add_argument("--cores", type=int, default=3, help="Sampled cores, bit 0 = core 0")
+    parser.add_argument("--elf", help="Firmware ELF, without it the raw program counters are shown")
+    parser.add_argument("--addr2line", default="xtensa-esp32-elf-addr2line")
+    parser.add_argument("--core", type=int, help="Report one core only")
+    parser.add_argument("--lines", action="store_true", help="Top source lines instead of functions")
+    parser.add_argument("--top", type=int, default=25)
+    parser.add_argument("--save", help="Save the downloaded dump to a file")
+    args = parser.parse_args()
+
+    if args.broker:
+        profile = read_mqtt(args)
+    elif args.serial:
+        profile = read_serial(args)
+    else:
+        profile = Profile()
+        with open(args.file, encoding="utf-8") as f:
+            if not profile.add_text(f):
+                sys.exit(f"No complete profile in {args.file}")
+
+    if args.save:
+        with open(args.save, "w", encoding="utf-8") as f:
+            f.write(profile.to_text())
+
+    pcs = sorted({pc for counts in profile.pcs.values() for pc in counts})
+    symbols = symbolize(pcs, args.elf, args.addr2line) if args.elf else {}
+    report(profile, symbols, args)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,57 @@
+"""
+BrickCommander - telemetry_monitor
+----------------------------------
+Subscribes to the telemetry and status topics and prints the decoded
+payloads with their encoding and size, independent of the encoding set on
+the BrickCommander.
+
+Requires paho-mqtt.
+
+Usage:
+python3 telemetry_monitor.py <broker> [port]
+
+Switch the encodings via the config topic, e.g.:
+mosquitto_pub -t brickcommander/config -m '{"telemetry_encoding":"fixed","status_encoding":"msgpack"}'
+"""
+
+import json
+import sys
+import paho.mqtt.client as mqtt
+from brickcodec import decode, detect, CONTROLLER_TYPES
+
+TOPICS = ["brickcommander/telemetry", "brickcommander/status"]
+
+
+def on_connect(client, userdata, flags, rc):
+    #pylint: disable=unused-argument
+    for topic in TOPICS:
+        client.subscribe(topic)
+    print(f"[MONITOR] Connected (rc={rc}), subscribed to {', '.join(TOPICS)}")
+
+
+def on_message(client, userdata, msg):
+    #pylint: disable=unused-argument
+    try:
+        data = decode(msg.payload)
+    except Exception as e:
+        print(f"[MONITOR] {msg.topic}: cannot decode {msg.payload.hex()}: {e}")
+        return
+    print(f"[MONITOR] {msg.topic} {detect(msg.payload)} {len(msg.payload)} bytes")
+    if msg.topic.endswith("/telemetry"):
+        print(f"  uptime={data['t']} ms rssi={data['rssi']} dBm heap={data['heap']}")
+        for c in data["c"]:
+            name = CONTROLLER_TYPES.get(c["type"], c["type"])
+            print(f"  {c['mac']} {name:<10} conn={c['conn']} awake={c['awake']} bat={c['bat']} mV q={c['q']}")
+    else:
+        print(f"  {json.dumps(data)}")
+
+
+if __name__ == "__main__":
+    if len(sys.argv) < 2:
+        print(__doc__)
+        sys.exit(1)
+    client = mqtt.Client()
+    client.on_connect = on_connect
+    client.on_message = on_message
+    client.connect(sys.argv[1], int(sys.argv[2]) if len(sys.argv) > 2 else 1883, 60)
+    client.loop_forever()